@@ -175,6 +175,9 @@ import serial
 import queue
 import copy
 import threading
+import asyncio
+import re
+import sys
 
 class Comms(object):
     @classmethod
@@ -238,6 +241,40 @@ class Comms(object):
                 crc ^= 0x8C
         return crc
 
+    @staticmethod
+    def crc8Block(data, crc=0):
+        """crc8() over a whole block at once, one table lookup per byte."""
+        table = CRC8_TABLE
+        for b in data:
+            crc = table[crc ^ b]
+        return crc
+
+# crc of every byte value, the same as crc8(b, 0)
+CRC8_TABLE = bytes(Comms.crc8(b, 0) for b in range(256))
+
+# bytes that are escaped, as (byte, escape sequence). The escape character goes first, its
+# sequence doesn't contain any of the others
+_ESCAPES = [(bytes((b,)), bytes((Comms.PACKET_ESCAPE, ~b & 0xFF)))
+            for b in (Comms.PACKET_ESCAPE, Comms.PACKET_START, Comms.PACKET_END)]
+_UNESCAPE = re.compile(bytes((Comms.PACKET_ESCAPE,)) + b"(.)", re.DOTALL)
+
+def escape(data):
+    """Escapes the bytes 0x50, 0x55 and 0x5A in data."""
+    data = bytes(data)
+    for b, sequence in _ESCAPES:
+        data = data.replace(b, sequence)
+    return data
+
+def unescape(data):
+    """Undoes escape()."""
+    return _UNESCAPE.sub(lambda match: bytes((~match.group(1)[0] & 0xFF,)), data)
+
+def encodeFrame(packet):
+    """Builds the frame of a packet: start byte, escaped packet and crc, stop byte."""
+    packet = bytes(packet)
+    return (bytes((Comms.PACKET_START,)) + escape(packet + bytes((Comms.crc8Block(packet),))) +
+            bytes((Comms.PACKET_END,)))
+
 class CommsListener(object, metaclass=ABCMeta):
     """Interface for a class which accepts packets as an alternative to using a simple callback function."""
     @abstractmethod
@@ -325,12 +362,11 @@ class CommsPortSerial(CommsPort):
             raise
         
     def ThreadTarget(self):
-        b = None
-        while self.ser.isOpen():    
-            #print("read thread")        
-            b = self.ser.read()
-            if b:
-                self.PacketParser.parseByte(b)
+        while self.ser.isOpen():
+            # block for one byte, then take whatever else has arrived in one go
+            data = self.ser.read(max(1, self.ser.in_waiting))
+            if data:
+                self.PacketParser.parseData(data)
     
     def PacketParserHandler(self, data):
         #raise Exception("skdbhfsjdhfbjhrbfr")
@@ -539,8 +575,8 @@ class CommsPacketBuilder(object):
         if not (isinstance(Data, bytearray) or isinstance(Data, bytes)):
             raise TypeError()
 
-        for b in iter(Data):
-            self.AddChar(b)
+        self._buffer += escape(Data)
+        self.crc = Comms.crc8Block(Data, self.crc)
 
     def AddChar(self, b):
         if (b == Comms.PACKET_START or \
@@ -559,54 +595,187 @@ class CommsPacketBuilder(object):
         self.Reset()
         return A
 
+class CommsStreamDecoder(object):
+    """Incremental frame decoder. Takes the received bytes in chunks of any size and returns the
+    packets (without crc) of the frames that are complete and valid."""
+
+    def __init__(self):
+        self._pending = bytearray()
+        self.dropped = 0
+
+    def reset(self):
+        self._pending.clear()
+
+    def feed(self, data):
+        self._pending += data
+        packets = []
+        while True:
+            start = self._pending.find(Comms.PACKET_START)
+            if start < 0:
+                # nothing but noise
+                self._pending.clear()
+                return packets
+            end = self._pending.find(Comms.PACKET_END, start + 1)
+            if end < 0:
+                # keep the partial frame for the next chunk
+                del self._pending[:start]
+                return packets
+
+            # a start byte inside the frame means the previous one was broken
+            restart = self._pending.rfind(Comms.PACKET_START, start, end)
+            frame = unescape(bytes(self._pending[restart + 1:end]))
+            del self._pending[:end + 1]
+            if restart != start:
+                self.dropped += 1
+            if len(frame) >= 4 and not Comms.crc8Block(frame):
+                packets.append(bytearray(frame[:-1]))
+            else:
+                self.dropped += 1
+
 class CommsPacketParser(object):
     """Reads and procceses data."""
     
     def __init__(self):
         self._PacketHandler = None
-        self._buffer = bytearray()
-        self.rxCrc = 0
-        self.rxState = Comms.RXS_idle
+        self._decoder = CommsStreamDecoder()
 
     def Reset(self):
-        self._buffer.clear()
+        self._decoder.reset()
         
     def parseByte(self, b):
-        b = b[0]
-        if b == Comms.PACKET_START:
-            self._buffer.clear();
-            self.rxCrc = 0
-            self.rxState = Comms.RXS_receiving
-            return
-
-        if self.rxState == Comms.RXS_idle:
-            return
-
-        if b == Comms.PACKET_END:
-            if not self.rxCrc:
-                self._PacketHandler(self._buffer[:-1])
-            self.rxState = Comms.RXS_idle
-
-        if b == Comms.PACKET_ESCAPE:
-            self.rxState = Comms.RXS_escaping
-            return
-
-        if self.rxState == Comms.RXS_escaping:
-            self.rxState = Comms.RXS_receiving
-            b = (~b)&0xFF
-
-        self._buffer.append(b)
-        self.rxCrc = Comms.crc8(b, self.rxCrc)
+        self.parseData(b)
 
     def parseData(self, data):
-        for b in data:
-            self.parseByte(bytes((b,)))
+        for packet in self._decoder.feed(data):
+            self._PacketHandler(packet)
 
     def setPacketHandler(self, handler):
         ''' handler function must have one parameter'''
         self._PacketHandler = handler
         self.Reset()
 
+class CommsTimeout(Exception):
+    """Raised when a command got no reply, after all retries."""
+
+class CommsAsyncClient(object):
+    """Pipelined command client for asyncio. Up to the window size of commands are in flight at
+    once, each with its own sequence number, so replies are matched to their commands by sequence
+    number and command id. A command that gets no reply within timeout is sent again, up to
+    retries times. Frames are handed to write() as bytes, received bytes go to feed(), which must
+    be called from the event loop (see CommsSerialTransport).
+    Asynchronous and broadcast packets go to asyncHandler(source, command, data) if set."""
+
+    SEQUENCE_COUNT = 4
+
+    def __init__(self, write, destination=Comms.ADDRESS_UNKNOWN, timeout=0.5, retries=3):
+        self._write = write
+        self.destination = destination
+        self.timeout = timeout
+        self.retries = retries
+        self.asyncHandler = None
+        self.window = 1
+        self.retransmissions = 0
+
+        self._decoder = CommsStreamDecoder()
+        self._free = list(range(self.SEQUENCE_COUNT))
+        self._pending = {} # sequence: (command, future)
+        self._slots = None
+
+    def feed(self, data):
+        for packet in self._decoder.feed(data):
+            self._handlePacket(packet)
+
+    def _handlePacket(self, packet):
+        flags = packet[0] & Comms.FLAGS_MASK
+        sequence = (packet[1] & Comms.FLAGS_MASK) >> 6
+        command = packet[2]
+        data = bytes(packet[3:])
+
+        if flags != Comms.FLAGS_REPLY:
+            if self.asyncHandler:
+                self.asyncHandler(packet[0] & Comms.ADDRESS_MASK, command, data)
+            return
+
+        pending = self._pending.get(sequence)
+        # a reply to a command that has been retried or given up on already
+        if pending is None or command not in (pending[0], Comms.COMMAND_NACK):
+            return
+        if not pending[1].done():
+            pending[1].set_result((command, data))
+
+    async def _acquire(self):
+        if self._slots is None:
+            self._slots = asyncio.Semaphore(self.window)
+        await self._slots.acquire()
+        return self._free.pop(0)
+
+    def _release(self, sequence):
+        del self._pending[sequence]
+        self._free.append(sequence)
+        self._slots.release()
+
+    async def command(self, command, data=b"", destination=None):
+        """Sends a command and returns the reply as (command, data). The command is
+        Comms.COMMAND_NACK if the device didn't accept it. Raises CommsTimeout.
+        destination overrides the address of the client for this command."""
+        if destination is None:
+            destination = self.destination
+        sequence = await self._acquire()
+        header = bytes((Comms.FLAGS_COMMAND | Comms.ADDRESS_UNKNOWN,
+                        (sequence << 6) | (destination & Comms.ADDRESS_MASK), command))
+        frame = encodeFrame(header + bytes(data))
+        try:
+            for attempt in range(self.retries + 1):
+                future = asyncio.get_running_loop().create_future()
+                self._pending[sequence] = (command, future)
+                if attempt:
+                    self.retransmissions += 1
+                self._write(frame)
+                try:
+                    return await asyncio.wait_for(future, self.timeout)
+                except asyncio.TimeoutError:
+                    pass
+            raise CommsTimeout("no reply to command 0x{:02X}".format(command))
+        finally:
+            self._release(sequence)
+
+    async def commands(self, commands):
+        """Sends a list of (command, data) pipelined and returns their replies in the same order."""
+        return await asyncio.gather(*(self.command(command, data) for command, data in commands))
+
+    async def negotiateWindow(self):
+        """Asks the device for its window size (message 0x08) and uses it from now on. Devices
+        that don't know the message get a window of 1. Returns the window."""
+        command, data = await self.command(Comms.COMMAND_WINDOW_SIZE)
+        window = data[0] if command == Comms.COMMAND_WINDOW_SIZE and data else 1
+        self.window = max(1, min(window, self.SEQUENCE_COUNT))
+        # commands in flight keep the old semaphore, there are none while negotiating
+        self._slots = asyncio.Semaphore(self.window)
+        return self.window
+
+class CommsSerialTransport(object):
+    """Connects a CommsAsyncClient to a serial port. A thread reads the port and hands the bytes
+    to the event loop, writes go out directly."""
+
+    def __init__(self, name, baudrate=38400, WriteTimeout=1, **kwargs):
+        self.ser = serial.Serial(name, baudrate, timeout=0.1, writeTimeout=WriteTimeout)
+        self.client = CommsAsyncClient(self.ser.write, **kwargs)
+        self._loop = asyncio.get_running_loop()
+        self._thread = threading.Thread(target=self._read, daemon=True)
+        self._thread.start()
+
+    def _read(self):
+        while self.ser.isOpen():
+            try:
+                data = self.ser.read(max(1, self.ser.in_waiting))
+            except (serial.SerialException, TypeError):
+                # closed under our feet
+                return
+            if data:
+                self._loop.call_soon_threadsafe(self.client.feed, data)
+
+    def close(self):
+        self.ser.close()
 
 if __name__ == "__main__":
     print('''Welcome to the Launchbox protocol TEZTER.
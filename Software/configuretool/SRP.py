@@ -3,6 +3,10 @@ from serial.tools import list_ports
 import struct
 import sys
 import math
+import asyncio
+import argparse
+import os
+import time
 
 BAUD = 38400
 
@@ -11,8 +15,17 @@ Supported commands are:
 help: print this help page
 quit: quits the interface
 list: print the list of available keys
-get {keyname}: gets a key from the SRP board. See the list command for a list of keys
-set {keyname} {value}: sets a key on the SRP board. See the list command for a list of keys"""
+get {keyname} [{keyname} ...]: gets keys from the SRP board. See the list command for a list of keys
+set {keyname} {value} [{keyname} {value} ...]: sets keys on the SRP board. See the list command for a list of keys
+dump [{filename}]: gets the whole configuration at once, and optionally saves it to a file
+load {filename}: sets all keys in a file made by dump at once
+discover: reads the list of keys, their sizes and limits from the SRP board
+telemetry {rate}: makes the SRP board push its status {rate} times per second (1-50), 0 stops it
+log: downloads the flight event log from the SRP board
+diagnostics [reset]: prints the timing statistics and link error counters of a profiling build, or clears them
+selftest [start]: prints the report of the last pre-flight self-test, or starts one. The board has to be in idle
+status: prints the state, inputs, battery, warnings, link errors and uptime of the SRP board in one go
+To configure many boards at once, run SRP.py fleet -h instead"""
 
 
 # calculation constants
@@ -31,7 +44,15 @@ PACKET_NAMES = {
     "servo_closed_position": 0x06,
     "servo_open_position"  : 0x07,
     "servo_position"       : 0x08,
-    "address"              : 0x09
+    "address"              : 0x09,
+    "baud_rate"            : 0x0A,
+    "battery_voltage_precise": 0x0B,
+    "servo_output"         : 0x0C,
+    "servo_min_pulse"      : 0x0D,
+    "servo_max_pulse"      : 0x0E,
+    "servo_slew"           : 0x0F,
+    "vote_peers"           : 0x10,
+    "vote_quorum"          : 0x11
 }
 
 PACKET_NUMBERS = {num: name for name, num in PACKET_NAMES.items()}
@@ -46,9 +67,94 @@ PACKET_SIZE = {
     0x06: "<B",
     0x07: "<B",
     0x08: "<B",
-    0x09: "<B"
+    0x09: "<B",
+    0x0A: "<B",
+    0x0B: "<H",
+    0x0C: "<B",
+    0x0D: "<H",
+    0x0E: "<H",
+    0x0F: "<B",
+    0x10: "<B",
+    0x11: "<B"
 }
 
+# keys from this code on have no single getter and setter, they go through the batch messages
+SINGLE_ACCESS_CODES = 0x10
+
+# batch access, with [key][size][value] entries
+GET_PARAMETERS = 0x30
+SET_PARAMETERS = 0x31
+PARAMETERS_FROM = 0x80 # asks for the configuration from a key code on
+MAX_DATA = 29 # packet data the board can receive
+
+# parameter table discovery, see params.h in the firmware
+GET_PARAMETER_INFO = 0x32
+PARAM_READ = 0x01
+PARAM_WRITE = 0x02
+PARAM_CONFIG = 0x04
+PARAM_LIVE = 0x08
+PARAM_WIDE = 0x10
+
+# discovered (flags, min, max) per key code
+PARAMETER_INFO = {}
+
+# telemetry subscription, the packets are [state][inputs][battery][flight time in ms][buzzer pattern]
+TELEMETRY_COMMAND = 0x33
+TELEMETRY = "<BBHIB"
+INPUT_NAMES = ["vote", "armed", "breakwire", "squib"]
+BUZZER_PATTERNS = ["-", "ok", "cancel", "error", "flight", "deployed", "bit_0", "bit_1", "end", "song"]
+
+# flight event log download, see logger.h in the firmware
+LOG_COMMAND = 0x34
+LOG_RECORD = "<BBBH" # sequence, event, data, delta in ms
+LOG_RECORD_SIZE = struct.calcsize(LOG_RECORD)
+
+LOG_EVENTS = {
+    0x01: "boot",
+    0x02: "state",
+    0x03: "breakwire",
+    0x04: "vote",
+    0x05: "battery_min",
+    0x06: "deploy",
+    0x07: "peer_vote"
+}
+VOTE_REASONS = ["withdrawn", "apogee", "timer", "other"]
+
+# instrumentation of a profiling build, see profiling.h in the firmware
+DIAGNOSTICS_COMMAND = 0x35
+DIAGNOSTICS_RESET = 0xFF
+DIAGNOSTICS_SECTION = "<BHHHH" # section, min, max, average in timer counts, samples
+DIAGNOSTICS_SECTIONS = ["rx", "tx", "scheduler", "tick", "state_machine", "loop",
+                        "tick_latency", "task_latency", "loop_latency"]
+DIAGNOSTICS_COUNTERS = ["uart_overrun", "uart_frame", "crc_drop", "tx_busy"]
+TIMER_COUNT_US = 625 / 576
+
+# pre-flight self-test, see test.h in the firmware. The report of a started test follows asynchronously
+SELF_TEST_COMMAND = 0x36
+SELF_TEST_START = 1
+SELF_TEST_REPORT = "<BBBBBHHH" # state, failures, continuity, battery, battery min, settle ms, latency max, latency avg
+SELF_TEST_STATES = ["not run", "running", "done"]
+SELF_TEST_FAILURES = ["battery", "servo", "continuity", "timing", None, None, None, "aborted"]
+SELF_TEST_CONTINUITY = ["low pulse", "high pulse"]
+
+# everything at once, see get_status() in the firmware. The name of the state follows
+STATUS_COMMAND = 0x38
+STATUS = "<BBHBBBBI" # state, inputs, battery, warnings, uart errors, crc errors, frame errors, uptime in ms
+STATUS_WARNINGS = ["battery", "squib", "self-test", "uncommitted"]
+
+# fleet mode, see fleet_main()
+FLEET_HELP = """Reads, compares or writes the configuration of every board on every serial port in parallel.
+dump [{directory}]: gets the configuration of every board, and optionally saves each to a file in directory
+status: gets the state, warnings and link errors of every board with a single command each
+diff {filename}: compares the configuration of every board with a file made by dump
+load {filename}: writes the keys that differ from a file made by dump, and reads them back to check"""
+FLEET_TIMEOUT = 0.2 # seconds before a command is sent again
+FLEET_RETRIES = 2
+FLEET_SCAN_TIMEOUT = 0.05
+LINK_KEYS = ("address", "baud_rate") # differences that are shown in parentheses, but never written
+
+STATE_NAMES = ["ERROR", "SYSTEMS_CHECK", "IDLE", "PREPARATION", "ARMED", "LAUNCHED", "DEPLOYED"]
+
 # parsing functions
 
 def val_int(value):
@@ -70,6 +176,13 @@ def parse_time(seconds):
 def revparse_time(ticks):
     return ticks * TIME_DELTA
 
+def parse_time_ms(seconds):
+    seconds = val_float(seconds)
+    return int(seconds * 1000)
+
+def revparse_time_ms(ms):
+    return ms / 1000
+
 def parse_voltage(voltage):
     voltage = val_float(voltage) - 0.4
     return int(voltage / VDIV / RESOLUTION)
@@ -79,6 +192,26 @@ def revparse_voltage(value):
         return "Unknown"
     return value * RESOLUTION * VDIV + 0.4
 
+# baud rates selectable on the board, indexed like the LBP_BAUD_* defines in the firmware
+BAUD_RATES = [38400, 57600, 115200, 230400]
+
+def parse_baud_rate(baud):
+    baud = val_int(baud)
+    if baud not in BAUD_RATES:
+        raise SyntaxError("Unsupported baud rate {}, choose one of {}".format(baud, ", ".join(map(str, BAUD_RATES))))
+    return BAUD_RATES.index(baud)
+
+def revparse_baud_rate(index):
+    if index >= len(BAUD_RATES):
+        return "Unknown"
+    return BAUD_RATES[index]
+
+def parse_voltage_precise(voltage):
+    return parse_voltage(voltage) << 8
+
+def revparse_voltage_precise(value):
+    return revparse_voltage(value / 256)
+
 def parse_deploy_mode(mode):
     try:
         return val_int(mode)
@@ -93,16 +226,99 @@ def parse_deploy_mode(mode):
 def revparse_deploy_mode(mode):
     return "servo" if mode else "pyro"
 
+# servo outputs, indexed like the SERVO_OUTPUT_* defines in the firmware
+SERVO_OUTPUTS = ["software", "hardware"]
+
+def parse_servo_output(output):
+    if output in SERVO_OUTPUTS:
+        return SERVO_OUTPUTS.index(output)
+    return val_int(output)
+
+def revparse_servo_output(output):
+    return SERVO_OUTPUTS[output] if output < len(SERVO_OUTPUTS) else output
+
 PARSE_FUN = {
     0x00: (parse_time, revparse_time),
     0x01: (parse_time, revparse_time),
-    0x02: (parse_time, revparse_time),
+    0x02: (parse_time_ms, revparse_time_ms),
     0x03: (parse_voltage, revparse_voltage),
     0x04: (parse_voltage, revparse_voltage),
     0x05: (parse_deploy_mode, revparse_deploy_mode),
+    0x0A: (parse_baud_rate, revparse_baud_rate),
+    0x0B: (parse_voltage_precise, revparse_voltage_precise),
+    0x0C: (parse_servo_output, revparse_servo_output),
 }
 
 
+def lookup_code(name):
+    if name not in PACKET_NAMES:
+        raise SyntaxError("Unknown variable name {}".format(name))
+    return PACKET_NAMES[name]
+
+def pack_value(name, value):
+    code = lookup_code(name)
+    value = PARSE_FUN.get(code, (val_int, int))[0](value)
+    if code in PARAMETER_INFO:
+        flags, minimum, maximum = PARAMETER_INFO[code]
+        if not flags & PARAM_WRITE:
+            raise SyntaxError("{} can't be written".format(name))
+        if not minimum <= value <= maximum:
+            raise SyntaxError("{} must be between {} and {}".format(name, minimum, maximum))
+    return code, struct.pack(PACKET_SIZE[code], value)
+
+def add_parameter_info(data):
+    data = bytes(data)
+    code, flags, minimum, maximum = struct.unpack("<BBHH", data[:6])
+    name = data[6:].decode("ascii")
+    PACKET_NAMES[name] = code
+    PACKET_NUMBERS[code] = name
+    PACKET_SIZE[code] = "<H" if flags & PARAM_WIDE else "<B"
+    PARAMETER_INFO[code] = (flags, minimum, maximum)
+    return name, flags, minimum, maximum
+
+def pack_parameters(pairs):
+    data = b""
+    for name, value in pairs:
+        code, value = pack_value(name, value)
+        data += bytes([code, len(value)]) + value
+    return data
+
+def split_parameters(data):
+    # the entries of a batch, in chunks that fit in one packet
+    chunk = b""
+    i = 0
+    while i + 2 <= len(data):
+        entry = data[i:i + 2 + data[i + 1]]
+        if len(chunk) + len(entry) > MAX_DATA:
+            yield chunk
+            chunk = b""
+        chunk += entry
+        i += len(entry)
+    if chunk:
+        yield chunk
+
+def format_status(data):
+    # the result of a board (ok, warning or error) and a line with the rest
+    data = bytes(data)
+    size = struct.calcsize(STATUS)
+    state, inputs, battery, warnings, uart, crc, frame, uptime = struct.unpack(STATUS, data[:size])
+    name = data[size:].decode("ascii", "replace") or (STATE_NAMES[state] if state < len(STATE_NAMES) else state)
+    inputs = ",".join(name for i, name in enumerate(INPUT_NAMES) if inputs & (1 << i))
+    warnings = ",".join(name for i, name in enumerate(STATUS_WARNINGS) if warnings & (1 << i))
+    result = "error" if state == 0 else "warning" if warnings else "ok"
+    return result, "{}  battery {:.2f} V  inputs {}  warnings {}  link errors {}/{}/{}  up {:.0f} s".format(
+        name, revparse_voltage_precise(battery), inputs or "-", warnings or "-", uart, crc, frame, uptime / 1000)
+
+def unpack_parameters(data):
+    data = bytes(data)
+    i = 0
+    while i + 2 <= len(data):
+        code, size = data[i], data[i + 1]
+        value, = struct.unpack(PACKET_SIZE[code], data[i + 2:i + 2 + size])
+        yield code, value
+        i += size + 2
+
+
 class CommsPort(lbp.CommsPortSerial):
     # Just parse them immediately in the other thread
     def PacketParserHandler(self, data):
@@ -112,6 +328,9 @@ class CommsPort(lbp.CommsPortSerial):
 class PacketHandler:
     def __init__(self, device):
         self.device = device
+        self.log = None
+        self.dump_file = None
+        self.dump_lines = None
         device.setAsynchronousPacketHandler(self.AsynchronousPacketHandler)
         device.setCommandPacketHandler(self.CommandPacketHandler)
         device.setFillIdentificationData(self.FillIdentificationDataHandler)
@@ -119,36 +338,176 @@ class PacketHandler:
         device.setFillStatusData(self.FillStatusDataHandler)
 
     def send_user_input(self, s):
-        # The string should start with "get" or "set"
+        # The string should start with one of the commands in HELP
         command, *parameters = s.split()
         if command == "get":
+            if not parameters:
+                raise SyntaxError("Incorrect amount of parameters. Expected at least 1 got 0")
+
+            codes = [lookup_code(name) for name in parameters]
+            if len(codes) == 1 and codes[0] < SINGLE_ACCESS_CODES:
+                self.device.write(codes[0] + 0x10, b"", Flags=lbp.Comms.FLAGS_COMMAND)
+            else:
+                self.device.write(GET_PARAMETERS, bytes(codes), Flags=lbp.Comms.FLAGS_COMMAND)
+
+        elif command == "set":
+            if not parameters or len(parameters) % 2:
+                raise SyntaxError("Incorrect amount of parameters. Expected pairs of a key and a value")
+
+            pairs = list(zip(parameters[::2], parameters[1::2]))
+            if len(pairs) == 1 and lookup_code(pairs[0][0]) < SINGLE_ACCESS_CODES:
+                code, value = pack_value(*pairs[0])
+                self.device.write(code + 0x20, value, Flags=lbp.Comms.FLAGS_COMMAND)
+            else:
+                self.device.write(SET_PARAMETERS, pack_parameters(pairs), Flags=lbp.Comms.FLAGS_COMMAND)
+
+        elif command == "dump":
+            if len(parameters) > 1:
+                raise SyntaxError("Incorrect amount of parameters. Expected 0 or 1 got {}".format(len(parameters)))
+
+            self.dump_file = parameters[0] if parameters else None
+            self.dump_lines = []
+            self.device.write(GET_PARAMETERS, b"", Flags=lbp.Comms.FLAGS_COMMAND)
+
+        elif command == "load":
             if len(parameters) != 1:
                 raise SyntaxError("Incorrect amount of parameters. Expected 1 got {}".format(len(parameters)))
 
-            if parameters[0] not in PACKET_NAMES:
-                raise SyntaxError("Unknown variable name {}".format(parameters[0]))
+            try:
+                with open(parameters[0]) as f:
+                    pairs = [tuple(line.split()) for line in f if line.strip()]
+            except OSError as e:
+                raise SyntaxError("Can't read {}: {}".format(parameters[0], e.strerror))
 
-            code = PACKET_NAMES[parameters[0]]
-            self.device.write(code + 0x10, b"", Flags=lbp.Comms.FLAGS_COMMAND)
+            if any(len(pair) != 2 for pair in pairs):
+                raise SyntaxError("Every line in {} must contain a key and a value".format(parameters[0]))
 
-        elif command == "set":
-            if len(parameters) != 2:
-                raise SyntaxError("Incorrect amount of parameters. Expected 2 got {}".format(len(parameters)))
+            for data in split_parameters(pack_parameters(pairs)):
+                self.device.write(SET_PARAMETERS, data, Flags=lbp.Comms.FLAGS_COMMAND)
+
+        elif command == "discover":
+            if parameters:
+                raise SyntaxError("Incorrect amount of parameters. Expected 0 got {}".format(len(parameters)))
+
+            self.device.write(GET_PARAMETER_INFO, b"", Flags=lbp.Comms.FLAGS_COMMAND)
+
+        elif command == "telemetry":
+            if len(parameters) != 1:
+                raise SyntaxError("Incorrect amount of parameters. Expected 1 got {}".format(len(parameters)))
+
+            rate = val_int(parameters[0])
+            if not 0 <= rate <= 50:
+                raise SyntaxError("The rate must be between 0 and 50")
+            self.device.write(TELEMETRY_COMMAND, bytes([rate]), Flags=lbp.Comms.FLAGS_COMMAND)
+
+        elif command == "log":
+            if parameters:
+                raise SyntaxError("Incorrect amount of parameters. Expected 0 got {}".format(len(parameters)))
+
+            self.device.write(LOG_COMMAND, b"", Flags=lbp.Comms.FLAGS_COMMAND)
+
+        elif command == "diagnostics":
+            if parameters not in ([], ["reset"]):
+                raise SyntaxError("Expected no parameters or reset")
 
-            if parameters[0] not in PACKET_NAMES:
-                raise SyntaxError("Unknown variable name {}".format(parameters[0]))
+            data = bytes([DIAGNOSTICS_RESET]) if parameters else b""
+            self.device.write(DIAGNOSTICS_COMMAND, data, Flags=lbp.Comms.FLAGS_COMMAND)
 
-            code = PACKET_NAMES[parameters[0]]
+        elif command == "selftest":
+            if parameters not in ([], ["start"]):
+                raise SyntaxError("Expected no parameters or start")
 
-            value = PARSE_FUN.get(code, (val_int, int))[0](parameters[1])
-            value = struct.pack(PACKET_SIZE[code], value)
+            data = bytes([SELF_TEST_START]) if parameters else b""
+            self.device.write(SELF_TEST_COMMAND, data, Flags=lbp.Comms.FLAGS_COMMAND)
 
-            self.device.write(code + 0x20, value, Flags=lbp.Comms.FLAGS_COMMAND)
+        elif command == "status":
+            if parameters:
+                raise SyntaxError("Expected no parameters")
+
+            self.device.write(STATUS_COMMAND, b"", Flags=lbp.Comms.FLAGS_COMMAND)
 
         else:
             raise SyntaxError("Unknown command {}".format(command))
 
+    def print_log(self):
+        # empty slots have sequence numbers 0x00 or 0xFF, the rest is sent oldest first
+        records = [record for record in self.log if record and 0x01 <= record[0] <= 0xFE]
+        print("{} log records".format(len(records)))
+        time = 0
+        for record_sequence, event, data, delta in records:
+            name = LOG_EVENTS.get(event, hex(event))
+            if name == "boot":
+                time = 0
+            time += delta
+            if name == "state":
+                data = STATE_NAMES[data] if data < len(STATE_NAMES) else data
+            elif name == "battery_min":
+                data = revparse_voltage(data)
+            elif name == "deploy":
+                data = "{} on {}{}".format("servo" if data & 0x01 else "pyro", "vote" if data & 0x02 else "timeout",
+                                           " with peers" if data & 0x04 else "")
+            elif name == "peer_vote":
+                reason = data >> 4
+                data = "{} {}".format(data & 0x0F, VOTE_REASONS[reason] if reason < len(VOTE_REASONS) else reason)
+            print("{:9.3f} {:12} {}{}".format(time / 1000, name, data, " (+)" if delta == 0xFFFF else ""))
+
+    def print_diagnostics(self, data):
+        if len(data) == 1 and data[0] == DIAGNOSTICS_RESET:
+            print("diagnostics cleared")
+
+        elif len(data) == struct.calcsize(DIAGNOSTICS_SECTION):
+            section, minimum, maximum, average, samples = struct.unpack(DIAGNOSTICS_SECTION, bytes(data))
+            name = DIAGNOSTICS_SECTIONS[section] if section < len(DIAGNOSTICS_SECTIONS) else section
+            print("{:14} min {:8.1f} us  max {:8.1f} us  avg {:8.1f} us  ({} samples)".format(
+                name, minimum * TIMER_COUNT_US, maximum * TIMER_COUNT_US, average * TIMER_COUNT_US, samples))
+
+        else:
+            # the error counters, then ask for each of the sections
+            counters = struct.unpack("<{}H".format(data[1]), bytes(data[2:2 + 2 * data[1]]))
+            print("  ".join("{} {}".format(name, count) for name, count in zip(DIAGNOSTICS_COUNTERS, counters)))
+            for section in range(data[0]):
+                self.device.write(DIAGNOSTICS_COMMAND, bytes([section]), Flags=lbp.Comms.FLAGS_COMMAND)
+
+    def print_self_test(self, data):
+        state, failures, continuity, battery, battery_min, settle, latency_max, latency_avg = \
+            struct.unpack(SELF_TEST_REPORT, bytes(data))
+        failures = ",".join(name for i, name in enumerate(SELF_TEST_FAILURES) if name and failures & (1 << i))
+        continuity = ",".join(name for i, name in enumerate(SELF_TEST_CONTINUITY) if continuity & (1 << i))
+        print("self-test {}{}".format(SELF_TEST_STATES[state] if state < len(SELF_TEST_STATES) else state,
+                                      ", failed " + failures if failures else ", passed" if state == 2 else ""))
+        if not state:
+            return
+        voltage = lambda value: "{:.2f} V".format(revparse_voltage(value)) if value else "-"
+        print("continuity high after {}  battery {}, {} under load".format(
+            continuity or "-", voltage(battery), voltage(battery_min)))
+        print("servo settle {} ms  loop latency max {:.1f} us avg {:.1f} us".format(
+            settle, latency_max * TIMER_COUNT_US, latency_avg * TIMER_COUNT_US))
+
     def AsynchronousPacketHandler(self, source, sequence, command, data):
+        if command == SELF_TEST_COMMAND and len(data) == struct.calcsize(SELF_TEST_REPORT):
+            self.print_self_test(data)
+            return
+
+        if command == TELEMETRY_COMMAND and len(data) == struct.calcsize(TELEMETRY):
+            state, inputs, battery, flight_time, buzzer = struct.unpack(TELEMETRY, bytes(data))
+            inputs = ",".join(name for i, name in enumerate(INPUT_NAMES) if inputs & (1 << i))
+            print("{:13} {:8.3f} s  battery {:.2f} V  inputs {}  buzzer {}".format(
+                STATE_NAMES[state] if state < len(STATE_NAMES) else state, flight_time / 1000,
+                revparse_voltage_precise(battery), inputs or "-",
+                BUZZER_PATTERNS[buzzer] if buzzer < len(BUZZER_PATTERNS) else buzzer))
+            return
+
+        if command == LOG_COMMAND and self.log is not None:
+            index = data[0]
+            for offset in range(1, len(data) - LOG_RECORD_SIZE + 1, LOG_RECORD_SIZE):
+                if index < len(self.log):
+                    self.log[index] = struct.unpack(LOG_RECORD, bytes(data[offset:offset + LOG_RECORD_SIZE]))
+                index += 1
+            if index >= len(self.log):
+                self.print_log()
+                self.log = None
+            return
+
         print('\nAsynchronous/Broadcast packet')
         print('Source: ' + hex(source))
         print('Sequence: ' + hex(sequence))
@@ -164,7 +523,77 @@ class PacketHandler:
         self.device._TxBuffer.clear()
         return False
 
+    def print_parameters(self, data, is_setter):
+        lines = []
+        last = None
+        for code, value in unpack_parameters(data):
+            name = PACKET_NUMBERS[code]
+            value = PARSE_FUN.get(code, (val_int, int))[1](value)
+            print("{} is {}".format(name, value))
+            lines.append("{} {}\n".format(name, value))
+            last = code
+
+            # the board switches right after acknowledging a new baud rate, follow it
+            if is_setter and name == "baud_rate" and value in BAUD_RATES:
+                self.device.port.ser.baudrate = value
+
+        if is_setter or self.dump_lines is None:
+            return
+
+        # the configuration comes in as many replies as it needs, an empty one ends it
+        if last is not None:
+            self.dump_lines += lines
+            self.device.write(GET_PARAMETERS, bytes([PARAMETERS_FROM | (last + 1)]), Flags=lbp.Comms.FLAGS_COMMAND)
+            return
+
+        if self.dump_file:
+            with open(self.dump_file, "w") as f:
+                f.writelines(self.dump_lines)
+            print("Saved to {}".format(self.dump_file))
+        self.dump_file = None
+        self.dump_lines = None
+
     def ReplyPacketHandler(self, source, sequence, command, data):
+        if command == GET_PARAMETER_INFO:
+            if len(data) == 1:
+                # the amount of parameters, ask for each of them
+                for code in range(data[0]):
+                    self.device.write(GET_PARAMETER_INFO, bytes([code]), Flags=lbp.Comms.FLAGS_COMMAND)
+                return
+
+            name, flags, minimum, maximum = add_parameter_info(data)
+            access = "".join(letter for bit, letter in ((PARAM_READ, "r"), (PARAM_WRITE, "w")) if flags & bit)
+            print("{} ({}{}{}): {}..{}".format(name, access, ", stored" if flags & PARAM_CONFIG else "",
+                                              "" if flags & PARAM_LIVE else ", after reset", minimum, maximum))
+            return
+
+        if command in (GET_PARAMETERS, SET_PARAMETERS):
+            self.print_parameters(data, command == SET_PARAMETERS)
+            return
+
+        if command == TELEMETRY_COMMAND:
+            print("telemetry rate is {} Hz".format(data[0]))
+            return
+
+        if command == LOG_COMMAND:
+            # the records follow in asynchronous packets
+            self.log = [None] * data[0]
+            return
+
+        if command == DIAGNOSTICS_COMMAND:
+            self.print_diagnostics(data)
+            return
+
+        if command == SELF_TEST_COMMAND and len(data) == struct.calcsize(SELF_TEST_REPORT):
+            self.print_self_test(data)
+            return
+
+        if command == STATUS_COMMAND and len(data) >= struct.calcsize(STATUS):
+            print("{}: {}".format(*format_status(data)))
+            return
+
+        is_setter = command >= 0x20
+
         if command - 0x10 in PACKET_NUMBERS:
             command -= 0x10
 
@@ -184,6 +613,10 @@ class PacketHandler:
         value = PARSE_FUN.get(command, (val_int, int))[1](value)
         print("{} is {}".format(name, value))
 
+        # the board switches right after acknowledging a new baud rate, follow it
+        if is_setter and name == "baud_rate" and value in BAUD_RATES:
+            self.device.port.ser.baudrate = value
+
     def FillIdentificationDataHandler(self, source, sequence, command, data):
         print('\nIdentification data request (empty packet returned)')
         print('Source: ' + hex(source))
@@ -201,7 +634,172 @@ class PacketHandler:
         self.device._TxBuffer.clear()
 
 
+class FleetError(Exception):
+    pass
+
+async def fleet_command(client, command, data=b"", destination=None):
+    reply, data = await client.command(command, data, destination)
+    if reply != command:
+        raise FleetError("command 0x{:02X} refused".format(command))
+    return data
+
+async def fleet_read_config(client, address):
+    # as in the dump command, the configuration comes in as many replies as it needs
+    values = {}
+    request = b""
+    while True:
+        data = await fleet_command(client, GET_PARAMETERS, request, address)
+        entries = list(unpack_parameters(data))
+        if not entries:
+            return values
+        for code, value in entries:
+            values[code] = value
+        request = bytes([PARAMETERS_FROM | (entries[-1][0] + 1)])
+
+def fleet_differences(values, target):
+    # pairs of the target that differ from values, compared as they are sent
+    differences = []
+    for name, value in target:
+        code, packed = pack_value(name, value)
+        if code not in values or struct.pack(PACKET_SIZE[code], values[code]) != packed:
+            differences.append((name, value))
+    return differences
+
+async def fleet_board(client, port, address, action, target, directory):
+    start = time.monotonic()
+    result = {"port": port, "address": address, "status": "ok", "details": ""}
+    try:
+        if action == "status":
+            data = await fleet_command(client, STATUS_COMMAND, b"", address)
+            if len(data) < struct.calcsize(STATUS):
+                raise FleetError("short status")
+            result["status"], result["details"] = format_status(data)
+        else:
+            values = await fleet_read_config(client, address)
+            result["address"] = values.get(PACKET_NAMES["address"], address)
+
+        if action == "dump" and directory:
+            filename = os.path.join(directory, "{}_{}.txt".format(os.path.basename(port), result["address"]))
+            with open(filename, "w") as f:
+                for code, value in values.items():
+                    f.write("{} {}\n".format(PACKET_NUMBERS[code], PARSE_FUN.get(code, (val_int, int))[1](value)))
+            result["details"] = filename
+
+        elif action in ("diff", "load"):
+            differences = fleet_differences(values, target)
+            writes = [pair for pair in differences if pair[0] not in LINK_KEYS]
+            result["details"] = " ".join(name if (name, value) in writes else "({})".format(name)
+                                         for name, value in differences)
+            result["status"] = "{} different".format(len(writes)) if writes else "same"
+
+            if action == "load" and writes:
+                for data in split_parameters(pack_parameters(writes)):
+                    await fleet_command(client, SET_PARAMETERS, data, address)
+                left = fleet_differences(await fleet_read_config(client, address), writes)
+                if left:
+                    raise FleetError("not written: " + " ".join(name for name, value in left))
+                result["status"] = "wrote {}".format(len(writes))
+
+    except (FleetError, lbp.CommsTimeout, OSError, SyntaxError) as e:
+        result["status"] = "error"
+        result["details"] = str(e)
+    result["time"] = time.monotonic() - start
+    return result
+
+async def fleet_port(port, action, target, directory, scan):
+    try:
+        transport = lbp.CommsSerialTransport(port, BAUD, timeout=FLEET_TIMEOUT, retries=FLEET_RETRIES)
+    except (OSError, lbp.serial.SerialException) as e:
+        return [{"port": port, "address": "-", "status": "error", "details": str(e), "time": 0}]
+
+    client = transport.client
+    try:
+        try:
+            await client.negotiateWindow()
+        except lbp.CommsTimeout:
+            return [{"port": port, "address": "-", "status": "no reply", "details": "", "time": 0}]
+
+        # a board reports its own address when it is asked for from the unknown address. A router
+        # passes a command to the board it is addressed to, so the scan asks every address
+        if scan:
+            async def probe(address):
+                try:
+                    data = await fleet_command(client, GET_PARAMETERS, bytes([PACKET_NAMES["address"]]), address)
+                except (FleetError, lbp.CommsTimeout):
+                    return None
+                return address if dict(unpack_parameters(data)).get(PACKET_NAMES["address"]) == address else None
+
+            client.timeout = FLEET_SCAN_TIMEOUT
+            client.retries = 0
+            found = await asyncio.gather(*(probe(address) for address in range(lbp.Comms.ADDRESS_UNKNOWN)))
+            client.timeout = FLEET_TIMEOUT
+            client.retries = FLEET_RETRIES
+            addresses = [address for address in found if address is not None]
+        else:
+            addresses = [lbp.Comms.ADDRESS_UNKNOWN]
+
+        if not addresses:
+            return [{"port": port, "address": "-", "status": "no boards", "details": "", "time": 0}]
+        return await asyncio.gather(*(fleet_board(client, port, address, action, target, directory)
+                                      for address in addresses))
+    finally:
+        transport.close()
+
+def print_fleet_results(results):
+    print("{:16} {:>7}  {:14} {:>7}  {}".format("port", "address", "result", "time", "details"))
+    for result in results:
+        print("{:16} {:>7}  {:14} {:6.2f}s  {}".format(result["port"], result["address"], result["status"],
+                                                      result["time"], result["details"]))
+
+def fleet_main(args):
+    parser = argparse.ArgumentParser(prog="SRP.py fleet", description=FLEET_HELP,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("action", choices=["dump", "status", "diff", "load"])
+    parser.add_argument("file", nargs="?", help="directory for dump, file made by dump for diff and load")
+    parser.add_argument("--ports", nargs="+", help="serial ports to use, all of them by default")
+    parser.add_argument("--scan", action="store_true",
+                        help="look for boards behind routers on every address, instead of one board per port")
+    options = parser.parse_args(args)
+
+    target = None
+    if options.action in ("diff", "load"):
+        if not options.file:
+            parser.error("{} needs a file made by dump".format(options.action))
+        try:
+            with open(options.file) as f:
+                target = [tuple(line.split()) for line in f if line.strip()]
+        except OSError as e:
+            parser.error("Can't read {}: {}".format(options.file, e.strerror))
+        if any(len(pair) != 2 for pair in target):
+            parser.error("Every line in {} must contain a key and a value".format(options.file))
+        try:
+            for pair in target:
+                pack_value(*pair)
+        except SyntaxError as e:
+            parser.error("\n".join(e.args))
+
+    elif options.file:
+        os.makedirs(options.file, exist_ok=True)
+
+    ports = options.ports or [i.device for i in list_ports.comports()]
+    if not ports:
+        sys.exit("No available comports")
+
+    async def run():
+        results = await asyncio.gather(*(fleet_port(port, options.action, target, options.file, options.scan)
+                                         for port in ports))
+        return [result for port_results in results for result in port_results]
+
+    results = asyncio.run(run())
+    print_fleet_results(results)
+    return 0 if all(result["status"] in ("ok", "same") or result["status"].startswith("wrote")
+                    for result in results) else 1
+
+
 def main():
+    if len(sys.argv) > 1 and sys.argv[1] == "fleet":
+        sys.exit(fleet_main(sys.argv[2:]))
+
     comports = [i.device for i in list_ports.comports()]
     if not len(comports):
         sys.exit("No available comports")
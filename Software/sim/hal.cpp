@@ -0,0 +1,710 @@
+#include "hal.h"
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <util/delay.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/**
+ * Registers
+ */
+volatile uint8_t SREG;
+volatile uint8_t CLKPR;
+volatile uint8_t MCUSR;
+volatile uint8_t PRR;
+volatile uint8_t CCP;
+volatile uint8_t WDTCSR;
+volatile uint8_t ACSRA;
+volatile uint8_t DDRA, DDRB, DDRC;
+volatile uint8_t PORTA, PORTB, PORTC;
+volatile uint8_t PINA, PINB, PINC;
+volatile uint8_t PUEA, PUEB, PUEC;
+volatile uint8_t GIMSK;
+volatile uint8_t GIFR;
+volatile uint8_t PCMSK0, PCMSK1, PCMSK2;
+volatile uint8_t TCCR0A, TCCR0B, TCNT0, OCR0A, OCR0B;
+volatile uint8_t TCCR1A, TCCR1B;
+volatile uint16_t TCNT1, OCR1A, OCR1B, ICR1;
+volatile uint8_t TIMSK;
+sim_flag_register TIFR;
+volatile uint8_t ADMUX, ADCSRA, ADCSRB, DIDR0;
+volatile uint16_t ADC;
+sim_udr_register UDR0;
+volatile uint8_t UCSR0A, UCSR0B, UCSR0C;
+sim_ucsrd_register UCSR0D;
+volatile uint8_t UBRR0H, UBRR0L;
+
+/**
+ * Interrupt vectors of the firmware. Vectors it doesn't implement are never enabled.
+ */
+extern "C" void PCINT0_vect(void) __attribute__((weak));
+extern "C" void PCINT1_vect(void) __attribute__((weak));
+extern "C" void PCINT2_vect(void) __attribute__((weak));
+extern "C" void WDT_vect(void) __attribute__((weak));
+extern "C" void TIMER1_CAPT_vect(void) __attribute__((weak));
+extern "C" void TIMER1_COMPA_vect(void) __attribute__((weak));
+extern "C" void TIMER1_COMPB_vect(void) __attribute__((weak));
+extern "C" void TIMER0_COMPA_vect(void) __attribute__((weak));
+extern "C" void TIMER0_COMPB_vect(void) __attribute__((weak));
+extern "C" void TIMER0_OVF_vect(void) __attribute__((weak));
+extern "C" void ADC_vect(void) __attribute__((weak));
+extern "C" void USART0_START_vect(void) __attribute__((weak));
+extern "C" void USART0_RX_vect(void) __attribute__((weak));
+extern "C" void USART0_TX_vect(void) __attribute__((weak));
+
+/**
+ * The cycles column is charged to the simulated time for every call, see sim_vector_stats. They are
+ * estimates of the usual path from reading the handlers, not measurements:
+ * - about 74 cycles to enter and leave a handler that calls other functions and has to save the call
+ *   clobbered registers
+ * - about 40 for a get_time(), which adds the count to the time of the period
+ * - about 60 for a scan of the task pool, the scheduler makes one for a single due task
+ * Replace them with the numbers of a PROFILING build when there are some.
+ */
+static sim_vector_stats vector_stats[SIM_VECTOR_COUNT] = {
+    {"PCINT0",          200,    0, 0, 0}, // sampling the inputs
+    {"PCINT1",          200,    0, 0, 0},
+    {"PCINT2",          200,    0, 0, 0},
+    {"WDT",             50,     0, 0, 0},
+    {"TIMER1_CAPT",     210,    0, 0, 0}, // with the servo slew and the buzzer, a servo move costs more
+    {"TIMER1_COMPA",    270,    0, 0, 0}, // a scan, a short task and programming the compare
+    {"TIMER1_COMPB",    60,     0, 0, 0},
+    {"TIMER0_COMPA",    80,     0, 0, 0}, // a bit of the relay link, a byte costs more
+    {"TIMER0_COMPB",    80,     0, 0, 0},
+    {"TIMER0_OVF",      110,    0, 0, 0}, // the average, every 4th call samples the inputs for about 200
+    {"ADC",             60,     0, 0, 0}, // the sum, the filter only runs every 16th conversion
+    {"USART0_START",    20,     0, 0, 0},
+    {"USART0_RX",       150,    0, 0, 0}, // a data byte through the link layer and the crc
+    {"USART0_TX",       150,    0, 0, 0}
+};
+
+/**
+ * Simulation state
+ */
+uint64_t sim_time;
+uint64_t sim_standby_time;
+uint8_t sim_sleep_mode;
+uint16_t sim_adc;
+uint32_t sim_loop_time;
+void (*sim_step_hook)();
+void (*sim_pin_hook)(uint8_t port, uint8_t bit, uint8_t level);
+void (*sim_uart_hook)(uint8_t byte);
+void (*sim_serial_hook)(uint8_t byte);
+
+// amount of interrupts that have run, sim_sleep() waits for this to change
+static uint32_t interrupts_served;
+
+// cpu cycles charged by the interrupts that haven't made up a whole timer count yet
+static uint32_t interrupt_cycles;
+
+// sleeping in standby, the io clock is stopped
+static uint8_t standby;
+
+// watchdog counter, in timer counts. The watchdog oscillator runs at 32768 Hz, its shortest
+// interval of 512 cycles is 14400 timer counts
+#define WDT_COUNTS          14400
+static uint32_t wdt_count;
+
+// input pins driven from the outside, and their levels
+static uint8_t pins_driven[SIM_PORT_COUNT];
+static uint8_t pins_level[SIM_PORT_COUNT];
+
+// last output levels, to report changes
+static uint8_t outputs[SIM_PORT_COUNT];
+
+// OC1B output of timer 1
+static uint8_t oc1b;
+
+// adc conversion in progress, timer counts left
+#define ADC_CONVERSION_TIME 104 // 13 adc clocks at cpu / 64
+static uint8_t adc_remaining;
+
+// usart receiver. Bytes from the host wait in a fifo, the usart has a two byte receive buffer
+#define UART_RX_QUEUE_SIZE  1024
+#define UART_RX_BUFFER_SIZE 2
+
+static uint8_t uart_rx_queue[UART_RX_QUEUE_SIZE];
+static uint16_t uart_rx_queue_index;
+static uint16_t uart_rx_queue_length;
+static uint32_t uart_rx_remaining;
+
+static uint8_t uart_rx_buffer[UART_RX_BUFFER_SIZE];
+static uint8_t uart_rx_flags[UART_RX_BUFFER_SIZE]; // DOR0 of the buffered byte
+static uint8_t uart_rx_length;
+
+// usart transmitter, the shift register and the data register
+static uint8_t uart_tx_shift;
+static uint32_t uart_tx_remaining;
+static uint8_t uart_tx_data;
+static uint8_t uart_tx_data_full;
+static uint8_t uart_txc;
+
+// serial line on a software uart, see sim_serial_init(). A byte is 10 bits, the start bit, 8 data bits
+// and the stop bit
+#define SERIAL_QUEUE_SIZE   256
+
+typedef struct {
+    uint8_t port;
+    uint8_t bit;
+    uint8_t data;
+    uint8_t bits;           // bits of the byte that are left, 0 when idle
+    uint32_t remaining;     // timer counts left of the current bit
+} serial_end;
+
+static uint32_t serial_bit_counts;
+static serial_end serial_rx;    // the firmware's rx pin, driven from the queue
+static serial_end serial_tx;    // the firmware's tx pin, sampled in the middle of the bits
+static uint8_t serial_queue[SERIAL_QUEUE_SIZE];
+static uint16_t serial_queue_index;
+static uint16_t serial_queue_length;
+
+static volatile uint8_t *const port_ddr[SIM_PORT_COUNT] = {&DDRA, &DDRB, &DDRC};
+static volatile uint8_t *const port_port[SIM_PORT_COUNT] = {&PORTA, &PORTB, &PORTC};
+static volatile uint8_t *const port_pin[SIM_PORT_COUNT] = {&PINA, &PINB, &PINC};
+static volatile uint8_t *const port_pue[SIM_PORT_COUNT] = {&PUEA, &PUEB, &PUEC};
+static volatile uint8_t *const port_pcmsk[SIM_PORT_COUNT] = {&PCMSK0, &PCMSK1, &PCMSK2};
+
+/**
+ * Returns host time in nanoseconds
+ */
+static uint64_t host_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/**
+ * Recompute the usart status bits, which belong to the hardware
+ */
+static void update_uart_status() {
+    uint8_t status = 0;
+    if (uart_rx_length) {
+        status |= (1 << RXC0) | uart_rx_flags[0];
+    }
+    if (uart_txc) {
+        status |= 1 << TXC0;
+    }
+    if (!uart_tx_data_full) {
+        status |= 1 << UDRE0;
+    }
+    UCSR0A = status;
+}
+
+/**
+ * Returns the amount of timer counts one usart byte takes at the current baud rate
+ */
+uint32_t sim_uart_byte_time() {
+    // 16 samples per bit, 10 bits per byte, 8 cpu cycles per timer count
+    uint16_t ubrr = (UBRR0H << 8) | UBRR0L;
+    return (ubrr + 1) * 16 * 10 / 8;
+}
+
+sim_udr_register::operator uint8_t() {
+    if (!uart_rx_length) {
+        return 0;
+    }
+    uint8_t byte = uart_rx_buffer[0];
+    uart_rx_buffer[0] = uart_rx_buffer[1];
+    uart_rx_flags[0] = uart_rx_flags[1];
+    uart_rx_length--;
+    update_uart_status();
+    return byte;
+}
+
+sim_udr_register &sim_udr_register::operator=(uint8_t value) {
+    if (!(UCSR0B & (1 << TXEN0))) {
+        return *this;
+    }
+
+    if (!uart_tx_remaining) {
+        uart_tx_shift = value;
+        uart_tx_remaining = sim_uart_byte_time();
+    } else if (!uart_tx_data_full) {
+        uart_tx_data = value;
+        uart_tx_data_full = 1;
+    } else {
+        fprintf(stderr, "sim: UDR0 written while the usart was busy\n");
+    }
+    update_uart_status();
+    return *this;
+}
+
+sim_ucsrd_register &sim_ucsrd_register::operator=(uint8_t write) {
+    uint8_t rxs = value & ~write & (1 << RXS0);
+    value = (write & ~(1 << RXS0)) | rxs;
+    return *this;
+}
+
+/**
+ * Peripherals
+ */
+static void step_timer1() {
+    if (standby || (PRR & (1 << PRTIM1)) || !(TCCR1B & ((1 << CS12) | (1 << CS11) | (1 << CS10)))) {
+        return;
+    }
+
+    // ctc on ICR1, the count includes ICR1
+    if (TCNT1 == ICR1) {
+        TCNT1 = 0;
+        TIFR.value |= 1 << ICF1;
+    } else {
+        TCNT1++;
+    }
+
+    if (TCNT1 == OCR1A) {
+        TIFR.value |= 1 << OCF1A;
+    }
+    if (TCNT1 == OCR1B) {
+        TIFR.value |= 1 << OCF1B;
+        switch ((TCCR1A >> COM1B0) & 3) {
+            case 1:
+                oc1b = !oc1b;
+                break;
+            case 2:
+                oc1b = 0;
+                break;
+            case 3:
+                oc1b = 1;
+                break;
+        }
+    }
+}
+
+static void step_timer0() {
+    // only the CPU_FREQ / 8 prescaler is simulated, a count per step
+    if (standby || (PRR & (1 << PRTIM0)) || (TCCR0B & ((1 << CS02) | (1 << CS01) | (1 << CS00))) != (1 << CS01)) {
+        return;
+    }
+
+    // normal mode, the counter wraps at 0xFF
+    if (!++TCNT0) {
+        TIFR.value |= 1 << TOV0;
+    }
+    if (TCNT0 == OCR0A) {
+        TIFR.value |= 1 << OCF0A;
+    }
+    if (TCNT0 == OCR0B) {
+        TIFR.value |= 1 << OCF0B;
+    }
+}
+
+static void step_adc() {
+    if (standby || (PRR & (1 << PRADC)) || !(ADCSRA & (1 << ADEN)) || !(ADCSRA & (1 << ADSC))) {
+        adc_remaining = 0;
+        return;
+    }
+    if (!adc_remaining) {
+        adc_remaining = ADC_CONVERSION_TIME;
+    }
+    if (--adc_remaining) {
+        return;
+    }
+
+    ADC = sim_adc;
+    ADCSRA |= 1 << ADIF;
+    if (!(ADCSRA & (1 << ADATE))) {
+        ADCSRA &= ~(1 << ADSC);
+    }
+}
+
+static void step_uart() {
+    // receiver
+    if (uart_rx_remaining && !--uart_rx_remaining) {
+        uint8_t byte = uart_rx_queue[uart_rx_queue_index];
+        uart_rx_queue_index = (uart_rx_queue_index + 1) % UART_RX_QUEUE_SIZE;
+        uart_rx_queue_length--;
+
+        // in standby only the start frame detection keeps the receiver going
+        if ((UCSR0B & (1 << RXEN0)) && (!standby || (UCSR0D & (1 << SFDE0)))) {
+            if (uart_rx_length < UART_RX_BUFFER_SIZE) {
+                uart_rx_buffer[uart_rx_length] = byte;
+                uart_rx_flags[uart_rx_length] = 0;
+                uart_rx_length++;
+            } else {
+                // the byte is lost, the next one read tells
+                uart_rx_flags[UART_RX_BUFFER_SIZE - 1] = 1 << DOR0;
+            }
+        }
+    }
+    if (!uart_rx_remaining && uart_rx_queue_length) {
+        uart_rx_remaining = sim_uart_byte_time();
+        if (UCSR0D & (1 << SFDE0)) {
+            UCSR0D.value |= 1 << RXS0;
+        }
+    }
+
+    // transmitter
+    if (!standby && uart_tx_remaining && !--uart_tx_remaining) {
+        if (sim_uart_hook) {
+            sim_uart_hook(uart_tx_shift);
+        }
+        if (uart_tx_data_full) {
+            uart_tx_shift = uart_tx_data;
+            uart_tx_data_full = 0;
+            uart_tx_remaining = sim_uart_byte_time();
+        } else {
+            uart_txc = 1;
+        }
+    }
+
+    update_uart_status();
+}
+
+static void step_wdt() {
+    if (!(WDTCSR & (1 << WDIE))) {
+        wdt_count = 0;
+        return;
+    }
+    uint8_t prescaler = (WDTCSR & ((1 << WDP2) | (1 << WDP1) | (1 << WDP0))) | ((WDTCSR >> WDP3) & 1) << 3;
+    if (++wdt_count >= (uint32_t)WDT_COUNTS << prescaler) {
+        wdt_count = 0;
+        WDTCSR |= 1 << WDIF;
+    }
+}
+
+static void step_serial() {
+    if (!serial_bit_counts) {
+        return;
+    }
+
+    // the line driven by the queue
+    if (serial_rx.bits && !--serial_rx.remaining) {
+        serial_rx.bits--;
+        serial_rx.remaining = serial_bit_counts;
+        // the data bits, then the stop bit and the idle line
+        uint8_t level = 1;
+        if (serial_rx.bits >= 2) {
+            level = serial_rx.data & 1;
+            serial_rx.data >>= 1;
+        }
+        sim_set_pin(serial_rx.port, serial_rx.bit, level);
+    }
+    if (!serial_rx.bits && serial_queue_length) {
+        serial_rx.data = serial_queue[serial_queue_index];
+        serial_queue_index = (serial_queue_index + 1) % SERIAL_QUEUE_SIZE;
+        serial_queue_length--;
+        serial_rx.bits = 10;
+        serial_rx.remaining = serial_bit_counts;
+        sim_set_pin(serial_rx.port, serial_rx.bit, 0);
+    }
+
+    // the line of the firmware, the level it had after the last step
+    uint8_t level = (outputs[serial_tx.port] >> serial_tx.bit) & 1;
+    if (!serial_tx.bits) {
+        if (!level) {
+            serial_tx.bits = 9;
+            serial_tx.remaining = serial_bit_counts * 3 / 2;
+        }
+        return;
+    }
+    if (--serial_tx.remaining) {
+        return;
+    }
+    serial_tx.remaining = serial_bit_counts;
+    if (--serial_tx.bits) {
+        serial_tx.data = (serial_tx.data >> 1) | (level << 7);
+    } else if (level && sim_serial_hook) {
+        sim_serial_hook(serial_tx.data);
+    }
+}
+
+static void step_pins() {
+    for (uint8_t port = 0; port < SIM_PORT_COUNT; port++) {
+        uint8_t ddr = *port_ddr[port];
+        uint8_t output = *port_port[port] & ddr;
+        if (port == SIM_PORT_A && (TCCR1A & (3 << COM1B0)) && (ddr & (1 << 6))) {
+            output = (output & ~(1 << 6)) | (oc1b << 6);
+        }
+
+        // inputs read their driver, or their pullup
+        uint8_t input = (pins_level[port] & pins_driven[port]) | (*port_pue[port] & ~pins_driven[port]);
+        uint8_t pin = output | (input & ~ddr);
+
+        if ((pin ^ *port_pin[port]) & *port_pcmsk[port]) {
+            GIFR |= 1 << (PCIF0 + port);
+        }
+        *port_pin[port] = pin;
+
+        uint8_t changed = output ^ outputs[port];
+        outputs[port] = output;
+        for (uint8_t bit = 0; changed && sim_pin_hook && bit < 8; bit++) {
+            if (changed & (1 << bit)) {
+                sim_pin_hook(port, bit, (output >> bit) & 1);
+            }
+        }
+    }
+}
+
+/**
+ * Interrupts
+ */
+
+/**
+ * Advance one timer count without running interrupts
+ */
+static void step_peripherals() {
+    sim_time++;
+    step_timer1();
+    step_timer0();
+    step_adc();
+    step_uart();
+    step_wdt();
+    step_serial();
+    if (sim_step_hook) {
+        sim_step_hook();
+    }
+    step_pins();
+}
+
+/**
+ * Returns nonzero if vector is enabled and its flag is set. Clears flags the hardware clears
+ * when it jumps to the vector.
+ */
+static uint8_t take_interrupt(uint8_t vector) {
+    switch (vector) {
+        case SIM_PCINT0:
+        case SIM_PCINT1:
+        case SIM_PCINT2: {
+            uint8_t bit = PCIF0 + vector - SIM_PCINT0;
+            if ((GIFR & (1 << bit)) && (GIMSK & (1 << bit))) {
+                GIFR &= ~(1 << bit);
+                return 1;
+            }
+            return 0;
+        }
+
+        case SIM_WDT:
+            if ((WDTCSR & (1 << WDIF)) && (WDTCSR & (1 << WDIE))) {
+                WDTCSR &= ~(1 << WDIF);
+                return 1;
+            }
+            return 0;
+
+        case SIM_TIMER1_CAPT:
+        case SIM_TIMER1_COMPA:
+        case SIM_TIMER1_COMPB:
+        case SIM_TIMER0_COMPA:
+        case SIM_TIMER0_COMPB:
+        case SIM_TIMER0_OVF: {
+            static const uint8_t bits[] = {ICF1, OCF1A, OCF1B, OCF0A, OCF0B, TOV0};
+            uint8_t bit = bits[vector - SIM_TIMER1_CAPT];
+            if ((TIFR & (1 << bit)) && (TIMSK & (1 << bit))) {
+                TIFR.value &= ~(1 << bit);
+                return 1;
+            }
+            return 0;
+        }
+
+        case SIM_ADC:
+            if ((ADCSRA & (1 << ADIF)) && (ADCSRA & (1 << ADIE))) {
+                ADCSRA &= ~(1 << ADIF);
+                return 1;
+            }
+            return 0;
+
+        case SIM_USART0_START:
+            // cleared by writing a one
+            return (UCSR0D & (1 << RXS0)) && (UCSR0D & (1 << RXSIE0));
+
+        case SIM_USART0_RX:
+            // cleared by reading UDR0
+            return (UCSR0A & (1 << RXC0)) && (UCSR0B & (1 << RXCIE0));
+
+        case SIM_USART0_TX:
+            if (uart_txc && (UCSR0B & (1 << TXCIE0))) {
+                uart_txc = 0;
+                update_uart_status();
+                return 1;
+            }
+            return 0;
+    }
+    return 0;
+}
+
+static void (*const vector_functions[SIM_VECTOR_COUNT])(void) = {
+    PCINT0_vect, PCINT1_vect, PCINT2_vect, WDT_vect,
+    TIMER1_CAPT_vect, TIMER1_COMPA_vect, TIMER1_COMPB_vect,
+    TIMER0_COMPA_vect, TIMER0_COMPB_vect, TIMER0_OVF_vect, ADC_vect, USART0_START_vect, USART0_RX_vect, USART0_TX_vect
+};
+
+/**
+ * Run the pending interrupts in order of priority, as long as they're enabled
+ */
+static void run_interrupts() {
+    while (SREG & 0x80) {
+        uint8_t vector = 0;
+        while (vector < SIM_VECTOR_COUNT && !take_interrupt(vector)) {
+            vector++;
+        }
+        if (vector == SIM_VECTOR_COUNT) {
+            return;
+        }
+
+        if (!vector_functions[vector]) {
+            fprintf(stderr, "sim: %s enabled without a vector\n", vector_stats[vector].name);
+            exit(1);
+        }
+
+        SREG &= ~0x80;
+        uint64_t begin = host_ns();
+        vector_functions[vector]();
+        uint32_t elapsed = host_ns() - begin;
+
+        // the time the handler takes on the chip, nothing else can interrupt it meanwhile
+        sim_vector_stats *stats = vector_stats + vector;
+        interrupt_cycles += stats->cycles;
+        while (interrupt_cycles >= 8) {
+            interrupt_cycles -= 8;
+            step_peripherals();
+        }
+        SREG |= 0x80;
+
+        stats->calls++;
+        stats->total_ns += elapsed;
+        if (elapsed > stats->max_ns) {
+            stats->max_ns = elapsed;
+        }
+        interrupts_served++;
+    }
+}
+
+/**
+ * Public interface
+ */
+
+/**
+ * Reset the peripherals to their power on state. Call this before the firmware's init().
+ */
+void sim_init() {
+    MCUSR = 1 << PORF;
+    update_uart_status();
+    step_pins();
+}
+
+/**
+ * Advance one timer count and run the interrupts that are due
+ */
+void sim_step() {
+    step_peripherals();
+    run_interrupts();
+}
+
+/**
+ * Step until time (see sim_time)
+ */
+void sim_run_until(uint64_t time) {
+    while (sim_time < time) {
+        sim_step();
+    }
+}
+
+/**
+ * Sleep until an interrupt has run. Called by sleep_cpu().
+ */
+void sim_sleep() {
+    if (!(SREG & 0x80)) {
+        fprintf(stderr, "sim: sleeping with interrupts disabled\n");
+        exit(1);
+    }
+    uint32_t served = interrupts_served;
+    // the work of the main loop before it went to sleep, an interrupt meanwhile wakes it right away
+    sim_run_until(sim_time + sim_loop_time);
+    standby = sim_sleep_mode == SLEEP_MODE_STANDBY && served == interrupts_served;
+    while (served == interrupts_served) {
+        sim_step();
+        if (standby) {
+            sim_standby_time++;
+        }
+    }
+    standby = 0;
+}
+
+/**
+ * Busy wait, called by _delay_us() and _delay_ms()
+ */
+void sim_delay_us(double us) {
+    sim_run_until(sim_time + (uint64_t)(us * 576 / 625));
+}
+
+/**
+ * Drive an input pin to level from the outside, or release it so it reads its pullup
+ */
+void sim_set_pin(uint8_t port, uint8_t bit, uint8_t level) {
+    pins_driven[port] |= 1 << bit;
+    pins_level[port] = (pins_level[port] & ~(1 << bit)) | ((level ? 1 : 0) << bit);
+}
+
+void sim_release_pin(uint8_t port, uint8_t bit) {
+    pins_driven[port] &= ~(1 << bit);
+}
+
+/**
+ * Returns the level of an output pin
+ */
+uint8_t sim_get_output(uint8_t port, uint8_t bit) {
+    return (outputs[port] >> bit) & 1;
+}
+
+/**
+ * Queue bytes for the usart receiver. They arrive back to back at the configured baud rate.
+ */
+void sim_uart_send(const uint8_t *bytes, uint8_t length) {
+    for (uint8_t i = 0; i < length; i++) {
+        if (uart_rx_queue_length == UART_RX_QUEUE_SIZE) {
+            fprintf(stderr, "sim: uart queue full\n");
+            exit(1);
+        }
+        uart_rx_queue[(uart_rx_queue_index + uart_rx_queue_length) % UART_RX_QUEUE_SIZE] = bytes[i];
+        uart_rx_queue_length++;
+    }
+}
+
+/**
+ * Returns nonzero while bytes are waiting to be received
+ */
+uint8_t sim_uart_busy() {
+    return uart_rx_queue_length != 0;
+}
+
+/**
+ * Connect a serial line to a software uart of the firmware, its rx pin and its tx pin, at bit_counts
+ * timer counts per bit. The line idles high.
+ */
+void sim_serial_init(uint8_t rx_port, uint8_t rx_bit, uint8_t tx_port, uint8_t tx_bit, uint32_t bit_counts) {
+    serial_rx.port = rx_port;
+    serial_rx.bit = rx_bit;
+    serial_tx.port = tx_port;
+    serial_tx.bit = tx_bit;
+    serial_bit_counts = bit_counts;
+    sim_set_pin(rx_port, rx_bit, 1);
+}
+
+/**
+ * Queue bytes for the rx pin of the serial line. They are sent back to back, 8 bits, no parity, 1 stop bit.
+ */
+void sim_serial_send(const uint8_t *bytes, uint8_t length) {
+    for (uint8_t i = 0; i < length; i++) {
+        if (serial_queue_length == SERIAL_QUEUE_SIZE) {
+            fprintf(stderr, "sim: serial queue full\n");
+            exit(1);
+        }
+        serial_queue[(serial_queue_index + serial_queue_length) % SERIAL_QUEUE_SIZE] = bytes[i];
+        serial_queue_length++;
+    }
+}
+
+/**
+ * Returns the statistics of an interrupt vector (SIM_*)
+ */
+const sim_vector_stats *sim_get_vector_stats(uint8_t vector) {
+    return vector_stats + vector;
+}
+
+/**
+ * Change the estimated cycles of an interrupt vector (SIM_*), for a build whose handler does more or less
+ */
+void sim_set_vector_cycles(uint8_t vector, uint16_t cycles) {
+    vector_stats[vector].cycles = cycles;
+}
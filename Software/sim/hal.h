@@ -0,0 +1,138 @@
+#ifndef _SIM_HAL_H_
+#define _SIM_HAL_H_
+
+#include <stdint.h>
+
+/**
+ * This file contains the interface to the simulated ATtiny1634. The simulation advances in steps
+ * of one Timer 1 count (8 cpu cycles, see TIME_COUNTS_PER_SECOND). Every step updates the timer,
+ * the usart, the adc and the pins, then runs the interrupts that are due. An interrupt handler takes
+ * the estimated cycles of its vector (see sim_vector_stats), the peripherals go on meanwhile and
+ * other interrupts wait. The main loop runs in no simulated time unless sim_loop_time is set.
+ * Timings measured here are those of the design (ticks, debouncing, baud rates and scheduling) plus
+ * the estimates, a PROFILING build on the board measures the code itself.
+ */
+
+// ports for the pin functions
+#define SIM_PORT_A          0
+#define SIM_PORT_B          1
+#define SIM_PORT_C          2
+#define SIM_PORT_COUNT      3
+
+// interrupt vectors that are simulated, in order of priority
+#define SIM_PCINT0          0
+#define SIM_PCINT1          1
+#define SIM_PCINT2          2
+#define SIM_WDT             3
+#define SIM_TIMER1_CAPT     4
+#define SIM_TIMER1_COMPA    5
+#define SIM_TIMER1_COMPB    6
+#define SIM_TIMER0_COMPA    7
+#define SIM_TIMER0_COMPB    8
+#define SIM_TIMER0_OVF      9
+#define SIM_ADC             10
+#define SIM_USART0_START    11
+#define SIM_USART0_RX       12
+#define SIM_USART0_TX       13
+#define SIM_VECTOR_COUNT    14
+
+/**
+ * Statistics of an interrupt vector. cycles is the estimated cost of a call on the chip, which the
+ * simulated time advances by. The host time is a relative measure to compare changes of the firmware
+ * with, on the same machine.
+ */
+typedef struct {
+    const char *name;
+    uint16_t cycles;
+    uint32_t calls;
+    uint32_t max_ns;
+    uint64_t total_ns;
+} sim_vector_stats;
+
+// timer 1 counts since reset
+extern uint64_t sim_time;
+
+// timer 1 counts spent sleeping in standby
+extern uint64_t sim_standby_time;
+
+// value of the next adc conversions
+extern uint16_t sim_adc;
+
+// timer counts a main loop iteration takes, stepped with interrupts enabled before it sleeps
+extern uint32_t sim_loop_time;
+
+// called every step before the interrupts, to script inputs and traffic
+extern void (*sim_step_hook)();
+
+// called when an output pin changes level, including OC1B
+extern void (*sim_pin_hook)(uint8_t port, uint8_t bit, uint8_t level);
+
+// called with every byte the usart has finished transmitting
+extern void (*sim_uart_hook)(uint8_t byte);
+
+// called with every byte received on the serial line, see sim_serial_init()
+extern void (*sim_serial_hook)(uint8_t byte);
+
+/**
+ * Reset the peripherals to their power on state. Call this before the firmware's init().
+ */
+void sim_init();
+
+/**
+ * Advance one timer count and run the interrupts that are due
+ */
+void sim_step();
+
+/**
+ * Step until time (see sim_time)
+ */
+void sim_run_until(uint64_t time);
+
+/**
+ * Drive an input pin to level from the outside, or release it so it reads its pullup
+ */
+void sim_set_pin(uint8_t port, uint8_t bit, uint8_t level);
+void sim_release_pin(uint8_t port, uint8_t bit);
+
+/**
+ * Returns the level of an output pin
+ */
+uint8_t sim_get_output(uint8_t port, uint8_t bit);
+
+/**
+ * Queue bytes for the usart receiver. They arrive back to back at the configured baud rate.
+ */
+void sim_uart_send(const uint8_t *bytes, uint8_t length);
+
+/**
+ * Returns nonzero while bytes are waiting to be received
+ */
+uint8_t sim_uart_busy();
+
+/**
+ * Returns the amount of timer counts one usart byte takes at the current baud rate
+ */
+uint32_t sim_uart_byte_time();
+
+/**
+ * Connect a serial line to a software uart of the firmware, its rx pin and its tx pin, at bit_counts
+ * timer counts per bit. The line idles high.
+ */
+void sim_serial_init(uint8_t rx_port, uint8_t rx_bit, uint8_t tx_port, uint8_t tx_bit, uint32_t bit_counts);
+
+/**
+ * Queue bytes for the rx pin of the serial line. They are sent back to back, 8 bits, no parity, 1 stop bit.
+ */
+void sim_serial_send(const uint8_t *bytes, uint8_t length);
+
+/**
+ * Returns the statistics of an interrupt vector (SIM_*)
+ */
+const sim_vector_stats *sim_get_vector_stats(uint8_t vector);
+
+/**
+ * Change the estimated cycles of an interrupt vector (SIM_*), for a build whose handler does more or less
+ */
+void sim_set_vector_cycles(uint8_t vector, uint16_t cycles);
+
+#endif
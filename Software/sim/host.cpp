@@ -0,0 +1,91 @@
+#include "host.h"
+
+// link layer characters, see lbp.cpp
+#define CHAR_ESCAPE     0x50
+#define CHAR_START      0x55
+#define CHAR_STOP       0x5A
+
+#define STATE_IDLE      0
+#define STATE_FRAME     1
+#define STATE_ESCAPING  2
+
+/**
+ * The crc of the launchbox protocol (reflected polynomial 0x8C)
+ */
+static uint8_t crc8(uint8_t byte, uint8_t crc) {
+    crc ^= byte;
+    for (uint8_t i = 0; i < 8; i++) {
+        crc = (crc & 1) ? (crc >> 1) ^ 0x8C : crc >> 1;
+    }
+    return crc;
+}
+
+/**
+ * Append byte to bytes, escaped if it's a control character
+ */
+static uint8_t put_escaped(uint8_t byte, uint8_t *bytes) {
+    if (byte == CHAR_ESCAPE || byte == CHAR_START || byte == CHAR_STOP) {
+        bytes[0] = CHAR_ESCAPE;
+        bytes[1] = ~byte;
+        return 2;
+    }
+    bytes[0] = byte;
+    return 1;
+}
+
+/**
+ * Encode the packet in data (header and payload, without the crc) into bytes. Returns the length.
+ */
+uint8_t host_encode(const uint8_t *data, uint8_t length, uint8_t *bytes) {
+    uint8_t count = 0;
+    uint8_t crc = 0;
+    bytes[count++] = CHAR_START;
+    for (uint8_t i = 0; i < length; i++) {
+        crc = crc8(data[i], crc);
+        count += put_escaped(data[i], bytes + count);
+    }
+    count += put_escaped(crc, bytes + count);
+    bytes[count++] = CHAR_STOP;
+    return count;
+}
+
+/**
+ * Feed a received byte to decoder. Returns the length of the packet in decoder->data once a frame
+ * with a valid crc is complete (the crc is not included), zero otherwise.
+ */
+uint8_t host_decode(host_decoder *decoder, uint8_t byte) {
+    if (byte == CHAR_START) {
+        decoder->state = STATE_FRAME;
+        decoder->crc = 0;
+        decoder->length = 0;
+        return 0;
+    }
+    if (decoder->state == STATE_IDLE) {
+        return 0;
+    }
+
+    if (byte == CHAR_STOP) {
+        decoder->state = STATE_IDLE;
+        // the crc over the data and the crc itself is zero
+        if (decoder->crc || decoder->length < 4) {
+            return 0;
+        }
+        return decoder->length - 1;
+    }
+    if (byte == CHAR_ESCAPE) {
+        decoder->state = STATE_ESCAPING;
+        return 0;
+    }
+    if (decoder->state == STATE_ESCAPING) {
+        byte = ~byte;
+        decoder->state = STATE_FRAME;
+    }
+
+    if (decoder->length == LBP_BUFFER_SIZE) {
+        decoder->state = STATE_IDLE;
+        return 0;
+    }
+    decoder->data[decoder->length++] = byte;
+    decoder->crc = crc8(byte, decoder->crc);
+    return 0;
+}
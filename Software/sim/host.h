@@ -0,0 +1,36 @@
+#ifndef _SIM_HOST_H_
+#define _SIM_HOST_H_
+
+#include <stdint.h>
+#include "lbp.h"
+
+/**
+ * This file contains the host side of the launch box protocol link layer, the part LaunchBoxProtocol.py
+ * does for the configuration tool.
+ */
+
+// largest encoded frame, every byte of the data and the crc escaped
+#define HOST_FRAME_BYTES    (2 * LBP_BUFFER_SIZE + 2)
+
+/**
+ * Receiving end of the link layer
+ */
+typedef struct {
+    uint8_t state;
+    uint8_t crc;
+    uint8_t length;
+    uint8_t data[LBP_BUFFER_SIZE];
+} host_decoder;
+
+/**
+ * Encode the packet in data (header and payload, without the crc) into bytes. Returns the length.
+ */
+uint8_t host_encode(const uint8_t *data, uint8_t length, uint8_t *bytes);
+
+/**
+ * Feed a received byte to decoder. Returns the length of the packet in decoder->data once a frame
+ * with a valid crc is complete (the crc is not included), zero otherwise.
+ */
+uint8_t host_decode(host_decoder *decoder, uint8_t byte);
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef _SIM_AVR_EEPROM_H_
+#define _SIM_AVR_EEPROM_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+/**
+ * The EEPROM variables live in RAM, so a simulation can change the configuration before init()
+ * by assigning them. Writes complete immediately.
+ */
+#define EEMEM
+
+static inline uint8_t eeprom_read_byte(const uint8_t *address) { return *address; }
+static inline uint16_t eeprom_read_word(const uint16_t *address) { return *address; }
+static inline uint32_t eeprom_read_dword(const uint32_t *address) { return *address; }
+static inline void eeprom_read_block(void *destination, const void *source, size_t length) {
+    memcpy(destination, source, length);
+}
+
+static inline void eeprom_write_byte(uint8_t *address, uint8_t value) { *address = value; }
+static inline void eeprom_update_byte(uint8_t *address, uint8_t value) { *address = value; }
+static inline void eeprom_update_word(uint16_t *address, uint16_t value) { *address = value; }
+static inline void eeprom_update_dword(uint32_t *address, uint32_t value) { *address = value; }
+static inline void eeprom_update_block(const void *source, void *destination, size_t length) {
+    memcpy(destination, source, length);
+}
+
+#define eeprom_is_ready()   1
+
+#endif
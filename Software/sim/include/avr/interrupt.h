@@ -0,0 +1,16 @@
+#ifndef _SIM_AVR_INTERRUPT_H_
+#define _SIM_AVR_INTERRUPT_H_
+
+#include <avr/io.h>
+
+/**
+ * Interrupt vectors are plain functions, hal.cpp calls them when their flags are set and the
+ * I bit in SREG allows it.
+ */
+#define ISR(vector, ...)    extern "C" void vector(void) __VA_ARGS__; extern "C" void vector(void)
+#define ISR_ALIASOF(target) __attribute__((alias(#target)))
+
+#define sei()               (SREG |= 0x80)
+#define cli()               (SREG &= ~0x80)
+
+#endif
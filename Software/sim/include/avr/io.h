@@ -0,0 +1,221 @@
+#ifndef _SIM_AVR_IO_H_
+#define _SIM_AVR_IO_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * This file stands in for avr-libc's <avr/io.h> in the SRP_HOST build. The registers of the
+ * ATtiny1634 that the firmware uses are plain variables, which hal.cpp reads and updates as it
+ * steps the peripherals. Registers with side effects on access are small classes.
+ */
+
+/**
+ * UDR0: reading takes a byte from the receive buffer, writing starts a transmission
+ */
+class sim_udr_register {
+public:
+    operator uint8_t();
+    sim_udr_register &operator=(uint8_t value);
+};
+
+/**
+ * UCSR0D: writing a one clears RXS0, the other bits are plain
+ */
+class sim_ucsrd_register {
+public:
+    uint8_t value;
+    operator uint8_t() const { return value; }
+    sim_ucsrd_register &operator=(uint8_t write);
+};
+
+/**
+ * Interrupt flag register, writing a one clears a flag
+ */
+class sim_flag_register {
+public:
+    uint8_t value;
+    operator uint8_t() const { return value; }
+    sim_flag_register &operator=(uint8_t clear) { value &= ~clear; return *this; }
+};
+
+// status register, only the I bit is used
+extern volatile uint8_t SREG;
+
+// system
+extern volatile uint8_t CLKPR;
+extern volatile uint8_t MCUSR;
+extern volatile uint8_t PRR;
+extern volatile uint8_t CCP;
+
+// watchdog
+extern volatile uint8_t WDTCSR;
+
+// analog comparator
+extern volatile uint8_t ACSRA;
+
+// ports
+extern volatile uint8_t DDRA, DDRB, DDRC;
+extern volatile uint8_t PORTA, PORTB, PORTC;
+extern volatile uint8_t PINA, PINB, PINC;
+extern volatile uint8_t PUEA, PUEB, PUEC;
+
+// pin change interrupts
+extern volatile uint8_t GIMSK;
+extern volatile uint8_t GIFR;
+extern volatile uint8_t PCMSK0, PCMSK1, PCMSK2;
+
+// timer 0
+extern volatile uint8_t TCCR0A, TCCR0B, TCNT0, OCR0A, OCR0B;
+
+// timer 1
+extern volatile uint8_t TCCR1A, TCCR1B;
+extern volatile uint16_t TCNT1, OCR1A, OCR1B, ICR1;
+extern volatile uint8_t TIMSK;
+extern sim_flag_register TIFR;
+
+// adc
+extern volatile uint8_t ADMUX, ADCSRA, ADCSRB, DIDR0;
+extern volatile uint16_t ADC;
+
+// usart 0
+extern sim_udr_register UDR0;
+extern volatile uint8_t UCSR0A, UCSR0B, UCSR0C;
+extern sim_ucsrd_register UCSR0D;
+extern volatile uint8_t UBRR0H, UBRR0L;
+
+// MCUSR
+#define PORF    0
+
+// PRR
+#define PRADC   0
+#define PRUSART0 1
+#define PRUSART1 2
+#define PRUSI   3
+#define PRTIM0  4
+#define PRTIM1  5
+#define PRTWI   6
+
+// WDTCSR
+#define WDP0    0
+#define WDP1    1
+#define WDP2    2
+#define WDE     3
+#define WDP3    5
+#define WDIE    6
+#define WDIF    7
+
+// ACSRA
+#define ACD     7
+
+// GIMSK, GIFR
+#define PCIE0   3
+#define PCIE1   4
+#define PCIE2   5
+#define PCIF0   3
+#define PCIF1   4
+#define PCIF2   5
+
+// PCMSK0..2
+#define PCINT0  0
+#define PCINT4  4
+#define PCINT5  5
+#define PCINT9  1
+#define PCINT13 1
+
+// TCCR0B
+#define CS00    0
+#define CS01    1
+#define CS02    2
+
+// TCCR1A, TCCR1B
+#define COM1B0  4
+#define COM1B1  5
+#define WGM12   3
+#define WGM13   4
+#define CS10    0
+#define CS11    1
+#define CS12    2
+
+// TIMSK, TIFR
+#define OCIE0A  0
+#define TOIE0   1
+#define OCIE0B  2
+#define ICIE1   3
+#define OCIE1B  5
+#define OCIE1A  6
+#define OCF0A   0
+#define TOV0    1
+#define OCF0B   2
+#define ICF1    3
+#define OCF1B   5
+#define OCF1A   6
+
+// ADMUX
+#define MUX0    0
+#define MUX1    1
+#define MUX2    2
+#define MUX3    3
+#define REFS0   6
+#define REFS1   7
+
+// ADCSRA
+#define ADPS0   0
+#define ADPS1   1
+#define ADPS2   2
+#define ADIE    3
+#define ADIF    4
+#define ADATE   5
+#define ADSC    6
+#define ADEN    7
+
+// ADCSRB
+#define ADTS0   0
+#define ADTS1   1
+#define ADTS2   2
+#define ADLAR   3
+
+// DIDR0
+#define ADC0D   0
+
+// UCSR0A
+#define DOR0    3
+#define FE0     4
+#define UDRE0   5
+#define TXC0    6
+#define RXC0    7
+
+// UCSR0B
+#define TXEN0   3
+#define RXEN0   4
+#define TXCIE0  6
+#define RXCIE0  7
+
+// UCSR0C
+#define UCSZ00  1
+
+// UCSR0D
+#define SFDE0   5
+#define RXS0    6
+#define RXSIE0  7
+
+/**
+ * Fuses, kept in a variable nobody reads
+ */
+#define FUSE_SUT_CKSEL1 0xFD
+#define FUSE_EESAVE     0xBF
+#define FUSE_SPIEN      0xDF
+#define FUSE_BODLEVEL1  0xFD
+#define FUSE_BODLEVEL0  0xFE
+#define FUSE_BODACT0    0xFB
+#define FUSE_BODPD0     0xFE
+
+typedef struct {
+    uint8_t low;
+    uint8_t high;
+    uint8_t extended;
+} sim_fuses_type;
+
+#define FUSES sim_fuses_type sim_fuses
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef _SIM_AVR_PGMSPACE_H_
+#define _SIM_AVR_PGMSPACE_H_
+
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * There is only one address space on the host
+ */
+#define PROGMEM
+#define PSTR(s)             (s)
+
+#define pgm_read_byte(address)  (*(const uint8_t *)(address))
+#define pgm_read_word(address)  (*(const uint16_t *)(address))
+#define memcpy_P            memcpy
+#define strlen_P            strlen
+
+#endif
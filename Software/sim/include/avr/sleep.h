@@ -0,0 +1,21 @@
+#ifndef _SIM_AVR_SLEEP_H_
+#define _SIM_AVR_SLEEP_H_
+
+#include <stdint.h>
+
+/**
+ * Sleeping steps the simulation until an interrupt has run, see sim_sleep(). In standby the
+ * peripherals that run on the io clock stop.
+ */
+void sim_sleep();
+extern uint8_t sim_sleep_mode;
+
+#define SLEEP_MODE_IDLE     0
+#define SLEEP_MODE_STANDBY  3
+
+#define set_sleep_mode(mode) (sim_sleep_mode = (mode))
+#define sleep_enable()
+#define sleep_disable()
+#define sleep_cpu()         sim_sleep()
+
+#endif
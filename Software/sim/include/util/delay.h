@@ -0,0 +1,12 @@
+#ifndef _SIM_UTIL_DELAY_H_
+#define _SIM_UTIL_DELAY_H_
+
+/**
+ * Busy waits step the simulation for their duration
+ */
+void sim_delay_us(double us);
+
+static inline void _delay_us(double us) { sim_delay_us(us); }
+static inline void _delay_ms(double ms) { sim_delay_us(ms * 1000); }
+
+#endif
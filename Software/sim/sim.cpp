@@ -0,0 +1,904 @@
+// Native simulation of the SRP firmware, with a benchmark suite for the lbp stack and the state
+// machine. The firmware sources are built unchanged against the registers in include/ and hal.cpp.
+// From the Software directory:
+//
+//     g++ -DSRP_HOST -O2 -Isim/include -Isim -Isrc src/*.cpp sim/*.cpp -o srp_sim
+//     ./srp_sim [benchmark]
+//
+// Without an argument all benchmarks run, otherwise those whose name starts with the argument.
+// Every benchmark runs in a fresh copy of the process, so the firmware always starts from reset.
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "hal.h"
+#include "host.h"
+#include "eeprom.h"
+#include "actuators.h"
+#include "params.h"
+#include "vote.h"
+#include "crc8.h"
+#include "power.h"
+
+// entry points of the firmware, see main.cpp
+void init();
+void update();
+
+// see state_machine.h
+uint8_t get_flight_state();
+
+/**
+ * Helpers
+ */
+
+#define MS(counts)          ((double)(counts) * 1000 / TIME_COUNTS_PER_SECOND)
+
+// a battery well above battery_empty_limit
+#define BATTERY_ADC         900
+
+// the pins the benchmarks drive, see config.h
+#define VOTE_PORT           SIM_PORT_C
+#define VOTE_BIT            1
+#define ARMED_PORT          SIM_PORT_A
+#define ARMED_BIT           4
+#define BREAKWIRE_PORT      SIM_PORT_B
+#define BREAKWIRE_BIT       1
+#define SQUIB_PORT          SIM_PORT_A
+#define SQUIB_BIT           5
+#define PYRO_PORT           SIM_PORT_A
+#define PYRO_BIT            2
+#define SERVO_PORT          SIM_PORT_C
+#define SERVO_BIT           0
+#define SERVO_HARDWARE_PORT SIM_PORT_A
+#define SERVO_HARDWARE_BIT  6
+
+// configuration the firmware boots with, the defaults unless a benchmark changes it
+static config_type boot_config;
+
+/**
+ * Store configuration into the EEPROM as a valid record, the way a commit leaves it
+ */
+static void store_config(const config_type *configuration) {
+    config_record record;
+    memset(&record, 0, sizeof(record));
+    record.config = *configuration;
+    record.version = CONFIG_VERSION;
+    record.crc = config_record_crc(&record);
+    record.sequence = 1;
+    config_slots[0] = record;
+}
+
+/**
+ * Start the firmware the way main() does
+ */
+static void boot() {
+    store_config(&boot_config);
+    sim_adc = BATTERY_ADC;
+    sim_init();
+    cli();
+    init();
+    sei();
+}
+
+/**
+ * Run the main loop for ms milliseconds
+ */
+static void run_for(uint32_t ms) {
+    uint64_t end = sim_time + TIME_FROM_MS(ms);
+    while (sim_time < end) {
+        update();
+    }
+}
+
+/**
+ * Host side of the link. Commands are numbered with the 4 sequence numbers of the window.
+ */
+#define HOST_ADDRESS        0x3F
+#define GET_MIN_DEPLOY_TIME 0x10
+#define SET_TELEMETRY       0x33
+#define SELF_TEST           0x36
+#define DEPLOY_VOTE         0x37
+#define GET_STATUS          0x38
+
+static host_decoder host;
+static uint8_t host_destination;    // of the commands, boards answer to address 0 by default
+static uint8_t host_sequence;
+static uint8_t host_window;         // commands kept in flight, 0 if the benchmark sends them
+static uint8_t host_in_flight;
+static uint64_t host_sent_time[4];
+
+static uint32_t host_requests;
+static uint32_t host_replies;
+static uint32_t host_nacks;
+static uint32_t host_async;
+static uint32_t host_bytes;
+static uint64_t host_round_trip_total;
+static uint64_t host_round_trip_max;
+static uint8_t host_reply_length;   // of the last reply, which stays in host.data
+
+static void host_command(uint8_t id, const uint8_t *data, uint8_t length) {
+    uint8_t packet[LBP_BUFFER_SIZE];
+    packet[0] = LBP_SYNC | HOST_ADDRESS;
+    packet[1] = (host_sequence << 6) | host_destination;
+    packet[2] = id;
+    for (uint8_t i = 0; i < length; i++) {
+        packet[3 + i] = data[i];
+    }
+
+    uint8_t bytes[HOST_FRAME_BYTES];
+    sim_uart_send(bytes, host_encode(packet, length + 3, bytes));
+    host_sent_time[host_sequence] = sim_time;
+    host_sequence = (host_sequence + 1) & 3;
+    host_requests++;
+    host_in_flight++;
+}
+
+static void host_broadcast(uint8_t id, const uint8_t *data, uint8_t length) {
+    uint8_t packet[LBP_BUFFER_SIZE];
+    packet[0] = LBP_BROADCAST | HOST_ADDRESS;
+    packet[1] = 0;
+    packet[2] = id;
+    for (uint8_t i = 0; i < length; i++) {
+        packet[3 + i] = data[i];
+    }
+
+    uint8_t bytes[HOST_FRAME_BYTES];
+    sim_uart_send(bytes, host_encode(packet, length + 3, bytes));
+}
+
+static void host_request() {
+    host_command(GET_MIN_DEPLOY_TIME, NULL, 0);
+}
+
+static void host_receive(uint8_t byte) {
+    host_bytes++;
+    uint8_t length = host_decode(&host, byte);
+    if (!length) {
+        return;
+    }
+
+    lbp_packet *packet = (lbp_packet *)host.data;
+    if (LBP_TYPE(packet) != LBP_REPLY) {
+        host_async++;
+        return;
+    }
+
+    if (packet->id == LBP_NACK) {
+        host_nacks++;
+    } else {
+        host_replies++;
+    }
+    host_reply_length = length;
+    uint64_t round_trip = sim_time - host_sent_time[LBP_SEQNUM(packet) >> 6];
+    host_round_trip_total += round_trip;
+    if (round_trip > host_round_trip_max) {
+        host_round_trip_max = round_trip;
+    }
+
+    if (host_in_flight) {
+        host_in_flight--;
+    }
+    if (host_window) {
+        host_request();
+    }
+}
+
+/**
+ * Send a command and run until its reply is in. Returns the round trip. The benchmark fails if there is
+ * no reply within HOST_TIMEOUT, the host doesn't retry.
+ */
+#define HOST_TIMEOUT        500 // ms
+
+static uint64_t host_poll(uint8_t id) {
+    uint32_t replies = host_replies + host_nacks;
+    uint64_t total = host_round_trip_total;
+    uint64_t timeout = sim_time + TIME_FROM_MS(HOST_TIMEOUT);
+    host_command(id, NULL, 0);
+    while (host_replies + host_nacks == replies) {
+        if (sim_time >= timeout) {
+            printf("  no reply to 0x%02X within %u ms\n", id, HOST_TIMEOUT);
+            fflush(stdout);
+            _exit(1);
+        }
+        update();
+    }
+    return host_round_trip_total - total;
+}
+
+/**
+ * Fail the benchmark if the link counted an error (see LBP_ERROR_*), call it once the errors are printed.
+ * The host doesn't retry, a lost frame takes a slot of the window for good.
+ */
+static void fail_on_link_errors(const uint8_t *errors) {
+    for (uint8_t i = 0; i < LBP_ERROR_COUNT; i++) {
+        if (errors[i]) {
+            fflush(stdout);
+            _exit(1);
+        }
+    }
+}
+
+/**
+ * The crc tables against the bitwise crc for every byte and crc value, and lbp_crc() against the check
+ * value of Comms.crc8 in LaunchBoxProtocol.py. Fails on a mismatch.
+ */
+#define CRC_CHECK_VALUE     0xA1 // over "123456789"
+
+static void benchmark_crc(uint8_t arg) {
+    (void)arg;
+    uint32_t table_errors = 0;
+    uint32_t nibble_errors = 0;
+    for (uint16_t crc = 0; crc < 256; crc++) {
+        for (uint16_t data = 0; data < 256; data++) {
+            uint8_t expected = crc8_bitwise(data, crc);
+            table_errors += crc8_by_table(data, crc) != expected;
+            nibble_errors += crc8_by_nibble(data, crc) != expected;
+        }
+    }
+    uint8_t check = lbp_crc((const uint8_t *)"123456789", 9, 0);
+    printf("  65536 pairs: table %u mismatches  nibble %u mismatches  check value 0x%02X, expected 0x%02X\n",
+           table_errors, nibble_errors, check, CRC_CHECK_VALUE);
+    if (table_errors || nibble_errors || check != CRC_CHECK_VALUE) {
+        fflush(stdout);
+        _exit(1);
+    }
+}
+
+/**
+ * A pad display polling a board: the status, the battery, its limit and the deploy mode one at a time the
+ * way it had to be done before, against the one extended status
+ */
+static void benchmark_status(uint8_t arg) {
+    (void)arg;
+    // a battery just above its limit, which is a warning
+    boot_config.battery_empty_limit = BATTERY_ADC / 4 - 4;
+    sim_set_pin(BREAKWIRE_PORT, BREAKWIRE_BIT, 0);
+    sim_uart_hook = host_receive;
+    boot();
+    run_for(500);
+
+    static const uint8_t queries[] = {LBP_STATUS_REQUEST, 0x10 | PARAM_BATTERY_VOLTAGE_PRECISE,
+                                      0x10 | PARAM_DEPLOY_MODE, 0x10 | PARAM_BATTERY_EMPTY_LIMIT};
+    uint64_t separate = 0;
+    for (uint8_t i = 0; i < sizeof(queries); i++) {
+        separate += host_poll(queries[i]);
+    }
+    host_poll(LBP_STATUS_REQUEST);
+    lbp_packet *packet = (lbp_packet *)host.data;
+    printf("  status 0x%02X \"%.*s\"  4 queries %.2f ms\n", packet->data[0], host_reply_length - 4,
+           (const char *)packet->data + 1, MS(separate));
+
+    uint64_t status = host_poll(GET_STATUS);
+    const uint8_t *d = packet->data;
+    printf("  extended status: state %u inputs 0x%02X battery %u warnings 0x%02X link errors %u/%u/%u "
+           "uptime %u ms \"%.*s\"  %u bytes %.2f ms\n", d[0], d[1], d[2] | (d[3] << 8), d[4], d[5], d[6], d[7],
+           d[8] | (d[9] << 8) | (d[10] << 16) | ((uint32_t)d[11] << 24), host_reply_length - 15,
+           (const char *)d + 12, host_reply_length - 3, MS(status));
+}
+
+/**
+ * A board with address BOARD_ADDRESS on a bus shared with other boards. It has to answer what's sent to
+ * it and to the unknown address, and stay quiet on commands for the others and on their replies.
+ * The host keeps a window of commands in flight to another board while it polls this one.
+ */
+#define BOARD_ADDRESS       5
+#define OTHER_ADDRESS       7
+
+static void benchmark_address(uint8_t arg) {
+    (void)arg;
+    boot_config.lbp_address = BOARD_ADDRESS;
+    sim_uart_hook = host_receive;
+    boot();
+    run_for(100);
+
+    static const uint8_t destinations[] = {BOARD_ADDRESS, LBP_ADDRESS_UNKNOWN, OTHER_ADDRESS, 0};
+    printf("  replies to");
+    for (uint8_t i = 0; i < sizeof(destinations); i++) {
+        uint32_t replies = host_replies + host_nacks;
+        host_destination = destinations[i];
+        host_request();
+        run_for(50);
+        printf(" 0x%02X: %u ", destinations[i], host_replies + host_nacks - replies);
+    }
+
+    // the reply of another board to the host
+    uint8_t reply[3] = {LBP_REPLY | LBP_SOURCE_ADDRESS, HOST_ADDRESS, GET_MIN_DEPLOY_TIME};
+    uint8_t bytes[HOST_FRAME_BYTES];
+    uint32_t replies = host_replies + host_nacks + host_async;
+    sim_uart_send(bytes, host_encode(reply, sizeof(reply), bytes));
+    run_for(50);
+    printf(" another board's reply: %u\n", host_replies + host_nacks + host_async - replies);
+
+    // the other board is busy, nothing may come back from this one for it
+    host_destination = OTHER_ADDRESS;
+    replies = host_replies + host_nacks;
+    uint32_t bytes_back = host_bytes;
+    for (uint8_t burst = 0; burst < 50; burst++) {
+        for (uint8_t i = 0; i < LBP_WINDOW_SIZE_CONTENT; i++) {
+            host_request();
+        }
+        run_for(20);
+    }
+    printf("  %u commands for 0x%02X  %u answered  %u bytes back\n", 50 * LBP_WINDOW_SIZE_CONTENT,
+           OTHER_ADDRESS, host_replies + host_nacks - replies, host_bytes - bytes_back);
+}
+
+/**
+ * A relay build with a board at PEER_ADDRESS behind it on the relay link. The host talks to the peer
+ * through the relay, and the peer's deploy vote broadcast has to reach both the relay and the host.
+ * Fails on a link error, and if the longest handler plus the pin change interrupt doesn't stay below
+ * half a bit of the relay link, see relay.h.
+ */
+#define PEER_ADDRESS        9
+#define RELAY_VOTER         3
+#define RELAY_START_CYCLES  100 // PCINT0 calling relay_pin_change() and comparing the input levels
+
+#if LBP_RELAY
+static host_decoder peer;
+static uint32_t peer_frames;
+
+static void peer_receive(uint8_t byte) {
+    uint8_t length = host_decode(&peer, byte);
+    if (!length) {
+        return;
+    }
+    peer_frames++;
+
+    lbp_packet *packet = (lbp_packet *)peer.data;
+    if (LBP_TYPE(packet) != LBP_SYNC || LBP_DEST_ADDR(packet) != PEER_ADDRESS) {
+        return;
+    }
+    uint8_t reply[3] = {LBP_REPLY | LBP_SOURCE_ADDRESS, (uint8_t)(LBP_SRC_ADDR(packet) | LBP_SEQNUM(packet)),
+                        packet->id};
+    uint8_t bytes[HOST_FRAME_BYTES];
+    sim_serial_send(bytes, host_encode(reply, sizeof(reply), bytes));
+}
+
+static void check_relay_budget() {
+    uint8_t longest = 0;
+    for (uint8_t i = 1; i < SIM_VECTOR_COUNT; i++) {
+        if (sim_get_vector_stats(i)->cycles > sim_get_vector_stats(longest)->cycles) {
+            longest = i;
+        }
+    }
+    const sim_vector_stats *stats = sim_get_vector_stats(longest);
+    uint32_t cycles = stats->cycles + sim_get_vector_stats(SIM_PCINT0)->cycles;
+    printf("  longest handler %s: %u cycles with the pin change, half a bit is %u\n", stats->name, cycles,
+           CPU_FREQ / RELAY_BAUD / 2);
+    if (cycles >= CPU_FREQ / RELAY_BAUD / 2) {
+        fflush(stdout);
+        _exit(1);
+    }
+}
+#endif
+
+static void benchmark_relay(uint8_t arg) {
+    (void)arg;
+#if LBP_RELAY
+    boot_config.vote_peers = 1 << RELAY_VOTER;
+    sim_uart_hook = host_receive;
+    sim_serial_hook = peer_receive;
+    sim_serial_init(SIM_PORT_A, 0, SIM_PORT_A, 1, TIME_COUNTS_PER_SECOND / RELAY_BAUD);
+    // the pin change interrupt of port A mostly catches start bits, the inputs rarely change here
+    sim_set_vector_cycles(SIM_PCINT0, RELAY_START_CYCLES);
+    boot();
+    run_for(100);
+
+    static const uint8_t destinations[] = {PEER_ADDRESS, 0, LBP_ADDRESS_UNKNOWN};
+    for (uint8_t i = 0; i < sizeof(destinations); i++) {
+        uint32_t frames = peer_frames;
+        host_destination = destinations[i];
+        uint64_t round_trip = host_poll(GET_MIN_DEPLOY_TIME);
+        printf("  to 0x%02X: round trip %6.2f ms  %u frames on the relay link\n", destinations[i],
+               MS(round_trip), peer_frames - frames);
+    }
+
+    uint8_t vote[5] = {LBP_BROADCAST | LBP_SOURCE_ADDRESS, 0, DEPLOY_VOTE, RELAY_VOTER, VOTE_APOGEE};
+    uint8_t bytes[HOST_FRAME_BYTES];
+    sim_serial_send(bytes, host_encode(vote, sizeof(vote), bytes));
+    run_for(50);
+    printf("  peer vote broadcast: votes 0x%02X  %u frames at the host\n", get_peer_votes(), host_async);
+
+    // a window of commands to the peer, the relay link is the bottleneck
+    host_destination = PEER_ADDRESS;
+    host_window = LBP_WINDOW_SIZE_CONTENT;
+    uint32_t replies = host_replies;
+    for (uint8_t i = 0; i < host_window; i++) {
+        host_request();
+    }
+    run_for(2000);
+    uint8_t errors[LBP_ERROR_COUNT];
+    lbp_read_errors(errors);
+    printf("  window %u to 0x%02X: %.0f replies/s  link errors %u/%u/%u\n", host_window, PEER_ADDRESS,
+           (host_replies - replies) / 2.0, errors[0], errors[1], errors[2]);
+    fail_on_link_errors(errors);
+    check_relay_budget();
+#else
+    printf("  LBP_RELAY is off in config.h\n");
+#endif
+}
+
+/**
+ * Throughput with a window of commands in flight. arg is the LBP_BAUD_* index in the low nibble
+ * and the window in the high nibble. Fails on a link error.
+ */
+static void benchmark_throughput(uint8_t arg) {
+    boot_config.lbp_baud_index = arg & 0x0F;
+    boot();
+    sim_uart_hook = host_receive;
+    run_for(100);
+
+    host_window = arg >> 4;
+    for (uint8_t i = 0; i < host_window; i++) {
+        host_request();
+    }
+    uint32_t bytes = host_bytes;
+    run_for(2000);
+
+    uint32_t answered = host_replies + host_nacks;
+    double line = (double)(host_bytes - bytes) / 2 * sim_uart_byte_time() / TIME_COUNTS_PER_SECOND;
+    uint8_t errors[LBP_ERROR_COUNT];
+    lbp_read_errors(errors);
+    printf("  %6.0f replies/s  round trip avg %6.2f ms max %6.2f ms  tx line %3.0f%%  nacks %u  link errors %u/%u/%u\n",
+           host_replies / 2.0, answered ? MS(host_round_trip_total / answered) : 0.0,
+           MS(host_round_trip_max), line * 100, host_nacks, errors[0], errors[1], errors[2]);
+    fail_on_link_errors(errors);
+}
+
+/**
+ * Bursts of commands with no regard for the window, every 50ms for 2 seconds, with telemetry at
+ * 50 Hz on top. arg is the burst length in the low nibble and the main loop time in ms in the high
+ * nibble.
+ */
+#define BURST_INTERVAL       50
+
+static void benchmark_pipelined(uint8_t arg) {
+    sim_loop_time = TIME_FROM_MS(arg >> 4);
+    arg &= 0x0F;
+    boot();
+    sim_uart_hook = host_receive;
+    run_for(100);
+
+    uint8_t rate = 50;
+    host_command(SET_TELEMETRY, &rate, 1);
+    run_for(100);
+
+    host_requests = host_replies = host_nacks = host_async = 0;
+    for (uint8_t burst = 0; burst < 2000 / BURST_INTERVAL; burst++) {
+        for (uint8_t i = 0; i < arg; i++) {
+            host_request();
+        }
+        run_for(BURST_INTERVAL);
+    }
+    run_for(100);
+
+    uint32_t dropped = host_requests - host_replies - host_nacks;
+    printf("  %4u commands  %4u replies  %4u nacks  %4u dropped (%5.1f%%)  %4u telemetry\n",
+           host_requests, host_replies, host_nacks, dropped, 100.0 * dropped / host_requests, host_async);
+}
+
+/**
+ * Host time spent in the interrupts under load: 230400 baud with a full window and telemetry at 50 Hz
+ */
+static void benchmark_isr(uint8_t arg) {
+    (void)arg;
+    boot_config.lbp_baud_index = LBP_BAUD_230400;
+    boot();
+    sim_uart_hook = host_receive;
+    run_for(100);
+
+    uint8_t rate = 50;
+    host_command(SET_TELEMETRY, &rate, 1);
+    run_for(100);
+    host_window = LBP_WINDOW_SIZE_CONTENT;
+    for (uint8_t i = 0; i < host_window; i++) {
+        host_request();
+    }
+    run_for(2000);
+
+    for (uint8_t i = 0; i < SIM_VECTOR_COUNT; i++) {
+        const sim_vector_stats *stats = sim_get_vector_stats(i);
+        if (!stats->calls) {
+            continue;
+        }
+        printf("  %-14s %8u calls  %4u cycles %5.1f%% cpu (estimated)  avg %6.0f ns  max %7u ns (host)\n",
+               stats->name, stats->calls, stats->cycles, 100.0 * stats->calls * stats->cycles / (sim_time * 8),
+               (double)stats->total_ns / stats->calls, stats->max_ns);
+    }
+}
+
+/**
+ * Flight scenarios. The board boots with the breakwire connected, is armed at ARM_TIME and the
+ * breakwire breaks at LAUNCH_TIME. Deployment is measured from the break to the actuator: the pyro
+ * pin going high or the start of the first servo pulse that is closer to open than to closed.
+ */
+#define ARM_TIME            300
+#define LAUNCH_TIME         600
+#define MIN_DEPLOY          50  // 20ms periods
+#define MAX_DEPLOY          100
+#define FLIGHT_TIME         2500
+
+#define NO_VOTE             0xFFFF
+
+// peer votes are broadcast by the host as board PEER_VOTER, and repeated every PEER_REPEAT
+#define PEER_VOTER          2
+#define PEER_REPEAT         100
+#define PEERS               (1 << PEER_VOTER)
+#define OTHER_PEERS         (1 << (PEER_VOTER + 1))
+
+typedef struct {
+    uint8_t use_servo;
+    uint8_t servo_output;
+    uint16_t vote_time;         // from the break, ms
+    uint16_t vote_length;       // ms, 0 keeps voting
+    uint8_t vote_peers;         // configuration, see vote.h
+    uint8_t vote_quorum;
+    uint16_t peer_time;         // from the break, ms
+    uint16_t peer_length;       // ms, 0 keeps voting
+    uint16_t expected;          // deploy time from the break, ms
+} flight_type;
+
+static const flight_type flights[] = {
+    {1, SERVO_OUTPUT_SOFTWARE, NO_VOTE, 0,  0,           1, NO_VOTE, 0,   MAX_DEPLOY * 20},
+    {1, SERVO_OUTPUT_SOFTWARE, 1500,    0,  0,           1, NO_VOTE, 0,   1500},
+    {1, SERVO_OUTPUT_SOFTWARE, 500,     0,  0,           1, NO_VOTE, 0,   MIN_DEPLOY * 20},
+    {1, SERVO_OUTPUT_SOFTWARE, 1500,    1,  0,           1, NO_VOTE, 0,   MAX_DEPLOY * 20}, // shorter than the debouncing
+    {1, SERVO_OUTPUT_HARDWARE, 1500,    0,  0,           1, NO_VOTE, 0,   1500},
+    {0, SERVO_OUTPUT_SOFTWARE, NO_VOTE, 0,  0,           1, NO_VOTE, 0,   MAX_DEPLOY * 20},
+    {0, SERVO_OUTPUT_SOFTWARE, 1500,    0,  0,           1, NO_VOTE, 0,   1500},
+    {1, SERVO_OUTPUT_SOFTWARE, NO_VOTE, 0,  PEERS,       1, 1500,    0,   1500},
+    {1, SERVO_OUTPUT_SOFTWARE, 1500,    0,  PEERS,       2, 1200,    0,   1500},
+    {1, SERVO_OUTPUT_SOFTWARE, 1200,    0,  PEERS,       2, 1500,    0,   1500},
+    {1, SERVO_OUTPUT_SOFTWARE, 1500,    0,  PEERS,       2, 800,     200, MAX_DEPLOY * 20}, // stale by then
+    {1, SERVO_OUTPUT_SOFTWARE, 1500,    0,  OTHER_PEERS, 2, 1200,    0,   MAX_DEPLOY * 20}, // not a peer
+    {0, SERVO_OUTPUT_SOFTWARE, NO_VOTE, 0,  PEERS,       1, 1500,    0,   1500}
+};
+
+static const flight_type *flight;
+static uint64_t servo_rise;
+static uint64_t deploy_time;
+
+static void flight_script() {
+    uint64_t now = sim_time;
+    if (now == TIME_FROM_MS(ARM_TIME)) {
+        sim_set_pin(ARMED_PORT, ARMED_BIT, 0);
+    }
+    if (now == TIME_FROM_MS(LAUNCH_TIME)) {
+        sim_set_pin(BREAKWIRE_PORT, BREAKWIRE_BIT, 0);
+    }
+    if (flight->vote_time != NO_VOTE) {
+        uint32_t vote = LAUNCH_TIME + flight->vote_time;
+        if (now == TIME_FROM_MS(vote)) {
+            sim_set_pin(VOTE_PORT, VOTE_BIT, 0);
+        }
+        if (flight->vote_length && now == TIME_FROM_MS(vote + flight->vote_length)) {
+            sim_release_pin(VOTE_PORT, VOTE_BIT);
+        }
+    }
+    if (flight->peer_time != NO_VOTE) {
+        uint32_t vote = LAUNCH_TIME + flight->peer_time;
+        uint32_t end = flight->peer_length ? vote + flight->peer_length : LAUNCH_TIME + FLIGHT_TIME;
+        for (uint32_t t = vote; t < end; t += PEER_REPEAT) {
+            if (now == TIME_FROM_MS(t)) {
+                uint8_t data[2] = {PEER_VOTER, VOTE_APOGEE};
+                host_broadcast(DEPLOY_VOTE, data, 2);
+            }
+        }
+    }
+}
+
+static void flight_pins(uint8_t port, uint8_t bit, uint8_t level) {
+    if (deploy_time) {
+        return;
+    }
+    if (port == PYRO_PORT && bit == PYRO_BIT && level) {
+        deploy_time = sim_time;
+        return;
+    }
+
+    uint8_t servo = flight->servo_output == SERVO_OUTPUT_HARDWARE ?
+        port == SERVO_HARDWARE_PORT && bit == SERVO_HARDWARE_BIT : port == SERVO_PORT && bit == SERVO_BIT;
+    if (!servo) {
+        return;
+    }
+    if (level) {
+        servo_rise = sim_time;
+    } else if (sim_time - servo_rise > TIME_FROM_US((config.servo_min_pulse + config.servo_max_pulse) / 2) &&
+               sim_time > TIME_FROM_MS(LAUNCH_TIME)) {
+        deploy_time = servo_rise;
+    }
+}
+
+static void benchmark_flight(uint8_t arg) {
+    flight = flights + arg;
+    boot_config.use_servo = flight->use_servo;
+    boot_config.servo_output = flight->servo_output;
+    boot_config.min_deploy_time = MIN_DEPLOY;
+    boot_config.max_deploy_time = MAX_DEPLOY;
+    boot_config.vote_peers = flight->vote_peers;
+    boot_config.vote_quorum = flight->vote_quorum;
+
+    sim_set_pin(BREAKWIRE_PORT, BREAKWIRE_BIT, 1);
+    sim_set_pin(SQUIB_PORT, SQUIB_BIT, 1);
+    sim_step_hook = flight_script;
+    sim_pin_hook = flight_pins;
+    boot();
+    run_for(LAUNCH_TIME + FLIGHT_TIME);
+
+    double launch = MS(TIME_FROM_MS(LAUNCH_TIME));
+    if (!deploy_time) {
+        printf("  no deployment, expected at %u ms\n", flight->expected);
+        return;
+    }
+    double deployed = MS(deploy_time) - launch;
+    printf("  deployed %8.2f ms after the break, expected %4u ms, late %6.2f ms\n",
+           deployed, flight->expected, deployed - flight->expected);
+}
+
+/**
+ * A board flashed with the EEPROM image. It has to boot from the default record in the first slot,
+ * which fails when CONFIG_DEFAULTS_CRC in eeprom.cpp is out of date. Fails if the record isn't loaded.
+ */
+static void benchmark_config_image(uint8_t arg) {
+    (void)arg;
+    config_record record;
+    eeprom_read_block(&record, config_slots, sizeof(config_record));
+    config_type defaults;
+    memcpy_P(&defaults, &config_defaults, sizeof(config_type));
+    init_eeprom();
+    uint8_t loaded = !memcmp(&config, &defaults, sizeof(config_type));
+    printf("  version %u crc 0x%02X, expected 0x%02X  valid %u  defaults %u\n", record.version, record.crc,
+           config_record_crc(&record), config_is_valid(), loaded);
+    if (!config_is_valid() || !loaded) {
+        fflush(stdout);
+        _exit(1);
+    }
+}
+
+/**
+ * Power loss during a configuration commit, at every byte of it. A board that boots afterwards has to
+ * load either the old or the new configuration as a whole, never a mix of them.
+ */
+#define OLD_DEPLOY_TIME     500
+#define NEW_DEPLOY_TIME     600
+
+static void benchmark_config_commit(uint8_t arg) {
+    (void)arg;
+    uint8_t old_count = 0;
+    uint8_t new_count = 0;
+    uint8_t torn = 0;
+    // a commit takes at most one call per byte and one to finish
+    for (uint8_t cut = 0; cut <= sizeof(config_record) + 1; cut++) {
+        boot_config.min_deploy_time = OLD_DEPLOY_TIME;
+        boot_config.max_deploy_time = OLD_DEPLOY_TIME + 1;
+        memset(config_slots + 1, 0xFF, sizeof(config_record));
+        store_config(&boot_config);
+        init_eeprom();
+
+        // a batched write of both times, interrupted after cut byte writes
+        config_write(&config.min_deploy_time, NEW_DEPLOY_TIME);
+        config_write(&config.max_deploy_time, NEW_DEPLOY_TIME + 1);
+        for (uint8_t i = 0; i < cut; i++) {
+            update_eeprom();
+        }
+
+        init_eeprom();
+        if (!config_is_valid()) {
+            torn++;
+        } else if (config.min_deploy_time == OLD_DEPLOY_TIME && config.max_deploy_time == OLD_DEPLOY_TIME + 1) {
+            old_count++;
+        } else if (config.min_deploy_time == NEW_DEPLOY_TIME && config.max_deploy_time == NEW_DEPLOY_TIME + 1) {
+            new_count++;
+        } else {
+            torn++;
+        }
+    }
+    printf("  %3u cut points  %3u old  %3u new  %3u torn or invalid\n", old_count + new_count + torn,
+           old_count, new_count, torn);
+}
+
+/**
+ * Pre-flight self-test over lbp. The servo draws current for SERVO_MOVE_TIME whenever its pulse width
+ * changes, which has to show up as the settle time of the report.
+ */
+#define SERVO_MOVE_TIME     300
+#define SERVO_SAG_ADC       40
+
+static uint64_t servo_sag_end;
+static uint64_t servo_pulse;
+static uint8_t self_test_report[LBP_BUFFER_SIZE];
+static uint8_t self_test_report_length;
+
+static void self_test_pins(uint8_t port, uint8_t bit, uint8_t level) {
+    if (port != SERVO_PORT || bit != SERVO_BIT) {
+        return;
+    }
+    if (level) {
+        servo_rise = sim_time;
+        return;
+    }
+    uint64_t pulse = sim_time - servo_rise;
+    uint64_t change = pulse > servo_pulse ? pulse - servo_pulse : servo_pulse - pulse;
+    if (servo_pulse && change > TIME_FROM_US(50)) {
+        servo_sag_end = sim_time + TIME_FROM_MS(SERVO_MOVE_TIME);
+    }
+    servo_pulse = pulse;
+}
+
+static void self_test_battery() {
+    sim_adc = sim_time < servo_sag_end ? BATTERY_ADC - SERVO_SAG_ADC : BATTERY_ADC;
+}
+
+static void self_test_receive(uint8_t byte) {
+    uint8_t length = host_decode(&host, byte);
+    lbp_packet *packet = (lbp_packet *)host.data;
+    if (length && LBP_TYPE(packet) != LBP_REPLY && packet->id == SELF_TEST) {
+        memcpy(self_test_report, packet->data, length - 3);
+        self_test_report_length = length - 3;
+    }
+}
+
+static void benchmark_self_test(uint8_t arg) {
+    (void)arg;
+    sim_set_pin(BREAKWIRE_PORT, BREAKWIRE_BIT, 0);
+    sim_set_pin(SQUIB_PORT, SQUIB_BIT, 1);
+    sim_pin_hook = self_test_pins;
+    sim_step_hook = self_test_battery;
+    sim_uart_hook = self_test_receive;
+    boot();
+    run_for(500);
+
+    uint8_t start = 1;
+    host_command(SELF_TEST, &start, 1);
+    run_for(6000);
+
+    if (self_test_report_length != 11) {
+        printf("  no report\n");
+        return;
+    }
+    const uint8_t *r = self_test_report;
+    printf("  state %u  failures 0x%02X  continuity 0x%02X  battery %u min %u\n", r[0], r[1], r[2], r[3], r[4]);
+    printf("  servo settle %u ms with %u ms of current, filter lag included  loop latency max %.1f us avg %.1f us\n",
+           r[5] | (r[6] << 8), SERVO_MOVE_TIME, MS(r[7] | (r[8] << 8)) * 1000, MS(r[9] | (r[10] << 8)) * 1000);
+}
+
+/**
+ * Pad standby in IDLE and PREPARATION. Standby only ends on an event, so the script wakes the board with
+ * a command over lbp and with the breakwire. Reports the time in standby after STANDBY_DELAY, how far the
+ * time base drifted, and how long the command and the breakwire take to get through. Fails if the time
+ * base is off by more than half a watchdog interval per wake up and the period carried along, see
+ * power.h.
+ */
+#define STANDBY_PHASE       (STANDBY_DELAY + 10000)
+#define STANDBY_SETTLE      1000 // into the phase, from there on the board should be in standby
+#define COMMAND_TIME        STANDBY_PHASE
+#define BREAKWIRE_TIME      (2 * STANDBY_PHASE)
+#define END_TIME            (3 * STANDBY_PHASE)
+#define FLIGHT_PREPARATION  3 // see state_machine.cpp
+
+static uint64_t standby_start;
+static uint64_t standby_start_time;
+
+static void standby_script() {
+    uint64_t now = sim_time;
+    if (now == TIME_FROM_MS(STANDBY_DELAY + STANDBY_SETTLE) ||
+        now == TIME_FROM_MS(BREAKWIRE_TIME + STANDBY_DELAY + STANDBY_SETTLE)) {
+        standby_start = sim_standby_time;
+        standby_start_time = now;
+    }
+    if (now == TIME_FROM_MS(COMMAND_TIME) || now == TIME_FROM_MS(END_TIME)) {
+        host_command(GET_MIN_DEPLOY_TIME, NULL, 0);
+    }
+    if (now == TIME_FROM_MS(BREAKWIRE_TIME)) {
+        sim_set_pin(BREAKWIRE_PORT, BREAKWIRE_BIT, 1);
+    }
+}
+
+static void standby_report(uint8_t wakes) {
+    int32_t drift = get_time() - (uint32_t)sim_time;
+    uint32_t limit = wakes * (STANDBY_WAKE_TIME / 2) + TIME_COUNTS_PER_PERIOD;
+    printf("  %.1f%% of %.0f s in standby  time base %+.1f ms, limit %.1f ms\n",
+           100.0 * (sim_standby_time - standby_start) / (sim_time - standby_start_time),
+           MS(sim_time - standby_start_time) / 1000, MS(drift), MS(limit));
+    if ((uint32_t)(drift < 0 ? -drift : drift) > limit) {
+        fflush(stdout);
+        _exit(1);
+    }
+}
+
+static void benchmark_standby(uint8_t arg) {
+    (void)arg;
+    sim_set_pin(BREAKWIRE_PORT, BREAKWIRE_BIT, 0);
+    sim_step_hook = standby_script;
+    sim_uart_hook = host_receive;
+    boot();
+
+    // IDLE, woken up by a command
+    run_for(COMMAND_TIME);
+    standby_report(1);
+    run_for(100);
+    printf("  command: %u replies  round trip %.2f ms\n", host_replies, MS(host_round_trip_max));
+
+    // woken up by the breakwire, PREPARATION
+    while (get_flight_state() != FLIGHT_PREPARATION) {
+        update();
+    }
+    printf("  breakwire: PREPARATION after %.2f ms\n", MS(sim_time - TIME_FROM_MS(BREAKWIRE_TIME)));
+    run_for(END_TIME - MS(sim_time));
+    standby_report(3);
+    printf("  %u watchdog wakes\n", sim_get_vector_stats(SIM_WDT)->calls);
+}
+
+/**
+ * Benchmark table
+ */
+typedef struct {
+    const char *name;
+    void (*run)(uint8_t arg);
+    uint8_t arg;
+} benchmark_type;
+
+static const benchmark_type benchmarks[] = {
+    {"crc",                             benchmark_crc,          0},
+    {"throughput 38400 window 1",       benchmark_throughput,   (1 << 4) | LBP_BAUD_38400},
+    {"throughput 38400 window 4",       benchmark_throughput,   (4 << 4) | LBP_BAUD_38400},
+    {"throughput 115200 window 4",      benchmark_throughput,   (4 << 4) | LBP_BAUD_115200},
+    {"throughput 230400 window 4",      benchmark_throughput,   (4 << 4) | LBP_BAUD_230400},
+    {"pipelined burst 4",               benchmark_pipelined,    4},
+    {"pipelined burst 8",               benchmark_pipelined,    8},
+    {"pipelined burst 4 loop 10ms",     benchmark_pipelined,    (10 << 4) | 4},
+    {"pipelined burst 6 loop 10ms",     benchmark_pipelined,    (10 << 4) | 6},
+    {"pipelined burst 8 loop 10ms",     benchmark_pipelined,    (10 << 4) | 8},
+    {"isr",                             benchmark_isr,          0},
+    {"flight servo timeout",            benchmark_flight,       0},
+    {"flight servo vote",               benchmark_flight,       1},
+    {"flight servo early vote",         benchmark_flight,       2},
+    {"flight servo vote glitch",        benchmark_flight,       3},
+    {"flight hardware servo vote",      benchmark_flight,       4},
+    {"flight pyro timeout",             benchmark_flight,       5},
+    {"flight pyro vote",                benchmark_flight,       6},
+    {"flight servo peer vote",          benchmark_flight,       7},
+    {"flight servo peer and pin vote",  benchmark_flight,       8},
+    {"flight servo pin and peer vote",  benchmark_flight,       9},
+    {"flight servo stale peer vote",    benchmark_flight,       10},
+    {"flight servo unknown peer vote",  benchmark_flight,       11},
+    {"flight pyro peer vote",           benchmark_flight,       12},
+    {"config image",                    benchmark_config_image, 0},
+    {"config commit power loss",        benchmark_config_commit, 0},
+    {"self test",                       benchmark_self_test,    0},
+    {"standby",                         benchmark_standby,      0},
+    {"status poll",                     benchmark_status,       0},
+    {"address filter",                  benchmark_address,      0},
+    {"relay",                           benchmark_relay,        0}
+};
+
+#define BENCHMARK_COUNT (sizeof(benchmarks) / sizeof(benchmarks[0]))
+
+int main(int argc, char **argv) {
+    const char *filter = argc > 1 ? argv[1] : "";
+    int failed = 0;
+
+    for (uint8_t i = 0; i < BENCHMARK_COUNT; i++) {
+        if (strncmp(benchmarks[i].name, filter, strlen(filter))) {
+            continue;
+        }
+        printf("%s\n", benchmarks[i].name);
+        fflush(stdout);
+
+        // the firmware keeps its state in globals, a child starts from a clean copy of them
+        memcpy_P(&boot_config, &config_defaults, sizeof(config_type));
+        pid_t pid = fork();
+        if (!pid) {
+            benchmarks[i].run(benchmarks[i].arg);
+            fflush(stdout);
+            _exit(0);
+        }
+        int status;
+        waitpid(pid, &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+            printf("  failed\n");
+            failed = 1;
+        }
+    }
+    return failed;
+}
@@ -1,103 +1,290 @@
 #include "actuators.h"
+#include "events.h"
+#include "scheduler.h"
+#include "eeprom.h"
+#include "profiling.h"
+#include <avr/pgmspace.h>
 
 /**
  * Internal data
  */
 
-// buzzer queue data structures
+// buzzer patterns. A step sounds the buzzer for on ticks of 20ms and then stays silent for off ticks,
+// a pattern is a list of steps ended by BUZZER_STEP_END
 typedef struct {
-    uint8_t duration;
-} buzzer_queue_entry;
+    uint8_t on;
+    uint8_t off;
+} buzzer_step;
 
+#define BUZZER_STEP_END {0, 0}
+
+typedef struct {
+    const buzzer_step *steps;   // in PROGMEM
+    uint8_t repeat;             // amount of times the steps are played, 0 loops until another pattern plays
+    uint8_t priority;           // BUZZER_PRIORITY_*
+} buzzer_pattern;
+
+static const buzzer_step buzzer_short_steps[] PROGMEM = {
+    {BEEP_SHORT, BEEP_SHORT}, BUZZER_STEP_END
+};
+
+static const buzzer_step buzzer_normal_steps[] PROGMEM = {
+    {BEEP_NORMAL, BEEP_NORMAL}, BUZZER_STEP_END
+};
+
+static const buzzer_step buzzer_long_steps[] PROGMEM = {
+    {BEEP_LONG, BEEP_LONG}, BUZZER_STEP_END
+};
+
+static const buzzer_step buzzer_ok_steps[] PROGMEM = {
+    {BEEP_SHORT, BEEP_SHORT}, {BEEP_SHORT, BEEP_SHORT}, BUZZER_STEP_END
+};
+
+// a song on a single pitch, in 0.25s to 2s tones
+static const buzzer_step buzzer_song_steps[] PROGMEM = {
+    {0, 24}, {0, 24}, {6, 6}, {6, 6}, {6, 6}, {6, 6},
+    {12, 12}, {6, 6}, {6, 6}, {12, 12}, {6, 6}, {6, 6},
+    {24, 24}, {6, 6}, {6, 6}, {6, 6}, {6, 6},
+    {48, 48}, BUZZER_STEP_END
+};
+
+// indexed by BUZZER_* id
+static const buzzer_pattern buzzer_patterns[BUZZER_PATTERN_COUNT] PROGMEM = {
+    {NULL, 0, 0},                                           // BUZZER_NONE
+    {buzzer_ok_steps, 1, BUZZER_PRIORITY_STATUS},           // BUZZER_OK
+    {buzzer_long_steps, 1, BUZZER_PRIORITY_STATUS},         // BUZZER_CANCEL
+    {buzzer_long_steps, 0, BUZZER_PRIORITY_ALARM},          // BUZZER_ERROR
+    {buzzer_short_steps, 0, BUZZER_PRIORITY_STATUS},        // BUZZER_FLIGHT
+    {buzzer_long_steps, 0, BUZZER_PRIORITY_STATUS},         // BUZZER_DEPLOYED
+    {buzzer_short_steps, 1, BUZZER_PRIORITY_STATUS},        // BUZZER_BIT_0
+    {buzzer_long_steps, 1, BUZZER_PRIORITY_STATUS},         // BUZZER_BIT_1
+    {buzzer_normal_steps, 1, BUZZER_PRIORITY_STATUS},       // BUZZER_END
+    {buzzer_song_steps, 0, BUZZER_PRIORITY_STATUS},         // BUZZER_SONG
+};
+
+// patterns waiting for the current one to finish
 typedef struct {
-    volatile uint8_t index;
-    volatile uint8_t length;
-    buzzer_queue_entry queue[BUZZER_QUEUE_SIZE];
+    uint8_t index;
+    uint8_t length;
+    uint8_t queue[BUZZER_QUEUE_SIZE];
 } buzzer_queue_type;
 
 static buzzer_queue_type buzzer_queue;
 
-// buzzer current beep data
-#define BUZZER_OFF      0
-#define BUZZER_ON       1
-#define BUZZER_COOLDOWN 2
-static uint8_t buzzer_state = BUZZER_OFF;
-static uint8_t current_beep_duration;
+// the pattern that is playing
+static volatile uint8_t buzzer_current = BUZZER_NONE;
+static buzzer_pattern buzzer_playing;
+static uint8_t buzzer_step_index;
+static uint8_t buzzer_repeat;   // rounds left of a pattern that doesn't loop
+static uint8_t buzzer_ticks;    // ticks left of the current half of the step
+static uint8_t buzzer_sounding; // nonzero in the on half of the step
+
+// servo state. The pulse width is only moved to OCR1B when a pulse starts,
+// so a pulse is never cut short or stretched by a new position
+static uint8_t servo_output_mode;
+static volatile uint8_t servo_started;
+static volatile uint8_t servo_position;
+static volatile uint8_t servo_target;
+static volatile uint16_t servo_pulse; // timer counts
+
+// the calibration servo_pulse was worked out with, in microseconds
+static uint16_t servo_pulse_min;
+static uint16_t servo_pulse_max;
 
 // timer data structure
 static volatile uint16_t timer_20ms;
 
+// amount of 20ms timer periods since boot
+static volatile uint32_t timer_periods;
+
+// time at the start of the current period, see get_time(). Kept along so reading the time needs no multiply
+static volatile uint32_t timer_time;
+
+// stop the timer at the end of the next servo pulse, see suspend_timer()
+static volatile uint8_t timer_suspending;
+
+#define TIMER_CLOCK_MASK ((1 << CS12) | (1 << CS11) | (1 << CS10))
+#define TIMER_CLOCK      (1 << CS11) // a clock divider of x8
+
 /**
  * Internal routines.
  * the tick routines are called every 20 ms in a timer1 interrupt
  */
 
 static void servo_tick() {
-    // pull the servo pwm pin high
-    WRITE_PIN(SERVO_PIN, 1);
+    // pull the servo pwm pin high, the pulse ends at the width of the latest position
+    if (servo_output_mode == SERVO_OUTPUT_SOFTWARE && servo_started) {
+        OCR1B = servo_pulse;
+        SERVO_PIN::set();
+    }
+}
+
+/**
+ * Returns the pulse width of a servo position in timer counts
+ */
+static uint16_t servo_pulse_counts(uint8_t position) {
+    servo_pulse_min = config.servo_min_pulse;
+    servo_pulse_max = config.servo_max_pulse;
+    int32_t min = TIME_FROM_US(servo_pulse_min);
+    int32_t max = TIME_FROM_US(servo_pulse_max);
+    // the endpoints may be swapped to reverse the servo
+    return min + (max - min) * position / 255;
+}
+
+/**
+ * Runs every 20ms, after servo_tick(). Moves the servo towards its target at the slew rate.
+ * The pulse is recalculated when the position or the calibration has changed, so a new calibration
+ * takes effect right away. The divisions are too slow for every tick.
+ */
+static void servo_slew_tick() {
+    if (!servo_started) {
+        return;
+    }
+
+    uint8_t position = servo_position;
+    uint8_t slew = config.servo_slew;
+    if (!slew || servo_target == servo_position) {
+        servo_position = servo_target;
+    } else if (servo_target > servo_position) {
+        servo_position = servo_target - servo_position > slew ? servo_position + slew : servo_target;
+    } else {
+        servo_position = servo_position - servo_target > slew ? servo_position - slew : servo_target;
+    }
+    if (servo_position != position || config.servo_min_pulse != servo_pulse_min ||
+        config.servo_max_pulse != servo_pulse_max) {
+        servo_pulse = servo_pulse_counts(servo_position);
+    }
 }
 
 static void timer_tick() {
     timer_20ms++;
+    timer_periods++;
+    timer_time += TIME_COUNTS_PER_PERIOD;
 }
 
-static void buzzer_tick() {
-    // should we turn the buzzer on?
-    if (buzzer_state == BUZZER_OFF) {
-        if (buzzer_queue.length) {
-            buzzer_state = BUZZER_ON;
-            current_beep_duration = 0;
-            WRITE_PIN(BUZZER_PIN, 1);
+/**
+ * Stop the timer if suspend_timer() asked for it. Called from the COMPB interrupt once a servo
+ * pulse has ended, or at the time it would end if there are no pulses
+ */
+static void timer_pulse_end() {
+    if (timer_suspending) {
+        timer_suspending = 0;
+        TCCR1B &= ~TIMER_CLOCK_MASK;
+    }
+}
 
-        }
+/**
+ * Start the on half of the current step of the playing pattern
+ */
+static void buzzer_load_step() {
+    buzzer_ticks = pgm_read_byte(&buzzer_playing.steps[buzzer_step_index].on);
+    buzzer_sounding = 1;
+    BUZZER_PIN::write(buzzer_ticks != 0);
+}
+
+/**
+ * Start playing a pattern from its first step
+ */
+static void buzzer_start(uint8_t pattern) {
+    buzzer_current = pattern;
+    memcpy_P(&buzzer_playing, buzzer_patterns + pattern, sizeof(buzzer_pattern));
+    buzzer_repeat = buzzer_playing.repeat;
+    buzzer_step_index = 0;
+    buzzer_load_step();
+}
+
+/**
+ * Start the next pattern in the queue, or go silent
+ */
+static void buzzer_next() {
+    if (!buzzer_queue.length) {
+        buzzer_current = BUZZER_NONE;
+        BUZZER_PIN::clear();
         return;
+    }
 
-    } 
+    uint8_t pattern = buzzer_queue.queue[buzzer_queue.index];
+    buzzer_queue.index = (buzzer_queue.index + 1) % BUZZER_QUEUE_SIZE;
+    buzzer_queue.length--;
+    buzzer_start(pattern);
+}
 
-    // check if we should state switch
-    current_beep_duration++;
-    if (current_beep_duration > buzzer_queue.queue[buzzer_queue.index].duration) {
-        if (buzzer_state == BUZZER_ON) {
-            // we're done beeping and go into a cooldown for the same duration
-            buzzer_state = BUZZER_COOLDOWN;
-            current_beep_duration = 0;
-            WRITE_PIN(BUZZER_PIN, 0);
+/**
+ * Runs every 20ms
+ */
+static void buzzer_tick() {
+    if (buzzer_current == BUZZER_NONE) {
+        return;
+    }
 
-        } else {
-            buzzer_queue.index = (buzzer_queue.index + 1) % BUZZER_QUEUE_SIZE;
-            buzzer_queue.length--;
-            // There's something in the queue
-            if (buzzer_queue.length) {
-                buzzer_state = BUZZER_ON;
-                current_beep_duration = 0;
-                WRITE_PIN(BUZZER_PIN, 1);
-
-            // or not
-            } else {
-                buzzer_state = BUZZER_OFF;
+    // halves of zero ticks are skipped right away
+    while (!buzzer_ticks) {
+        if (buzzer_sounding) {
+            buzzer_sounding = 0;
+            buzzer_ticks = pgm_read_byte(&buzzer_playing.steps[buzzer_step_index].off);
+            BUZZER_PIN::clear();
+            continue;
+        }
 
+        buzzer_step_index++;
+        const buzzer_step *step = buzzer_playing.steps + buzzer_step_index;
+        if (!pgm_read_byte(&step->on) && !pgm_read_byte(&step->off)) {
+            // end of a round. A looping pattern gives way to the queue here
+            if (buzzer_playing.repeat ? !--buzzer_repeat : buzzer_queue.length) {
+                buzzer_next();
+                if (buzzer_current == BUZZER_NONE) {
+                    return;
+                }
+                continue;
             }
+            buzzer_step_index = 0;
         }
+        buzzer_load_step();
     }
+    buzzer_ticks--;
 }
 
 /* Timer interrupts. They are used as follows
- * Timer 0: manages the pwm signal generation and keeps a counter that
- * counts in 20ms increments.
- * The first match (COMPB) will pull the PWM pin
- * low when the servo pwm width is reached.
- * The second match (COMPA) will pull the PWM pin high when 20ms is reached
+ * Timer 1: manages the pwm signal generation and keeps the time base.
+ * It counts up to ICR1 and wraps every 20ms.
+ * The wrap (CAPT) will pull the PWM pin high, advance the time base and run the servo slew and the buzzer.
+ * The COMPB match will pull the PWM pin low when the servo pwm width is reached.
+ * With the hardware servo output the OC1B pin is set at the count 0 match and cleared at
+ * the pulse width match by the timer itself, COMPB only prepares the next edge.
+ * The COMPA match belongs to the scheduler, see scheduler.cpp
  */
 
 ISR(TIMER1_COMPB_vect) {
+    if (servo_output_mode == SERVO_OUTPUT_HARDWARE) {
+        if (TCCR1A & (1 << COM1B0)) {
+            // the pulse started, clear the pin at its end
+            TCCR1A &= ~(1 << COM1B0);
+            OCR1B = servo_pulse;
+        } else {
+            // the pulse ended, set the pin at the start of the next period
+            TCCR1A |= 1 << COM1B0;
+            OCR1B = 0;
+            timer_pulse_end();
+        }
+        return;
+    }
+
     // pull the servo pwm pin low
-    WRITE_PIN(SERVO_PIN, 0);
+    SERVO_PIN::clear();
+    timer_pulse_end();
 }
 
-ISR(TIMER1_COMPA_vect) {
+ISR(TIMER1_CAPT_vect) {
+    // the counter restarted at 0 on the wrap, so it is the latency
+    PROFILE_LATENCY(PROFILE_TICK_LATENCY, 0);
+    PROFILE_BEGIN(PROFILE_TICK);
     servo_tick();
     timer_tick();
+    // these are due with the wrap anyway, a scheduler task costs more than either of them
+    servo_slew_tick();
     buzzer_tick();
+    post_event(EVENT_TICK);
+    PROFILE_END(PROFILE_TICK);
 }
 
 /**
@@ -110,54 +297,86 @@ ISR(TIMER1_COMPA_vect) {
  */
 void init_actuators() {
     // pins
-    SET_PIN_AS_OUTPUT(BUZZER_PIN);
-    SET_PIN_AS_OUTPUT(PYRO_PIN);
-    SET_PIN_AS_OUTPUT(SERVO_PIN);
-    SET_PIN_AS_OUTPUT(LED_PIN);
-    SET_PIN_AS_OUTPUT(LAUNCH_ASSERTED_PIN);
-
-    WRITE_PIN(BUZZER_PIN, 0);
-    WRITE_PIN(PYRO_PIN, 0);
-    WRITE_PIN(SERVO_PIN, 0);
-    WRITE_PIN(LED_PIN, 0);
-    WRITE_PIN(LAUNCH_ASSERTED_PIN, 0);
+    BUZZER_PIN::output();
+    PYRO_PIN::output();
+    SERVO_PIN::output();
+    LED_PIN::output();
+    LAUNCH_ASSERTED_PIN::output();
+
+    BUZZER_PIN::clear();
+    PYRO_PIN::clear();
+    SERVO_PIN::clear();
+    LED_PIN::clear();
+    LAUNCH_ASSERTED_PIN::clear();
+
+    // the servo output doesn't change at runtime, it needs a reset
+    servo_output_mode = config.servo_output;
+    if (servo_output_mode == SERVO_OUTPUT_HARDWARE) {
+        SERVO_HARDWARE_PIN::output();
+        SERVO_HARDWARE_PIN::clear();
+    }
 
     // timer
-    // enable CTC (reset on) OCR1A
-    TCCR1B = 1 << WGM12;
-    // Enable both the COMPA and COMB interrupts
-    TIMSK = (1 << OCIE1A) | (1 << OCIE1B);
+    // enable CTC (reset on) ICR1, this leaves OCR1A free for the scheduler
+    TCCR1B = (1 << WGM13) | (1 << WGM12);
+    // Enable the CAPT (wrap) and COMPB interrupts, the scheduler enables COMPA
+    TIMSK |= (1 << ICIE1) | (1 << OCIE1B);
     // Use a clock divider of x8
-    TCCR1B |= 1 << CS11;
-    // Configure the COMPA interrupt to happen after 20ms
-    OCR1A = 18432;
+    TCCR1B |= TIMER_CLOCK;
+    // Configure the wrap to happen after 20ms (the counter includes ICR1)
+    ICR1 = TIME_COUNTS_PER_PERIOD - 1;
     // And initialize the COMBP interrupt to happen at 0ms for now
     // This is later modified to determine the servo position
     OCR1B = 0;
 }
 
 /**
- * Buzzer control interface. This function will enable the buzzer for length*20ms and then be
- * silent for length*20ms. There is a BUFFER_QUEUE_SIZE length queue for the buzzer, any items
- * that do not fit in the queue will be discarded silently
+ * Play a buzzer pattern (BUZZER_*). This never blocks, the pattern is played from the timer.
+ * A pattern of higher priority than the playing one interrupts it and clears the queue, one of lower
+ * priority is dropped. One of the same priority replaces a looping pattern, or is queued behind a
+ * pattern that ends by itself. Patterns that don't fit in the queue are discarded silently.
+ * Safe to call from interrupt context.
  */
-void buzzer_beep(uint8_t length) {
-    ATOMIC(
-        // guard against full queue
-        if (buzzer_queue.length != BUZZER_QUEUE_SIZE) {
-            // index is the current entry being buzzed, (index + length) % size is therefore where a new entry is added
-            buzzer_queue_entry *entry = buzzer_queue.queue + ((buzzer_queue.index + buzzer_queue.length) % BUZZER_QUEUE_SIZE);
-            entry->duration = length;
-            buzzer_queue.length++;
+void buzzer_play(uint8_t pattern) {
+    if (pattern == BUZZER_NONE || pattern >= BUZZER_PATTERN_COUNT) {
+        return;
+    }
+
+    uint8_t priority = pgm_read_byte(&buzzer_patterns[pattern].priority);
+    NESTED_ATOMIC(
+        if (buzzer_current == BUZZER_NONE || priority > buzzer_playing.priority) {
+            buzzer_queue.length = 0;
+            buzzer_start(pattern);
+
+        } else if (priority == buzzer_playing.priority) {
+            if (!buzzer_playing.repeat) {
+                buzzer_start(pattern);
+
+            } else if (buzzer_queue.length != BUZZER_QUEUE_SIZE) {
+                // index is the pattern that plays next, (index + length) % size is therefore where a new entry is added
+                buzzer_queue.queue[(buzzer_queue.index + buzzer_queue.length) % BUZZER_QUEUE_SIZE] = pattern;
+                buzzer_queue.length++;
+            }
         }
     );
 }
 
 /**
- * Returns the amount of items in the buzzer queue.
+ * Silence the buzzer and clear its queue. Safe to call from interrupt context.
+ */
+void buzzer_stop() {
+    NESTED_ATOMIC(
+        buzzer_queue.length = 0;
+        buzzer_current = BUZZER_NONE;
+        BUZZER_PIN::clear();
+    );
+}
+
+/**
+ * Returns the pattern that is playing, BUZZER_NONE if the buzzer is silent.
  */
-uint8_t buzzer_queue_length() {
-    return buzzer_queue.length;
+uint8_t get_buzzer_pattern() {
+    return buzzer_current;
 }
 
 /**
@@ -165,7 +384,7 @@ uint8_t buzzer_queue_length() {
  * enabled should be set to ON or OFF.
  */
 void set_status_led(uint8_t enabled) {
-    WRITE_PIN(LED_PIN, enabled);
+    LED_PIN::write(enabled);
 }
 
 /**
@@ -173,16 +392,33 @@ void set_status_led(uint8_t enabled) {
  * enabled should be set to ON or OFF.
  */
 void set_pyro_state(uint8_t enabled) {
-    WRITE_PIN(PYRO_PIN, enabled);
+    PYRO_PIN::write(enabled);
 }
 
 /**
  * Sets the position of the servo.
- * position can be anywhere from 0 to 255 (which maps to the entire servo range).
+ * position can be anywhere from 0 to 255, which maps to servo_min_pulse - servo_max_pulse.
+ * The first position after startup is taken right away, after that the servo moves at most
+ * servo_slew per 20ms if that is set. Safe to call from interrupt context.
  */
 void set_servo_position(uint8_t position) {
-    // position is 0-256 mapped to 1-2 ms aka 1843.2 - 3686.4 counts
-    OCR1B = 921 + ((uint16_t)position) * 231 / 64;
+    NESTED_ATOMIC(
+        servo_target = position;
+        if (!servo_started) {
+            // we don't know where the servo is, so there is nothing to slew from
+            servo_position = position;
+            servo_pulse = servo_pulse_counts(position);
+            servo_started = 1;
+            if (servo_output_mode == SERVO_OUTPUT_HARDWARE) {
+                // set OC1B at the start of the next period
+                OCR1B = 0;
+                TCCR1A |= (1 << COM1B1) | (1 << COM1B0);
+            }
+        } else if (!config.servo_slew) {
+            servo_position = position;
+            servo_pulse = servo_pulse_counts(position);
+        }
+    );
 }
 
 /**
@@ -191,7 +427,90 @@ void set_servo_position(uint8_t position) {
  * enabled should be set to ON or OFF.
  */
 void set_launch_asserted(uint8_t enabled) {
-    WRITE_PIN(LAUNCH_ASSERTED_PIN, enabled);
+    LAUNCH_ASSERTED_PIN::write(enabled);
+}
+
+/**
+ * Returns the amount of 20ms timer periods since boot, and the counter value of the current period
+ * in count. Both are read consistently. Safe to call from interrupt context.
+ */
+uint32_t get_time_periods(uint16_t *count) {
+    uint32_t periods;
+    NESTED_ATOMIC(
+        *count = TCNT1;
+        periods = timer_periods;
+        // the counter may have wrapped without the CAPT interrupt having run yet
+        if ((TIFR & (1 << ICF1)) && *count < TIME_COUNTS_PER_PERIOD / 2) {
+            periods++;
+        }
+    );
+    return periods;
+}
+
+/**
+ * Returns the time since boot in timer counts (see TIME_COUNTS_PER_SECOND). This wraps around after
+ * about 77 minutes, so only use it for differences. Safe to call from interrupt context.
+ */
+uint32_t get_time() {
+    uint16_t count;
+    return get_time_count(&count);
+}
+
+/**
+ * Returns get_time(), and the counter value it was read at in count. Safe to call from interrupt context.
+ */
+uint32_t get_time_count(uint16_t *count) {
+    uint32_t time;
+    NESTED_ATOMIC(
+        *count = TCNT1;
+        time = timer_time;
+        // the counter may have wrapped without the CAPT interrupt having run yet
+        if ((TIFR & (1 << ICF1)) && *count < TIME_COUNTS_PER_PERIOD / 2) {
+            time += TIME_COUNTS_PER_PERIOD;
+        }
+    );
+    return time + *count;
+}
+
+/**
+ * Returns the time since boot in milliseconds. Safe to call from interrupt context.
+ */
+uint32_t get_millis() {
+    uint16_t count;
+    uint32_t periods = get_time_periods(&count);
+    return periods * 20 + TIME_TO_MS(count);
+}
+
+/**
+ * Stop the time base for standby, see power.h. The timer stops at the end of the servo pulse in
+ * progress, so the servo pin is never held high, is_timer_suspended() tells when. There are no
+ * servo pulses until resume_timer(), servos hold their position without them.
+ */
+void suspend_timer() {
+    NESTED_ATOMIC(timer_suspending = 1;);
+}
+
+/**
+ * Returns nonzero once the timer has stopped after suspend_timer()
+ */
+uint8_t is_timer_suspended() {
+    return !(TCCR1B & TIMER_CLOCK_MASK);
+}
+
+/**
+ * Restart the time base after suspend_timer(), or cancel a suspend_timer() that hasn't taken effect
+ * yet. periods is the time spent in standby in 20ms periods, the time base and the scheduled tasks
+ * move on by it. Safe to call from interrupt context.
+ */
+void resume_timer(uint32_t periods) {
+    NESTED_ATOMIC(
+        timer_suspending = 0;
+        timer_20ms += periods;
+        timer_periods += periods;
+        timer_time += TIME_FROM_PERIODS(periods);
+        delay_tasks(TIME_FROM_PERIODS(periods));
+        TCCR1B |= TIMER_CLOCK;
+    );
 }
 
 /**
@@ -12,31 +12,73 @@
 #define ON  1
 #define OFF 0
 
-// buzzer beeps
+// buzzer beep durations, in 20ms ticks
 #define BEEP_SHORT 12
 #define BEEP_NORMAL 25
 #define BEEP_LONG 50
-#define BEEP_FOREVER 0xFF
 
-// amount of entries in buzzer queue
-#define BUZZER_QUEUE_SIZE 8
+// buzzer patterns, see buzzer_play()
+#define BUZZER_NONE             0
+#define BUZZER_OK               1 // two short beeps, a step forward
+#define BUZZER_CANCEL           2 // a long beep, a step back
+#define BUZZER_ERROR            3 // long beeps until something else plays
+#define BUZZER_FLIGHT           4 // short beeps until something else plays
+#define BUZZER_DEPLOYED         5 // long beeps until something else plays
+#define BUZZER_BIT_0            6 // a short beep, see beep_byte()
+#define BUZZER_BIT_1            7 // a long beep
+#define BUZZER_END              8 // a normal beep
+#define BUZZER_SONG             9 // test song, loops
+#define BUZZER_PATTERN_COUNT    10
+
+// buzzer pattern priorities
+#define BUZZER_PRIORITY_STATUS  0
+#define BUZZER_PRIORITY_ALARM   1
+
+// amount of patterns that can wait for the playing one. Must be a power of two
+#define BUZZER_QUEUE_SIZE 16
+
+// servo outputs, see the servo_output setting
+#define SERVO_OUTPUT_SOFTWARE   0 // SERVO_PIN, the pulse edges are driven from the timer interrupts
+#define SERVO_OUTPUT_HARDWARE   1 // SERVO_HARDWARE_PIN, the pulse edges are driven by the OC1B output compare
+#define SERVO_OUTPUT_COUNT      2
+
+// limits of the servo pulse width calibration, in microseconds
+#define SERVO_PULSE_MIN         500
+#define SERVO_PULSE_MAX         2500
+
+// time base. Timer 1 counts at CPU_FREQ / 8 and wraps every 20ms
+#define TIME_COUNTS_PER_SECOND  (CPU_FREQ / 8)  // 921600, one count is 1.085 us
+#define TIME_COUNTS_PER_PERIOD  18432           // 20ms
+
+// conversions to time counts
+#define TIME_FROM_MS(ms)        ((uint32_t)(ms) * 4608 / 5)
+#define TIME_FROM_US(us)        ((uint32_t)(us) * 576 / 625)
+#define TIME_FROM_PERIODS(n)    ((uint32_t)(n) * TIME_COUNTS_PER_PERIOD)
+#define TIME_TO_MS(counts)      ((uint32_t)(counts) / 4608 * 5 + (uint32_t)(counts) % 4608 * 5 / 4608)
 
 /**
- * Initialize the actuator peripherals
+ * Initialize the actuator peripherals. This reads the servo settings, call it after init_eeprom().
  */
 void init_actuators();
 
 /**
- * Buzzer control interface. This function will enable the buzzer for length*20ms and then be
- * silent for length*20ms. There is a BUFFER_QUEUE_SIZE length queue for the buzzer, any items
- * that do not fit in the queue will be discarded silently
+ * Play a buzzer pattern (BUZZER_*). This never blocks, the pattern is played from the timer.
+ * A pattern of higher priority than the playing one interrupts it and clears the queue, one of lower
+ * priority is dropped. One of the same priority replaces a looping pattern, or is queued behind a
+ * pattern that ends by itself. Patterns that don't fit in the queue are discarded silently.
+ * Safe to call from interrupt context.
  */
-void buzzer_beep(uint8_t length);
+void buzzer_play(uint8_t pattern);
 
 /**
- * Returns the amount of items in the buzzer queue.
+ * Silence the buzzer and clear its queue. Safe to call from interrupt context.
  */
-uint8_t buzzer_queue_length();
+void buzzer_stop();
+
+/**
+ * Returns the pattern that is playing, BUZZER_NONE if the buzzer is silent.
+ */
+uint8_t get_buzzer_pattern();
 
 /**
  * Set the state of a led connected to the breakout connector.
@@ -52,7 +94,9 @@ void set_pyro_state(uint8_t enabled);
 
 /**
  * Sets the position of the servo.
- * position can be anywhere from 0 to 255 (which maps to the entire servo range).
+ * position can be anywhere from 0 to 255, which maps to servo_min_pulse - servo_max_pulse.
+ * The first position after startup is taken right away, after that the servo moves at most
+ * servo_slew per 20ms if that is set. Safe to call from interrupt context.
  */
 void set_servo_position(uint8_t position);
 
@@ -63,6 +107,47 @@ void set_servo_position(uint8_t position);
  */
 void set_launch_asserted(uint8_t enabled);
 
+/**
+ * Returns the time since boot in timer counts (see TIME_COUNTS_PER_SECOND). This wraps around after
+ * about 77 minutes, so only use it for differences. Safe to call from interrupt context.
+ */
+uint32_t get_time();
+
+/**
+ * Returns get_time(), and the counter value it was read at in count. Safe to call from interrupt context.
+ */
+uint32_t get_time_count(uint16_t *count);
+
+/**
+ * Returns the time since boot in milliseconds. Safe to call from interrupt context.
+ */
+uint32_t get_millis();
+
+/**
+ * Returns the amount of 20ms timer periods since boot, and the counter value of the current period
+ * in count. Both are read consistently. Safe to call from interrupt context.
+ */
+uint32_t get_time_periods(uint16_t *count);
+
+/**
+ * Stop the time base for standby, see power.h. The timer stops at the end of the servo pulse in
+ * progress, so the servo pin is never held high, is_timer_suspended() tells when. There are no
+ * servo pulses until resume_timer(), servos hold their position without them.
+ */
+void suspend_timer();
+
+/**
+ * Returns nonzero once the timer has stopped after suspend_timer()
+ */
+uint8_t is_timer_suspended();
+
+/**
+ * Restart the time base after suspend_timer(), or cancel a suspend_timer() that hasn't taken effect
+ * yet. periods is the time spent in standby in 20ms periods, the time base and the scheduled tasks
+ * move on by it. Safe to call from interrupt context.
+ */
+void resume_timer(uint32_t periods);
+
 /**
  * Sets the value of the timer to 0. The timer is a 16-bit unsigned int that counts
  * every 20 ms. This means it wraps around after slightly more than 1300 sec.
@@ -1,10 +1,12 @@
 #ifndef _CONFIG_H_
 #define _CONFIG_H_
 
+// in a SRP_HOST build these come from Software/sim/include, which simulates the registers
 #include <avr/io.h>
 #include <avr/interrupt.h>
 #include <stdint.h>
 #include <stddef.h>
+#include "pins.h"
 
 /**
  * This file contains the configuration for the SRP Electronics board and
@@ -23,58 +25,79 @@
 // UART baud rate
 #define UART_BAUD           38400
 
-// input pins (for Attiny-1634)
-#define VOTE_IN_PIN                 C, 1
-#define ARMED_SWITCH_PIN            A, 4
-#define BREAKWIRE_PIN               B, 1
-#define CONTINUITY_DETECTION_PIN    A, 5
-#define EXTRA_GPIO1                 A, 6
-#define EXTRA_GPIO2                 A, 1
-#define EXTRA_GPIO3                 A, 0
+// LBP crc implementation. The table versions are a lot faster in the uart interrupts,
+// the 256 entry table costs 256 bytes of flash, the 16 entry nibble table only 16.
+#define LBP_CRC_BITWISE     0
+#define LBP_CRC_NIBBLE      1
+#define LBP_CRC_TABLE       2
+#define LBP_CRC             LBP_CRC_TABLE
+
+// instrumentation build, see profiling.h. PROFILING_STATS times the interrupt handlers and the main
+// loop and counts link errors, for LBP_GET_DIAGNOSTICS. PROFILING_GPIO also drives EXTRA_GPIO1..3 high
+// during the scheduler, uart rx and uart tx interrupts for a scope. With the hardware servo output the
+// EXTRA_GPIO1 pad belongs to the servo, the scheduler has no scope pin then.
+#define PROFILING_OFF       0
+#define PROFILING_STATS     1
+#define PROFILING_GPIO      2
+#define PROFILING           PROFILING_OFF
+
+// pad standby, see power.h. Milliseconds without anything happening in IDLE or PREPARATION after
+// which the board goes to standby, 0 keeps it running at full rate all the time
+#define STANDBY_DELAY       30000
+
+// LBP relay, see relay.h. A relay build forwards the frames for other addresses to a second link on
+// RELAY_TX_PIN and RELAY_RX_PIN, and the frames from there to the uart. It is not available with
+// PROFILING_GPIO, which uses the same pins
+#define LBP_RELAY           0
+
+// baud rate of the relay link
+#define RELAY_BAUD          9600
+
+// input pins (for Attiny-1634), see pins.h
+typedef Pin<PortC, 1> VOTE_IN_PIN;
+typedef Pin<PortA, 4> ARMED_SWITCH_PIN;
+typedef Pin<PortB, 1> BREAKWIRE_PIN;
+typedef Pin<PortA, 5> CONTINUITY_DETECTION_PIN;
+typedef Pin<PortA, 6> EXTRA_GPIO1;
+typedef Pin<PortA, 1> EXTRA_GPIO2;
+typedef Pin<PortA, 0> EXTRA_GPIO3;
+
+// relay link pins (for Attiny-1634), see relay.h. RELAY_RX_PIN must be on port A
+typedef EXTRA_GPIO2 RELAY_TX_PIN;
+typedef EXTRA_GPIO3 RELAY_RX_PIN;
+
+#if LBP_RELAY && PROFILING == PROFILING_GPIO
+#error "The relay link and PROFILING_GPIO use the same pins"
+#endif
 
 // actuator pins (for Attiny-1634)
-#define BUZZER_PIN                  B, 3
-#define PYRO_PIN                    A, 2
-#define SERVO_PIN                   C, 0
-#define LED_PIN                     B, 2
-#define LAUNCH_ASSERTED_PIN         C, 2
+typedef Pin<PortB, 3> BUZZER_PIN;
+typedef Pin<PortA, 2> PYRO_PIN;
+typedef Pin<PortC, 0> SERVO_PIN;
+typedef Pin<PortA, 6> SERVO_HARDWARE_PIN; // OC1B, on the EXTRA_GPIO1 pad
+typedef Pin<PortB, 2> LED_PIN;
+typedef Pin<PortC, 2> LAUNCH_ASSERTED_PIN;
 
 /**
  * Peripheral configuration is generally hardcoded in the modules.
- * actuators.cpp uses Timer 1 and the ADC0
+ * actuators.cpp uses Timer 1, scheduler.cpp uses its compare A channel
+ * inputs.cpp uses the ADC0 and the overflow of Timer 0
  * eeprom.cpp uses the EEPROM
  * lbp.cpp uses the USART
+ * relay.cpp uses the compare channels of Timer 0 and the pin change interrupt of port A, which it shares
+ * with inputs.cpp
+ * power.cpp uses the watchdog timer and turns off the peripherals nobody uses
  */
 
 /**
  * Utility defines
  */
 
-// preprocessor messing around
-#define CONCAT_(A, B) A ## B
-#define CONCAT(A, B) CONCAT_(A, B)
-
-// masks a bit with a certain value
-#define MASK(name, shift, value) ((name) = ((name) & ~(1 << (shift))) | ((value) << (shift)))
-
-// intermediaties
-#define BANK_NAME(name, number) name
-#define BANK_NUMBER(name, number) number
-
-// initialization
-#define SET_PIN_AS_OUTPUT(pin) MASK(CONCAT(DDR, BANK_NAME(pin)), BANK_NUMBER(pin), 1)
-#define SET_PIN_AS_INPUT(pin) MASK(CONCAT(DDR, BANK_NAME(pin)), BANK_NUMBER(pin), 0)
-#define SET_PULLUP(pin, val) MASK(CONCAT(PUE, BANK_NAME(pin)), BANK_NUMBER(pin), val)
-
-// reading / writing
-#define READ_PIN(pin) (CONCAT(PIN, BANK_NAME(pin)) & (1 << BANK_NUMBER(pin)))
-#define WRITE_PIN(pin, val) MASK(CONCAT(PORT, BANK_NAME(pin)), BANK_NUMBER(pin), (val))
-
 // atomic section
 // a simple atomic section. Use this only in the main loop while interrupts are enabled
 #define ATOMIC(block) do {cli(); {block} sei();} while (0)
 // reentrant atomic section. use this if a function can be called from both contexts where
 // interrupts are enabled and where interrupts are disabled.
-#define NESTED_ATOMIC(block) do {uint8_t oldSREG = SREG; cli(); {block} SREG = oldSREG} while (0)
+#define NESTED_ATOMIC(block) do {uint8_t oldSREG = SREG; cli(); {block} SREG = oldSREG;} while (0)
 
 #endif
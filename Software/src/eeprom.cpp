@@ -1,27 +1,169 @@
 #include "eeprom.h"
+#include <string.h>
+#include "actuators.h"
+#include "lbp.h"
 
-// deployment times
-uint16_t EEMEM min_deploy_time = 500; // 20ms increments: 10 sec
-uint16_t EEMEM max_deploy_time = 700; // 20ms increments: 14 sec
+/**
+ * Configuration of a board without a valid record, and of the record in the EEPROM image
+ */
+#define CONFIG_DEFAULTS { \
+    500,    /* min_deploy_time: 10 sec */ \
+    700,    /* max_deploy_time: 14 sec */ \
+    0,      /* last_logged_deploy_time */ \
+    1000,   /* servo_min_pulse: 1 ms */ \
+    2000,   /* servo_max_pulse: 2 ms */ \
+    166,    /* battery_empty_limit: 6.5V that goes through a voltage divider (/2) and is read in a 8-bit ADC (19.53 mV/bit) */ \
+    1,      /* use_servo: by default servo is used, not pyro */ \
+    0,      /* servo_closed_position */ \
+    255,    /* servo_open_position */ \
+    0,      /* lbp_address */ \
+    0,      /* lbp_baud_index: 38400 baud */ \
+    SERVO_OUTPUT_SOFTWARE, /* servo_output */ \
+    0,      /* servo_slew: no slew limit */ \
+    0,      /* vote_peers: none */ \
+    1       /* vote_quorum: the vote in pin */ \
+}
+
+// config_record_crc() of the defaults at CONFIG_VERSION. It has to be updated along with either of them,
+// the "config image" benchmark of Software/sim checks it
+#define CONFIG_DEFAULTS_CRC 0x3C
+
+const config_type config_defaults PROGMEM = CONFIG_DEFAULTS;
 
-// Logging of actual deployment time
-uint16_t EEMEM last_logged_deploy_time = 0; // 20ms increments, written to by the microcontroller
+/**
+ * The records. The EEPROM image has the defaults as the first one, so a board flashed with it starts
+ * configured. A board without a valid record, like one that kept the EEPROM of a firmware with another
+ * layout, starts with the defaults in ERROR until the configuration is written over LBP.
+ */
+config_record EEMEM config_slots[CONFIG_SLOT_COUNT] = {
+    {CONFIG_DEFAULTS, CONFIG_VERSION, CONFIG_DEFAULTS_CRC, 1}
+};
+
+/**
+ * RAM copy of the configuration
+ */
+config_type config;
 
-// status checking
-uint8_t EEMEM battery_empty_limit = 166; // This correspond to 6.5V that goes through a voltage divider (/2) and is read in a 8-bit ADC (19.53 mV/bit)
+static uint8_t config_valid;
+
+// the configuration changed since the last commit started
+static uint8_t config_dirty;
+
+// sequence number of the newest record
+static uint8_t config_sequence;
+
+/**
+ * Commit in progress. The record is a snapshot of config, so changes during the commit go into the next one.
+ */
+#define COMMIT_IDLE 0xFF
+
+static config_record commit_record;
+static uint8_t commit_slot;               // the older slot, written by the next commit
+static uint8_t commit_index = COMMIT_IDLE; // next byte of commit_record to write
+
+/**
+ * Returns the crc a record with the contents of record has to have
+ */
+uint8_t config_record_crc(const config_record *record) {
+    return lbp_crc((const uint8_t *)record, offsetof(config_record, crc), 0);
+}
 
+/**
+ * Returns nonzero if the configuration came from a valid record, or has been committed since.
+ * The state machine stays in ERROR otherwise.
+ */
+uint8_t config_is_valid() {
+    return config_valid;
+}
 
-// deployment settings
-uint8_t  EEMEM use_servo = 1; // by default servo is used, not pyro
-uint8_t  EEMEM servo_closed_position = 0; // servorange/256 increments
-uint8_t  EEMEM servo_open_position = 255; // servorange/256 increments
+/**
+ * Update a value in the configuration. It is committed to the EEPROM later by update_eeprom(), together
+ * with everything else that changes until then. address must point to a member of config.
+ */
+void config_write(uint8_t *address, uint8_t value) {
+    *address = value;
+    config_dirty = 1;
+}
 
-// communication settings
-uint8_t  EEMEM lbp_address = 0;
+void config_write(uint16_t *address, uint16_t value) {
+    *address = value;
+    config_dirty = 1;
+}
 
 /**
- * Initialize the EEPROM state
+ * Initialize the EEPROM state. This loads the newest valid record into config, or the defaults if there is none.
  */
 void init_eeprom() {
+    config_record record;
+    config_valid = 0;
+    config_dirty = 0;
+    commit_index = COMMIT_IDLE;
+    for (uint8_t i = 0; i < CONFIG_SLOT_COUNT; i++) {
+        eeprom_read_block(&record, config_slots + i, sizeof(config_record));
+        if (record.version != CONFIG_VERSION || record.crc != config_record_crc(&record)) {
+            continue;
+        }
+        // sequence numbers wrap around
+        if (config_valid && (int8_t)(record.sequence - config_sequence) <= 0) {
+            continue;
+        }
+        config = record.config;
+        config_sequence = record.sequence;
+        commit_slot = (i + 1) % CONFIG_SLOT_COUNT;
+        config_valid = 1;
+    }
+
+    if (!config_valid) {
+        memcpy_P(&config, &config_defaults, sizeof(config_type));
+        config_sequence = 0;
+        commit_slot = 0;
+    }
+}
 
+/**
+ * Commit a changed configuration. This never waits for the EEPROM: it starts at most one byte write
+ * per call and only writes bytes that actually changed. Call it regularly from the main loop.
+ */
+void update_eeprom() {
+    if (commit_index == COMMIT_IDLE) {
+        if (!config_dirty) {
+            return;
+        }
+        commit_record.config = config;
+        commit_record.version = CONFIG_VERSION;
+        commit_record.crc = config_record_crc(&commit_record);
+        commit_record.sequence = config_sequence + 1;
+        config_dirty = 0;
+        commit_index = 0;
+    }
+
+    // a previous write is still in progress
+    if (!eeprom_is_ready()) {
+        return;
+    }
+
+    // write the next byte that differs, in order so the sequence number is the last one
+    uint8_t *slot = (uint8_t *)(config_slots + commit_slot);
+    while (commit_index < sizeof(config_record)) {
+        uint8_t value = ((uint8_t *)&commit_record)[commit_index];
+        if (eeprom_read_byte(slot + commit_index) != value) {
+            eeprom_write_byte(slot + commit_index, value);
+            commit_index++;
+            return;
+        }
+        commit_index++;
+    }
+
+    // the record is complete, the other slot is the older one now
+    config_sequence = commit_record.sequence;
+    commit_slot = (commit_slot + 1) % CONFIG_SLOT_COUNT;
+    commit_index = COMMIT_IDLE;
+    config_valid = 1;
+}
+
+/**
+ * Returns nonzero when every change of the configuration has been committed by update_eeprom()
+ */
+uint8_t is_config_committed() {
+    return !config_dirty && commit_index == COMMIT_IDLE;
 }
@@ -2,6 +2,7 @@
 #define _EEPROM_H_
 
 #include <avr/eeprom.h>
+#include <avr/pgmspace.h>
 #include "config.h"
 
 /**
@@ -9,28 +10,71 @@
  * of the variables stored in EEPROM.
  */
 
- /**
-  * Variable declarations
-  */
+/**
+ * The configuration. init_eeprom() loads it at boot, after that the rest of the code should only read it
+ * from here. Changes are made through config_write(), which updates the RAM copy immediately and leaves
+ * committing it to update_eeprom(). The parameter table in params.cpp ties members to parameters.
+ * Changing the members or their order needs a new CONFIG_VERSION. The 16 bit members go first, so there
+ * is no padding in a SRP_HOST build either and a record has the same bytes and crc there.
+ */
+typedef struct {
+    uint16_t min_deploy_time; // 20ms increments
+    uint16_t max_deploy_time; // 20ms increments
+    uint16_t last_logged_deploy_time; // milliseconds, written to by the microcontroller
+    uint16_t servo_min_pulse; // microseconds, the pulse width of position 0
+    uint16_t servo_max_pulse; // microseconds, the pulse width of position 255
+    uint8_t  battery_empty_limit; // battery_value below which the battery counts as empty
+    uint8_t  use_servo; // nonzero: use the servo, zero: use the pyro
+    uint8_t  servo_closed_position; // servorange/256 increments
+    uint8_t  servo_open_position; // servorange/256 increments
+    uint8_t  lbp_address; // Contains an id for the rocket, its address on the bus, see lbp_set_address()
+    uint8_t  lbp_baud_index; // One of the LBP_BAUD_* baud rates
+    uint8_t  servo_output; // one of the SERVO_OUTPUT_* modes
+    uint8_t  servo_slew; // position increments per 20ms, 0 moves right away
+    uint8_t  vote_peers; // lbp_address bits of the peers whose deploy votes count, see vote.h
+    uint8_t  vote_quorum; // votes out of the vote in pin and vote_peers that deploy
+} config_type;
+
+extern config_type config;
 
-// deployment times
-extern uint16_t EEMEM min_deploy_time; // 20ms increments
-extern uint16_t EEMEM max_deploy_time; // 20ms increments
+/**
+ * The EEPROM holds the configuration in two records. A commit writes the whole configuration into the
+ * older slot and finishes with the sequence number, so until its last byte is written the other slot
+ * stays the newest one. At boot the newest record with the right version and crc is loaded.
+ * The EEPROM image (.eep) has the defaults in the first slot.
+ */
+#define CONFIG_VERSION      3
+#define CONFIG_SLOT_COUNT   2
 
-// Logging of actual deployment time
-extern uint16_t EEMEM last_logged_deploy_time; // 20ms increments
+typedef struct {
+    config_type config;
+    uint8_t version;    // CONFIG_VERSION
+    uint8_t crc;        // lbp_crc() of config and version
+    uint8_t sequence;   // commit number, the newer of two valid records wins
+} config_record;
 
-// status checking
-extern uint8_t EEMEM battery_empty_limit; // 6.5V read in the 8-bit ADC
+extern config_record EEMEM config_slots[CONFIG_SLOT_COUNT];
 
-// deployment settings
-extern uint8_t  EEMEM use_servo; // nonzero: use the servo, zero: use the pyro
-extern uint8_t  EEMEM servo_closed_position; // servorange/256 increments
-extern uint8_t  EEMEM servo_open_position; // servorange/256 increments
+// the configuration of a board whose records are invalid
+extern const config_type config_defaults PROGMEM;
 
-// communication settings
-extern uint8_t  EEMEM lbp_address; // Contains an id for the rocket
+/**
+ * Returns the crc a record with the contents of record has to have
+ */
+uint8_t config_record_crc(const config_record *record);
 
+/**
+ * Returns nonzero if the configuration came from a valid record, or has been committed since.
+ * The state machine stays in ERROR otherwise.
+ */
+uint8_t config_is_valid();
+
+/**
+ * Update a value in the configuration. It is committed to the EEPROM later by update_eeprom(), together
+ * with everything else that changes until then. address must point to a member of config.
+ */
+void config_write(uint8_t *address, uint8_t value);
+void config_write(uint16_t *address, uint16_t value);
 
 /**
  * These overloaded functions do the right thing based on their input data types
@@ -102,8 +146,19 @@ inline void eeprom_write_safe(uint32_t *address, uint32_t value) {
 }
 
 /**
- * Initialize the EEPROM state
+ * Initialize the EEPROM state. This loads the newest valid record into config, or the defaults if there is none.
  */
 void init_eeprom();
 
+/**
+ * Commit a changed configuration. This never waits for the EEPROM: it starts at most one byte write
+ * per call and only writes bytes that actually changed. Call it regularly from the main loop.
+ */
+void update_eeprom();
+
+/**
+ * Returns nonzero when every change of the configuration has been committed by update_eeprom()
+ */
+uint8_t is_config_committed();
+
 #endif
@@ -0,0 +1,29 @@
+#include "events.h"
+#include <avr/sleep.h>
+
+// pending events
+volatile uint8_t pending_events;
+
+/**
+ * Sleep in idle mode until at least one event is pending. Returns the pending events and clears them.
+ */
+uint8_t wait_for_events() {
+    uint8_t events;
+
+    set_sleep_mode(SLEEP_MODE_IDLE);
+    cli();
+    while (!pending_events) {
+        // sei only takes effect after the next instruction, so an interrupt that
+        // posts an event can't slip in between the check and going to sleep
+        sleep_enable();
+        sei();
+        sleep_cpu();
+        sleep_disable();
+        cli();
+    }
+    events = pending_events;
+    pending_events = 0;
+    sei();
+
+    return events;
+}
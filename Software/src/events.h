@@ -0,0 +1,32 @@
+#ifndef _EVENTS_H_
+#define _EVENTS_H_
+
+#include "config.h"
+
+/**
+ * This file contains the events that wake up the main loop.
+ * Interrupt handlers post events, the main loop sleeps until at least one is pending.
+ */
+
+// event flags
+#define EVENT_TICK      0x01 // the 20ms timer tick
+#define EVENT_INPUT     0x02 // a debounced input changed
+#define EVENT_LBP       0x04 // the lbp driver has work for lbp_poll()
+#define EVENT_TELEMETRY 0x08 // a telemetry packet is due
+
+// pending events, only use the functions below to access this
+extern volatile uint8_t pending_events;
+
+/**
+ * Post events. Only call this from interrupt context.
+ */
+inline void post_event(uint8_t events) {
+    pending_events |= events;
+}
+
+/**
+ * Sleep in idle mode until at least one event is pending. Returns the pending events and clears them.
+ */
+uint8_t wait_for_events();
+
+#endif
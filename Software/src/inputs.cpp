@@ -1,19 +1,217 @@
 #include "inputs.h"
+#include "events.h"
+#include "actuators.h"
+#include "relay.h"
+
+/**
+ * Internal data
+ */
+
+// battery measurement. The ADC runs freely, every BATTERY_OVERSAMPLING conversions are
+// summed into one sample which is then fed into an exponential moving average.
+#define BATTERY_OVERSAMPLING    16  // 10-bit conversions per sample, gives 12 bits
+#define BATTERY_FILTER_SHIFT    5   // filter time constant of 32 samples, ~60ms
+
+static uint16_t battery_sum;
+static uint8_t battery_conversions;
+
+// filter state, the average scaled by 2^BATTERY_FILTER_SHIFT
+static uint32_t battery_filter;
+
+// filtered battery value as a left adjusted 16-bit number
+static volatile uint16_t battery_value;
+static volatile uint16_t battery_min;
+static volatile uint16_t battery_max;
+static volatile uint8_t battery_ready;
+
+// digital input state
+static volatile uint8_t inputs_debounced;
+static volatile uint8_t inputs_edges;
+
+// amount of consecutive samples that differed from the debounced state per input
+static uint8_t input_counters[INPUT_COUNT];
+static volatile uint32_t input_edge_times[INPUT_COUNT];
+
+// called when the debounced state changes, see set_input_handler()
+static void (* volatile input_handler)(uint8_t edges);
+
+// the inputs are sampled every INPUT_SAMPLE_OVERFLOWS overflows of Timer 0, which runs freely at
+// CPU_FREQ / 8 and overflows every 256 counts. The relay link shares it, see relay.h
+#define INPUT_SAMPLE_OVERFLOWS  4 // 1.1ms
+static volatile uint8_t input_overflows = INPUT_SAMPLE_OVERFLOWS;
+
+/**
+ * Reads the raw state of the digital inputs as a bitmap
+ */
+static uint8_t read_inputs() {
+    uint8_t inputs = 0;
+    if (!VOTE_IN_PIN::read()) {
+        inputs |= 1 << INPUT_VOTE;
+    }
+    if (!ARMED_SWITCH_PIN::read()) {
+        inputs |= 1 << INPUT_ARMED;
+    }
+    if (BREAKWIRE_PIN::read()) {
+        inputs |= 1 << INPUT_BREAKWIRE;
+    }
+    if (CONTINUITY_DETECTION_PIN::read()) {
+        inputs |= 1 << INPUT_SQUIB;
+    }
+    return inputs;
+}
+
+/**
+ * Samples the inputs and advances the debouncing. Called from interrupt context,
+ * every INPUT_SAMPLE_OVERFLOWS overflows of Timer 0 and on a pin change
+ */
+static void sample_inputs() {
+    uint8_t changed = read_inputs() ^ inputs_debounced;
+    for (uint8_t i = 0; i < INPUT_COUNT; i++) {
+        if (!(changed & (1 << i))) {
+            // glitch or no change at all
+            input_counters[i] = 0;
+            continue;
+        }
+
+        // remember when the change started
+        if (!input_counters[i]) {
+            input_edge_times[i] = get_time();
+        }
+
+        if (++input_counters[i] == INPUT_DEBOUNCE_SAMPLES) {
+            input_counters[i] = 0;
+            inputs_debounced ^= 1 << i;
+            inputs_edges |= 1 << i;
+            post_event(EVENT_INPUT);
+            if (input_handler) {
+                input_handler(1 << i);
+            }
+        }
+    }
+}
+
+/**
+ * Timer 0 overflow interrupt, counts down to the next sample
+ */
+ISR(TIMER0_OVF_vect) {
+    if (--input_overflows) {
+        return;
+    }
+    input_overflows = INPUT_SAMPLE_OVERFLOWS;
+    sample_inputs();
+}
+
+/**
+ * Pin change interrupt of the vote, armed, breakwire and continuity pins. This takes the first
+ * sample of a change right away and restarts the count to the next one, so the debounced state
+ * follows about INPUT_DEBOUNCE_SAMPLES - 1 sample periods after the pin has settled.
+ */
+#if LBP_RELAY
+// levels of the armed switch and the continuity detection at the last pin change of port A
+static uint8_t port_a_levels;
+
+/**
+ * Reads the levels of the inputs on port A, the pins that share the interrupt with the relay
+ */
+static uint8_t read_port_a_inputs() {
+    return (ARMED_SWITCH_PIN::read() ? 1 : 0) | (CONTINUITY_DETECTION_PIN::read() ? 2 : 0);
+}
+
+/**
+ * In a relay build RELAY_RX_PIN is on port A too. The relay needs its start bits right away, and only
+ * a change of the other two pins is a change of the inputs, the extra samples would shorten the debouncing.
+ */
+ISR(PCINT0_vect) {
+    relay_pin_change();
+
+    uint8_t levels = read_port_a_inputs();
+    if (levels == port_a_levels) {
+        return;
+    }
+    port_a_levels = levels;
+    input_overflows = INPUT_SAMPLE_OVERFLOWS;
+    sample_inputs();
+}
+
+ISR(PCINT1_vect) {
+    input_overflows = INPUT_SAMPLE_OVERFLOWS;
+    sample_inputs();
+}
+ISR(PCINT2_vect, ISR_ALIASOF(PCINT1_vect));
+#else
+ISR(PCINT0_vect) {
+    input_overflows = INPUT_SAMPLE_OVERFLOWS;
+    sample_inputs();
+}
+ISR(PCINT1_vect, ISR_ALIASOF(PCINT0_vect));
+ISR(PCINT2_vect, ISR_ALIASOF(PCINT0_vect));
+#endif
+
+/**
+ * ADC conversion complete interrupt. This accumulates the battery measurement
+ */
+ISR(ADC_vect) {
+    battery_sum += ADC;
+    if (++battery_conversions != BATTERY_OVERSAMPLING) {
+        return;
+    }
+
+    // 16 10-bit conversions sum up to a 14-bit value, left adjust to 16 bits
+    uint16_t sample = battery_sum << 2;
+    battery_sum = 0;
+    battery_conversions = 0;
+
+    // start the filter at the first sample so it doesn't have to settle from 0
+    if (!battery_ready) {
+        battery_filter = (uint32_t)sample << BATTERY_FILTER_SHIFT;
+        battery_min = sample;
+        battery_max = sample;
+        battery_ready = 1;
+    }
+
+    battery_filter -= battery_filter >> BATTERY_FILTER_SHIFT;
+    battery_filter += sample;
+    battery_value = battery_filter >> BATTERY_FILTER_SHIFT;
+
+    if (battery_value < battery_min) {
+        battery_min = battery_value;
+    }
+    if (battery_value > battery_max) {
+        battery_max = battery_value;
+    }
+}
 
 /**
  * Initialize the input peripherals
  */
 void init_inputs() {
     // inputs
-    SET_PIN_AS_INPUT(VOTE_IN_PIN);
-    SET_PIN_AS_INPUT(ARMED_SWITCH_PIN);
-    SET_PIN_AS_INPUT(BREAKWIRE_PIN);
-    SET_PIN_AS_INPUT(CONTINUITY_DETECTION_PIN);
+    VOTE_IN_PIN::input();
+    ARMED_SWITCH_PIN::input();
+    BREAKWIRE_PIN::input();
+    CONTINUITY_DETECTION_PIN::input();
 
     // pullups
-    SET_PULLUP(VOTE_IN_PIN, 1);
-    SET_PULLUP(ARMED_SWITCH_PIN, 1);
-    SET_PULLUP(CONTINUITY_DETECTION_PIN, 1);
+    VOTE_IN_PIN::pullup(1);
+    ARMED_SWITCH_PIN::pullup(1);
+    CONTINUITY_DETECTION_PIN::pullup(1);
+
+    // start debouncing from the current state so we don't see any edges at boot
+    inputs_debounced = read_inputs();
+#if LBP_RELAY
+    port_a_levels = read_port_a_inputs();
+#endif
+
+    // Timer 0 samples the digital inputs, it runs freely with a clock divider of x8
+    TCCR0A = 0;
+    TCCR0B = 1 << CS01;
+    TIMSK |= 1 << TOIE0;
+
+    // pin change interrupts on all digital inputs
+    PCMSK0 = (1 << PCINT4) | (1 << PCINT5); // armed switch and continuity detection
+    PCMSK1 = 1 << PCINT9;                   // breakwire
+    PCMSK2 = 1 << PCINT13;                  // vote in
+    GIMSK |= (1 << PCIE0) | (1 << PCIE1) | (1 << PCIE2);
     
     // ADC for battery measurement (ADC0 - PA3)
     DIDR0 = 
@@ -28,7 +226,7 @@ void init_inputs() {
             (0 << MUX0);       // use ADC0 for input (PA3), MUX bit 0
 
     ADCSRB =
-            (1 << ADLAR) |     // Left adjusted result. Only necessary to read ADCH for 8-bit precission.
+            (0 << ADLAR) |     // Right adjusted result, the interrupt accumulates the full 10 bits.
             (0 << ADTS2) |     // Free Running mode, ADTS bit 2
             (0 << ADTS1) |     // Free Running mode, ADTS bit 1
             (0 << ADTS0);      // Free Running mode, ADTS bit 0
@@ -37,47 +235,152 @@ void init_inputs() {
             (1 << ADEN)  |     // Enable ADC 
             (1 << ADSC)  |     // Start the conversion manually or start Free Running mode
             (1 << ADATE) |     // Enable auto triggering for free running mode.
-            (0 << ADIE)  |     // Disable Interruptions when conversion is complete
+            (1 << ADIE)  |     // Enable the interrupt when conversion is complete
             (1 << ADPS2) |     // set prescaler to 64, bit 2 // For 8Mhz CLK it is 125kHz ADC_CLK
             (1 << ADPS1) |     // set prescaler to 64, bit 1 // Usually 13 ADC_CLK cycles are needed per conversion
             (0 << ADPS0);      // set prescaler to 64, bit 0 // So, after 100uS a measurement is available after activation
             
 }
 
+/**
+ * Returns the debounced state of all digital inputs as a bitmap of (1 << INPUT_x).
+ * A set bit means the input is asserted (voting, armed, breakwire connected, squib connected).
+ */
+uint8_t get_inputs() {
+    return inputs_debounced;
+}
+
+/**
+ * Returns a bitmap of the inputs that changed since the last call, and clears it.
+ */
+uint8_t get_input_edges() {
+    uint8_t edges;
+    ATOMIC(
+        edges = inputs_edges;
+        inputs_edges = 0;
+    );
+    return edges;
+}
+
+/**
+ * Set a function that is called from interrupt context right after the debounced state of inputs
+ * changed, with the bitmap of the inputs that changed. NULL removes it. Safe to call from interrupt context.
+ */
+void set_input_handler(void (*handler)(uint8_t edges)) {
+    NESTED_ATOMIC(input_handler = handler;);
+}
+
+/**
+ * Returns the time (see get_time()) at which the last change of an input was first seen,
+ * before debouncing. Thanks to the pin change interrupts this is accurate to a few microseconds.
+ */
+uint32_t get_input_edge_time(uint8_t input) {
+    uint32_t temp;
+    ATOMIC(temp = input_edge_times[input];);
+    return temp;
+}
+
+/**
+ * Returns nonzero while an input differs from its debounced state, that is while a change of it
+ * has yet to be debounced. Safe to call from interrupt context.
+ */
+uint8_t is_input_changing() {
+    return read_inputs() != inputs_debounced;
+}
+
 /**
  * Returns nonzero when the vote in pin is pulled high
  */
 uint8_t is_vote_asserted() {
-    return !READ_PIN(VOTE_IN_PIN);
+    return inputs_debounced & (1 << INPUT_VOTE);
 }
 
 /**
  * Returns nonzero when a valid pyro is connected to the pyro output
  */
 uint8_t is_squib_connected() {
-    return READ_PIN(CONTINUITY_DETECTION_PIN);
+    return inputs_debounced & (1 << INPUT_SQUIB);
 }
 
 /**
  * Returns nonzero when the armed switch is in armed mode
  */
 uint8_t is_armed() {
-    return !READ_PIN(ARMED_SWITCH_PIN);
+    return inputs_debounced & (1 << INPUT_ARMED);
 }
 
 /**
  * Returns nonzero when a breakwire is connected
  */
 uint8_t is_breakwire_connected() {
-    return READ_PIN(BREAKWIRE_PIN);
+    return inputs_debounced & (1 << INPUT_BREAKWIRE);
+}
+
+/**
+ * Returns nonzero once the first battery measurement is available.
+ */
+uint8_t is_battery_value_ready() {
+    return battery_ready;
 }
 
 /**
- * Returns the most recent ADC measurement of the battery sensor.
- * 
+ * Returns the filtered measurement of the battery sensor in 8 bits.
  */
 uint8_t get_battery_value() {
-    // The ADC is in Free Running mode, then we need to wait for ADIF == 1 in order to read a new value
-    while (! (ADCSRA & (1 << ADIF) ) );
-    return ADCH; // Store the battery voltage     return battery_voltage;  // Return the battery voltage
+    return get_battery_value_precise() >> 8;
+}
+
+/**
+ * Returns the filtered measurement of the battery sensor as a left adjusted 16-bit value.
+ * The upper 8 bits are the value returned by get_battery_value().
+ */
+uint16_t get_battery_value_precise() {
+    uint16_t temp;
+    ATOMIC(temp = battery_value;);
+    return temp;
+}
+
+/**
+ * Returns the lowest filtered battery value since the last reset_battery_statistics().
+ */
+uint16_t get_battery_min() {
+    uint16_t temp;
+    ATOMIC(temp = battery_min;);
+    return temp;
+}
+
+/**
+ * Returns the highest filtered battery value since the last reset_battery_statistics().
+ */
+uint16_t get_battery_max() {
+    uint16_t temp;
+    ATOMIC(temp = battery_max;);
+    return temp;
+}
+
+/**
+ * Restarts the min/max tracking of the battery value from the current value.
+ */
+void reset_battery_statistics() {
+    ATOMIC(
+        battery_min = battery_value;
+        battery_max = battery_value;
+    );
+}
+
+/**
+ * Turn the ADC off for standby, see power.h. The battery value stays at the last measurement.
+ */
+void suspend_inputs() {
+    ADCSRA &= ~(1 << ADEN);
+    PRR |= 1 << PRADC;
+}
+
+/**
+ * Restart the battery measurement after suspend_inputs()
+ */
+void resume_inputs() {
+    PRR &= ~(1 << PRADC);
+    // the first conversion takes 25 adc clocks, 200us, the ones after it run freely again
+    ADCSRA |= (1 << ADEN) | (1 << ADSC);
 }
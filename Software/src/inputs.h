@@ -7,11 +7,50 @@
  * This file contains interfaces that measure data from the ouside world
  */
 
+// digital inputs, as used in the input bitmap (1 << INPUT_x) and for get_input_edge_time()
+#define INPUT_VOTE          0
+#define INPUT_ARMED         1
+#define INPUT_BREAKWIRE     2
+#define INPUT_SQUIB         3
+#define INPUT_COUNT         4
+
+// amount of consecutive equal samples (~1ms apart) before an input is considered to have changed
+#define INPUT_DEBOUNCE_SAMPLES 3
+
 /**
  * Initialize the input peripherals
  */
 void init_inputs();
 
+/**
+ * Returns the debounced state of all digital inputs as a bitmap of (1 << INPUT_x).
+ * A set bit means the input is asserted (voting, armed, breakwire connected, squib connected).
+ */
+uint8_t get_inputs();
+
+/**
+ * Returns a bitmap of the inputs that changed since the last call, and clears it.
+ */
+uint8_t get_input_edges();
+
+/**
+ * Set a function that is called from interrupt context right after the debounced state of inputs
+ * changed, with the bitmap of the inputs that changed. NULL removes it. Safe to call from interrupt context.
+ */
+void set_input_handler(void (*handler)(uint8_t edges));
+
+/**
+ * Returns the time (see get_time()) at which the last change of an input was first seen,
+ * before debouncing. Thanks to the pin change interrupts this is accurate to a few microseconds.
+ */
+uint32_t get_input_edge_time(uint8_t input);
+
+/**
+ * Returns nonzero while an input differs from its debounced state, that is while a change of it
+ * has yet to be debounced. Safe to call from interrupt context.
+ */
+uint8_t is_input_changing();
+
 /**
  * Returns nonzero when the vote in pin is pulled high
  */
@@ -33,8 +72,45 @@ uint8_t is_armed();
 uint8_t is_breakwire_connected();
 
 /**
- * Returns the most recent ADC measurement of the battery sensor.
+ * Returns nonzero once the first battery measurement is available.
+ */
+uint8_t is_battery_value_ready();
+
+/**
+ * Returns the filtered measurement of the battery sensor in 8 bits.
+ * This never waits for the ADC, the measurement is updated in the background.
+ */
+uint8_t get_battery_value();
+
+/**
+ * Returns the filtered measurement of the battery sensor as a left adjusted 16-bit value.
+ * The upper 8 bits are the value returned by get_battery_value().
+ */
+uint16_t get_battery_value_precise();
+
+/**
+ * Returns the lowest filtered battery value since the last reset_battery_statistics().
+ */
+uint16_t get_battery_min();
+
+/**
+ * Returns the highest filtered battery value since the last reset_battery_statistics().
+ */
+uint16_t get_battery_max();
+
+/**
+ * Restarts the min/max tracking of the battery value from the current value.
+ */
+void reset_battery_statistics();
+
+/**
+ * Turn the ADC off for standby, see power.h. The battery value stays at the last measurement.
+ */
+void suspend_inputs();
+
+/**
+ * Restart the battery measurement after suspend_inputs()
  */
-uint8_t get_battery_value() ;
+void resume_inputs();
 
 #endif
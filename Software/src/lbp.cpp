@@ -1,4 +1,11 @@
 #include "lbp.h"
+#include <avr/pgmspace.h>
+#include <string.h>
+#include "actuators.h"
+#include "events.h"
+#include "profiling.h"
+#include "relay.h"
+#include "crc8.h"
 
 /**
  * Internal data structures
@@ -13,61 +20,168 @@
 #define STATE_FRAME     1
 #define STATE_ESCAPING  2
 #define STATE_ENDING    3
-#define STATE_FILLING   4
-
-// rx state
-static uint8_t rx_link_state = STATE_IDLE;
-static uint8_t rx_crc;
-
-// tx state
-volatile static uint8_t tx_link_state = STATE_IDLE;
-static uint8_t tx_crc;
-
-// receive buffer
-static uint8_t lbp_rx_buffer[LBP_BUFFER_SIZE];
-static uint8_t lbp_rx_buffer_length;
+#define STATE_NEXT      4 // the stop byte of the previous frame is still being sent
+
+// LBP_ERROR_* counters
+static volatile uint8_t lbp_errors[LBP_ERROR_COUNT];
+
+// address of the board, see lbp_set_address()
+volatile static uint8_t lbp_address = LBP_ADDRESS_UNKNOWN;
+
+#if LBP_RELAY
+// where a received frame goes, decided by its header
+#define ROUTE_LOCAL     0x01 // the rx queue, for lbp_poll()
+#define ROUTE_UART      0x02 // forwarded to the uart
+#define ROUTE_RELAY     0x04 // forwarded to the relay link
+#endif
+
+// frame pool. A frame is either free, being received, waiting in the rx queue, handed to the
+// application or waiting in a tx queue. Replies are built in the frame the command arrived in,
+// which is then queued for sending as is.
+typedef struct {
+    uint8_t length;
+#if LBP_RELAY
+    uint8_t route;
+#endif
+    uint8_t data[LBP_BUFFER_SIZE];
+} lbp_frame;
+
+static lbp_frame lbp_frames[LBP_FRAME_COUNT];
+
+// bitmap of the free frames
+volatile static uint8_t lbp_free_frames = (1 << LBP_FRAME_COUNT) - 1;
+
+#define FRAME_NONE 0xFF
+
+// queue of frame numbers
+typedef struct {
+    volatile uint8_t index;
+    volatile uint8_t length;
+    uint8_t frames[LBP_FRAME_COUNT];
+} lbp_frame_queue;
+
+// complete frames waiting for lbp_poll()
+static lbp_frame_queue lbp_rx_queue;
+
+// frame handed to the application by lbp_poll() or lbp_get_tx_buffer()
+static uint8_t lbp_tx_claimed = FRAME_NONE;
+
+// receiving end of a link
+typedef struct {
+    uint8_t state;
+    uint8_t crc;
+    uint8_t frame; // frame being received. It is kept for the next frame if the current one turns out to be invalid
+} lbp_rx_link;
+
+// sending end of a link
+typedef struct {
+    volatile uint8_t state;
+    uint8_t crc;
+    uint8_t index;          // position in the frame that is being sent
+    lbp_frame_queue queue;  // frames waiting to be sent, the head is the one being sent
+} lbp_tx_link;
+
+static lbp_rx_link uart_rx = {STATE_IDLE, 0, FRAME_NONE};
+static lbp_tx_link uart_tx;
+
+#if LBP_RELAY
+static lbp_rx_link relay_rx = {STATE_IDLE, 0, FRAME_NONE};
+static lbp_tx_link relay_tx;
+#endif
+
+// set by the rx interrupt for every valid frame from the uart, see lbp_poll()
+volatile static uint8_t lbp_frame_heard;
+
+// baud rate state
+#define UBRR_NONE       0xFF
+#define UBRR(baud)      ((CPU_FREQ / (baud) / 16) - 1)
+
+static const uint8_t lbp_baud_ubrr[LBP_BAUD_COUNT] PROGMEM = {
+    UBRR(38400), UBRR(57600), UBRR(115200), UBRR(230400)
+};
+
+static uint8_t lbp_ubrr = UBRR(UART_BAUD);
+// baud rate that will be applied once the transmitter is idle
+volatile static uint8_t lbp_pending_ubrr = UBRR_NONE;
+// time in milliseconds when the last valid frame was received or the baud rate was changed
+static uint32_t lbp_frame_time;
 
-// transmit buffer
-static uint8_t lbp_tx_buffer[LBP_BUFFER_SIZE];
-static uint8_t lbp_tx_buffer_length;
-static uint8_t lbp_tx_buffer_index;
+/**
+ * Take a frame from the pool. Returns FRAME_NONE if there is none. Must be called with interrupts disabled.
+ */
+static uint8_t alloc_frame() {
+    for (uint8_t i = 0; i < LBP_FRAME_COUNT; i++) {
+        if (lbp_free_frames & (1 << i)) {
+            lbp_free_frames &= ~(1 << i);
+            return i;
+        }
+    }
+    return FRAME_NONE;
+}
 
 /**
- * The crc function used by the launchbox protocol
+ * Returns the amount of free frames in the pool
  */
-static uint8_t crc8(uint8_t data, uint8_t crc) {
-    crc = crc ^ data;
-    for (uint8_t i = 0; i < 8; i++) {
-        if (crc & 1) {
-            crc = (crc >> 1) ^ 0x8C;
+static uint8_t free_frame_count() {
+    uint8_t count = 0;
+    for (uint8_t i = 0; i < LBP_FRAME_COUNT; i++) {
+        if (lbp_free_frames & (1 << i)) {
+            count++;
+        }
+    }
+    return count;
+}
 
-        } else {
-            crc = (crc >> 1);
+/**
+ * Add a frame to the end of a queue. Must be called with interrupts disabled.
+ */
+static void queue_push(lbp_frame_queue *queue, uint8_t frame) {
+    uint8_t slot = queue->index + queue->length;
+    if (slot >= LBP_FRAME_COUNT) {
+        slot -= LBP_FRAME_COUNT;
+    }
+    queue->frames[slot] = frame;
+    queue->length++;
+}
 
-        }
+/**
+ * Count a link error, from the rx interrupt
+ */
+static void count_error(uint8_t error) {
+    if (lbp_errors[error] != 0xFF) {
+        lbp_errors[error]++;
     }
-    return crc;
+}
+
+/**
+ * Remove the frame at the head of a queue and return it. Must be called with interrupts disabled.
+ */
+static uint8_t queue_pop(lbp_frame_queue *queue) {
+    uint8_t frame = queue->frames[queue->index];
+    queue->index = (queue->index == LBP_FRAME_COUNT - 1) ? 0 : queue->index + 1;
+    queue->length--;
+    return frame;
 }
 
 /**
  * This function parses a packet in the receive buffer and
  * handles any reserved messages. If the message is meant for user code, it
- * calls lbp_handler.
+ * calls lbp_handler. The reply is built in the same buffer, so everything
+ * needed from the packet has to be read before the reply fields are written.
  */
 static void parse_packet(lbp_packet *packet, uint8_t data_length) {
-    // acquire a reply buffer
-    lbp_packet *reply = lbp_get_tx_buffer();
-    if (!reply) {
-        return;
-    }
+    lbp_packet *reply = packet;
+    uint8_t type = LBP_TYPE(packet);
 
+    // address the reply to the sender
     reply->destinfo = LBP_SRC_ADDR(packet) | LBP_SEQNUM(packet);
+    reply->srcinfo = LBP_SOURCE_ADDRESS;
 
     // temp var used for the reserved commands
     uint8_t temp;
 
     // This device doesn't care about getting a reply
-    if (LBP_TYPE(packet) == LBP_REPLY) {
+    if (type == LBP_REPLY) {
         lbp_discard_message();
         return;
     }
@@ -80,8 +194,8 @@ static void parse_packet(lbp_packet *packet, uint8_t data_length) {
                 break;
 
             case LBP_IDENTIFY:
-                packet->srcinfo |= (LBP_TYPE(packet) == LBP_SYNC) ? LBP_REPLY : LBP_ASYNC;
-                packet->id = (LBP_TYPE(packet) == LBP_ASYNC) ? LBP_IDENTIFY_ASYNC_REPLY : LBP_IDENTIFY;
+                reply->srcinfo |= (type == LBP_SYNC) ? LBP_REPLY : LBP_ASYNC;
+                reply->id = (type == LBP_SYNC) ? LBP_IDENTIFY : LBP_IDENTIFY_ASYNC_REPLY;
                 reply->data[0] = LBP_IDENTIFY_CONTENT_0;
                 reply->data[1] = LBP_IDENTIFY_CONTENT_1;
                 lbp_send_message(2);
@@ -89,21 +203,21 @@ static void parse_packet(lbp_packet *packet, uint8_t data_length) {
 
             case LBP_EXTENDED_IDENTIFY:
                 // syncronous only
-                if (LBP_TYPE(packet) != LBP_SYNC) {
+                if (type != LBP_SYNC) {
                     lbp_discard_message();
                     break;
                 }
 
-                packet->srcinfo |= LBP_REPLY;
+                reply->srcinfo |= LBP_REPLY;
                 // calculate the page number and nack if it's reserved
                 temp = (data_length < 1) ? 0 : packet->data[0];
                 if (temp >= 0x10) {
-                    packet->id = LBP_NACK;
+                    reply->id = LBP_NACK;
                     lbp_send_message(0);
                     break;
                 }
 
-                packet->id = LBP_EXTENDED_IDENTIFY;
+                reply->id = LBP_EXTENDED_IDENTIFY;
 
                 if (temp == 0) {
                     reply->data[0] = LBP_EXTENDED_IDENTIFY_CONTENT_0;
@@ -123,9 +237,9 @@ static void parse_packet(lbp_packet *packet, uint8_t data_length) {
                 break;
 
             case LBP_NETWORK_DISCOVERY:
-                if (LBP_TYPE(packet) == LBP_SYNC) {
-                    packet->srcinfo |= LBP_REPLY;
-                    packet->id = LBP_NACK;
+                if (type == LBP_SYNC) {
+                    reply->srcinfo |= LBP_REPLY;
+                    reply->id = LBP_NACK;
                     lbp_send_message(0);
                 } else {
                     lbp_discard_message();
@@ -134,17 +248,33 @@ static void parse_packet(lbp_packet *packet, uint8_t data_length) {
                 break;
 
             case LBP_STATUS_REQUEST:
-                packet->srcinfo |= (LBP_TYPE(packet) == LBP_SYNC) ? LBP_REPLY : LBP_ASYNC;
-                packet->id = (LBP_TYPE(packet) == LBP_ASYNC) ? LBP_STATUS_REQUEST_ASYNC_REPLY : LBP_STATUS_REQUEST;
+                reply->srcinfo |= (type == LBP_SYNC) ? LBP_REPLY : LBP_ASYNC;
+                reply->id = (type == LBP_SYNC) ? LBP_STATUS_REQUEST : LBP_STATUS_REQUEST_ASYNC_REPLY;
+
+                reply->data[0] = (1 << 4) | (lbp_state_error() ? 2 << 1 : (lbp_state_warning() ? 1 << 1 : 0)) |
+                                 (lbp_state_armed() ? 1 : 0);
+                lbp_send_message(1 + lbp_state_name(reply->data + 1));
+                break;
 
-                reply->data[0] = (1 << 4) | (lbp_state_error() ? 2 << 1 : 0) | (lbp_state_armed() ? 1 : 0);
+            case LBP_WINDOW_SIZE:
+                // syncronous only
+                if (type != LBP_SYNC) {
+                    lbp_discard_message();
+                    break;
+                }
+
+                // commands are handled in order from the rx queue, so the replies for
+                // a full window of sequence numbers go out in the order they came in
+                reply->srcinfo |= LBP_REPLY;
+                reply->id = LBP_WINDOW_SIZE;
+                reply->data[0] = LBP_WINDOW_SIZE_CONTENT;
                 lbp_send_message(1);
                 break;
 
             default:
-                if (LBP_TYPE(packet) == LBP_SYNC) {
-                    packet->srcinfo |= LBP_REPLY;
-                    packet->id = LBP_NACK;
+                if (type == LBP_SYNC) {
+                    reply->srcinfo |= LBP_REPLY;
+                    reply->id = LBP_NACK;
                     lbp_send_message(0);
 
                 } else {
@@ -153,10 +283,13 @@ static void parse_packet(lbp_packet *packet, uint8_t data_length) {
                 }
         }
     } else {
-        if (LBP_TYPE(packet) == LBP_SYNC) {
+        if (type == LBP_SYNC) {
             reply->srcinfo |= LBP_REPLY;
             lbp_handler(packet, data_length, reply);
 
+        } else if (type == LBP_BROADCAST) {
+            lbp_broadcast_handler(packet, data_length);
+
         } else {
             lbp_discard_message();
 
@@ -165,135 +298,391 @@ static void parse_packet(lbp_packet *packet, uint8_t data_length) {
 }
 
 /**
- * Interrupt handlers
+ * Write the baud rate registers. Must only be called when the transmitter is idle.
  */
-#include "actuators.h"
+static void apply_ubrr(uint8_t ubrr) {
+    lbp_ubrr = ubrr;
+    UBRR0H = 0;
+    UBRR0L = ubrr;
+}
+
 /**
- * This interrupt fires once a complete byte has been received. It will parse the 
- * link layer state and when the frame is complete it will call parse_packet on the packet
+ * Select a new baud rate. It is applied right away if the transmitter is idle,
+ * otherwise once the tx queue has been drained.
  */
-ISR(USART0_RX_vect) {
-    // read the byte from the shift reg
-    uint8_t byte = UDR0;
+static void set_ubrr(uint8_t ubrr) {
+    lbp_frame_time = get_millis();
+    ATOMIC(
+        if (uart_tx.state == STATE_IDLE) {
+            apply_ubrr(ubrr);
+            lbp_pending_ubrr = UBRR_NONE;
+
+        } else {
+            lbp_pending_ubrr = ubrr;
+
+        }
+    );
+}
+
+/**
+ * Starts sending the frame at the head of the queue of link. Returns the start byte, which the caller
+ * writes to the link. Must be called with interrupts disabled while the link is idle.
+ */
+static uint8_t start_frame(lbp_tx_link *link) {
+    link->index = 0;
+    link->crc = 0;
+    link->state = STATE_FRAME;
+    return CHAR_START;
+}
 
+/**
+ * Queue frame for sending on the uart, and start it if the transmitter is idle. Otherwise the tx
+ * interrupt will get to it. Must be called with interrupts disabled.
+ */
+static void send_uart(uint8_t frame) {
+    queue_push(&uart_tx.queue, frame);
+    if (uart_tx.state == STATE_IDLE) {
+        UDR0 = start_frame(&uart_tx);
+    }
+}
+
+#if LBP_RELAY
+/**
+ * Queue frame for sending on the relay link, like send_uart(). Must be called with interrupts disabled.
+ */
+static void send_relay(uint8_t frame) {
+    queue_push(&relay_tx.queue, frame);
+    if (relay_tx.state == STATE_IDLE) {
+        relay_write(start_frame(&relay_tx));
+    }
+}
+
+/**
+ * Send a received frame on to the other link, route is ROUTE_UART or ROUTE_RELAY.
+ * Must be called with interrupts disabled.
+ */
+static void forward_frame(uint8_t frame, uint8_t route) {
+    // the crc is computed again on the way out
+    lbp_frames[frame].length--;
+    if (route == ROUTE_UART) {
+        send_uart(frame);
+    } else {
+        send_relay(frame);
+    }
+}
+
+/**
+ * Returns the ROUTE_* flags of a frame from link with header, once the header is in. Frames from the
+ * uart are taken in or forwarded to the relay link, frames from the relay link are forwarded to the
+ * uart. Broadcasts are both taken in and forwarded.
+ */
+static inline uint8_t route_frame(const lbp_rx_link *link, const uint8_t *header) {
+    uint8_t type = header[0] & LBP_TYPE_MASK;
+    uint8_t other = (link == &uart_rx) ? ROUTE_RELAY : ROUTE_UART;
+    if (type == LBP_BROADCAST) {
+        return ROUTE_LOCAL | other;
+    }
+    if (link == &uart_rx) {
+        uint8_t destination = header[1] & LBP_ADDRESS_MASK;
+        if (destination == lbp_address || destination == LBP_ADDRESS_UNKNOWN) {
+            // replies go the other way, to the host
+            return (type == LBP_REPLY) ? 0 : ROUTE_LOCAL;
+        }
+    }
+    return other;
+}
+#else
+/**
+ * Returns nonzero if a frame with header is for this board, once the header is in
+ */
+static inline uint8_t is_local(const uint8_t *header) {
+    uint8_t type = header[0] & LBP_TYPE_MASK;
+    if (type == LBP_BROADCAST) {
+        return 1;
+    }
+    // this device doesn't care about replies, they're for the host
+    uint8_t destination = header[1] & LBP_ADDRESS_MASK;
+    return type != LBP_REPLY && (destination == lbp_address || destination == LBP_ADDRESS_UNKNOWN);
+}
+#endif
+
+/**
+ * Interrupt handlers
+ */
+/**
+ * Parse a byte received on link. It will update the link layer state and when the frame is
+ * complete it will add it to the rx queue for lbp_poll(), or forward it in a relay build.
+ * Frames that are for other boards are dropped right after their header, frames that do not fit
+ * in the pool are dropped.
+ */
+static inline void receive_byte(lbp_rx_link *link, uint8_t byte) {
     // are we escaping
-    if (rx_link_state == STATE_ESCAPING) {
+    if (link->state == STATE_ESCAPING) {
         byte = ~byte;
-        rx_link_state = STATE_FRAME;
+        link->state = STATE_FRAME;
 
     // or are we in a frame
-    } else if (rx_link_state == STATE_FRAME) {
+    } else if (link->state == STATE_FRAME) {
         switch (byte) {
             case CHAR_ESCAPE:
                 // escape char
-                rx_link_state = STATE_ESCAPING;
+                link->state = STATE_ESCAPING;
                 return;
 
             case CHAR_START:
                 // can't start a frame inside a frame
-                rx_link_state = STATE_IDLE;
+                link->state = STATE_IDLE;
                 return;
 
             case CHAR_STOP:
                 // end of frame
-                rx_link_state = STATE_IDLE;
+                link->state = STATE_IDLE;
 
                 // check the crc 
-                if (!rx_crc && lbp_rx_buffer_length >= 4) {
-                    // Do something with the packet
-
-                    parse_packet((lbp_packet *)lbp_rx_buffer, lbp_rx_buffer_length - 4);
+                if (!link->crc && lbp_frames[link->frame].length >= 4) {
+#if LBP_RELAY
+                    uint8_t route = lbp_frames[link->frame].route;
+                    if (link == &uart_rx) {
+                        lbp_frame_heard = 1;
+                    }
+                    if (!(route & ROUTE_LOCAL)) {
+                        forward_frame(link->frame, route);
+                        link->frame = FRAME_NONE;
+                        return;
+                    }
+#else
+                    lbp_frame_heard = 1;
+#endif
+                    // hand the frame over to lbp_poll()
+                    queue_push(&lbp_rx_queue, link->frame);
+                    link->frame = FRAME_NONE;
+                    post_event(EVENT_LBP);
+                } else if (link->crc) {
+                    count_error(LBP_ERROR_CRC);
+                    PROFILE_COUNT(PROFILE_CRC_DROP);
                 }
                 return;
         }
 
     // or are we starting a frame
     } else if (byte == CHAR_START) {
-        lbp_rx_buffer_length = 0;
-        rx_link_state = STATE_FRAME;
-        rx_crc = 0;
+        // reuse the frame of a broken packet, otherwise take a new one
+        if (link->frame == FRAME_NONE) {
+            link->frame = alloc_frame();
+
+            // no space to store the frame, ignore it
+            if (link->frame == FRAME_NONE) {
+                count_error(LBP_ERROR_FRAME);
+                return;
+            }
+        }
+
+        lbp_frames[link->frame].length = 0;
+        link->state = STATE_FRAME;
+        link->crc = 0;
+        return;
+
+    // outside of a frame, this is the rest of a frame we had no space for, or for someone else, or noise
+    } else {
         return;
     }
 
     // this is a valid data bit, add it
-    if (lbp_rx_buffer_length == LBP_BUFFER_SIZE) {
+    lbp_frame *frame = lbp_frames + link->frame;
+    if (frame->length == LBP_BUFFER_SIZE) {
         // we're full, ignore this packet
-        rx_link_state = STATE_IDLE;
+        link->state = STATE_IDLE;
+        count_error(LBP_ERROR_FRAME);
         return;
     }
 
-    lbp_rx_buffer[lbp_rx_buffer_length++] = byte;
-    rx_crc = crc8(byte, rx_crc);
+    frame->data[frame->length++] = byte;
+    link->crc = crc8(byte, link->crc);
+
+    // the header is in, which tells whether the rest matters. The frame is kept for the next one
+    if (frame->length == 2) {
+#if LBP_RELAY
+        frame->route = route_frame(link, frame->data);
+        if (!frame->route) {
+            link->state = STATE_IDLE;
+        }
+#else
+        if (!is_local(frame->data)) {
+            link->state = STATE_IDLE;
+        }
+#endif
+    }
 }
 
 /**
- * This interrupt fires when a byte has been transmitted successfully. 
- * It handles the link layer, escaping bytes in the tx buffer where
- * necessary and computing the crc
+ * This interrupt fires once a complete byte has been received.
  */
-ISR(USART0_TX_vect) {
+ISR(USART0_RX_vect) {
+    PROFILE_BEGIN(PROFILE_RX);
+    // the error flags are only valid until the byte is read
+    uint8_t status = UCSR0A;
+    if (status & ((1 << DOR0) | (1 << FE0))) {
+        count_error(LBP_ERROR_UART);
+#if PROFILING
+        if (status & (1 << DOR0)) {
+            PROFILE_COUNT(PROFILE_UART_OVERRUN);
+        }
+        if (status & (1 << FE0)) {
+            PROFILE_COUNT(PROFILE_UART_FRAME);
+        }
+#endif
+    }
+
+    // read the byte from the shift reg
+    receive_byte(&uart_rx, UDR0);
+    PROFILE_END(PROFILE_RX);
+}
+
+/**
+ * Pick the next byte to send on link. It handles the link layer, escaping bytes in the frame where
+ * necessary and computing the crc. Once a frame is done the next frame in the queue is started.
+ * Returns 0 once the stop byte of the last frame is out, the link is idle then.
+ */
+static inline uint8_t next_byte(lbp_tx_link *link, uint8_t *byte) {
     // if we're idling, do nothing
-    if (tx_link_state == STATE_IDLE || tx_link_state == STATE_FILLING) {
-        return;
+    if (link->state == STATE_IDLE) {
+        return 0;
     }
 
+    // the previous frame is done, start the next one if there's one waiting
+    if (link->state == STATE_NEXT) {
+        if (link->queue.length) {
+            *byte = start_frame(link);
+            return 1;
+        }
+        link->state = STATE_IDLE;
+        return 0;
+    }
+
+    lbp_frame *frame = lbp_frames + link->queue.frames[link->queue.index];
+
     // if we've ended the packet
-    if (tx_link_state == STATE_ENDING) {
-        UDR0 = CHAR_STOP;
-        tx_link_state = STATE_IDLE;
+    if (link->state == STATE_ENDING) {
+        *byte = CHAR_STOP;
+
+        // return the frame to the pool
+        lbp_free_frames |= 1 << queue_pop(&link->queue);
+        link->state = STATE_NEXT;
 
     // if we hit the end of the data we need to write a (possibly escaped) crc
-    } else if (lbp_tx_buffer_index == lbp_tx_buffer_length) {
+    } else if (link->index == frame->length) {
         // we've printed the escape character for the crc
-        if (tx_link_state == STATE_ESCAPING) {
-            UDR0 = ~tx_crc;
-            tx_link_state = STATE_ENDING;
+        if (link->state == STATE_ESCAPING) {
+            *byte = ~link->crc;
+            link->state = STATE_ENDING;
 
         // the crc needs to be escaped
-        } else if (tx_crc == CHAR_STOP || tx_crc == CHAR_START || tx_crc == CHAR_ESCAPE) {
-            UDR0 = CHAR_ESCAPE;
-            tx_link_state = STATE_ESCAPING;
+        } else if (link->crc == CHAR_STOP || link->crc == CHAR_START || link->crc == CHAR_ESCAPE) {
+            *byte = CHAR_ESCAPE;
+            link->state = STATE_ESCAPING;
 
         // The crc can be printed without escaping
         } else {
-            UDR0 = tx_crc;
-            tx_link_state = STATE_ENDING;
+            *byte = link->crc;
+            link->state = STATE_ENDING;
 
         }
 
     // if this char is following an escape char
-    } else if (tx_link_state == STATE_ESCAPING) {
-        UDR0 = ~lbp_tx_buffer[lbp_tx_buffer_index - 1];
-        tx_link_state = STATE_FRAME;
+    } else if (link->state == STATE_ESCAPING) {
+        *byte = ~frame->data[link->index - 1];
+        link->state = STATE_FRAME;
 
 
     // if we're sending data
     } else {
-        uint8_t byte = lbp_tx_buffer[lbp_tx_buffer_index++];
+        uint8_t data = frame->data[link->index++];
 
         // update the crc
-        tx_crc = crc8(byte, tx_crc);
+        link->crc = crc8(data, link->crc);
 
         // check if we should escape
-        if (byte == CHAR_STOP || byte == CHAR_START || byte == CHAR_ESCAPE) {
-            UDR0 = CHAR_ESCAPE;
-            tx_link_state = STATE_ESCAPING;
+        if (data == CHAR_STOP || data == CHAR_START || data == CHAR_ESCAPE) {
+            *byte = CHAR_ESCAPE;
+            link->state = STATE_ESCAPING;
 
         } else {
-            UDR0 = byte;
+            *byte = data;
 
         }
     }
+    return 1;
+}
+
+/**
+ * Send the next byte on the uart, see next_byte()
+ */
+static inline void transmit_byte() {
+    uint8_t byte;
+    if (next_byte(&uart_tx, &byte)) {
+        UDR0 = byte;
+        return;
+    }
+
+    // the line is quiet, this is the moment to change the baud rate
+    if (lbp_pending_ubrr != UBRR_NONE) {
+        apply_ubrr(lbp_pending_ubrr);
+        lbp_pending_ubrr = UBRR_NONE;
+    }
 }
 
+/**
+ * This interrupt fires when a byte has been transmitted successfully.
+ */
+ISR(USART0_TX_vect) {
+    PROFILE_BEGIN(PROFILE_TX);
+    transmit_byte();
+    PROFILE_END(PROFILE_TX);
+}
+
+// start frame detection in standby, the start bit of a byte wakes up the board
+#define START_DETECTION ((1 << RXSIE0) | (1 << SFDE0))
+
+/**
+ * Start of a byte while the board is in standby. Waking up is all there is to do, the byte is
+ * received once the clocks run again.
+ */
+ISR(USART0_START_vect) {
+    // clears the flag, the detection stays on until lbp_resume()
+    UCSR0D = START_DETECTION | (1 << RXS0);
+}
+
+#if LBP_RELAY
+/**
+ * A byte was received on the relay link, see relay.h
+ */
+void lbp_relay_receive(uint8_t byte) {
+    receive_byte(&relay_rx, byte);
+}
+
+/**
+ * The relay link is done with a byte, see relay.h
+ */
+void lbp_relay_transmit() {
+    uint8_t byte;
+    if (next_byte(&relay_tx, &byte)) {
+        relay_write(byte);
+    }
+}
+#endif
+
 /**
  * Public interface
  */
 
 /**
- * Initialize the peripheral and internal state
+ * Initialize the peripheral and internal state. baud_index selects the LBP_BAUD_* rate to start with,
+ * the link falls back to UART_BAUD if no valid frame arrives in time. Invalid values select UART_BAUD directly.
+ * address is the address of the board, see lbp_set_address().
  */
-void init_lbp() {
+void init_lbp(uint8_t baud_index, uint8_t address) {
+    lbp_set_address(address);
+
     // USART0 is used for UART communication
     
     // no special modes
@@ -303,48 +692,195 @@ void init_lbp() {
     // Set the frame format (8bits, no parity, 1 stop bit)
     UCSR0C = (3 << UCSZ00);
     // Baud rate registers
-    UBRR0H = ((CPU_FREQ / UART_BAUD / 16) - 1) >> 8;
-    UBRR0L = ((CPU_FREQ / UART_BAUD / 16) - 1) & 0xFF;
+    UBRR0H = UBRR(UART_BAUD) >> 8;
+    UBRR0L = UBRR(UART_BAUD) & 0xFF;
+    if (baud_index < LBP_BAUD_COUNT) {
+        apply_ubrr(pgm_read_byte(lbp_baud_ubrr + baud_index));
+    }
+
+#if LBP_RELAY
+    init_relay();
+#endif
+}
+
+/**
+ * Set the address of the board, only its lower 6 bits are used. Frames to other addresses are dropped
+ * from then on, or forwarded in a relay build.
+ */
+void lbp_set_address(uint8_t address) {
+    lbp_address = address & LBP_ADDRESS_MASK;
+}
+
+/**
+ * Select one of the LBP_BAUD_* baud rates. Returns zero if the index is invalid.
+ * When answering a command, call this after queuing the reply so the reply is still sent at the
+ * old rate. If no valid frame is received for LBP_BAUD_FALLBACK_TIMEOUT the link reverts to UART_BAUD.
+ */
+uint8_t lbp_set_baud(uint8_t index) {
+    if (index >= LBP_BAUD_COUNT) {
+        return 0;
+    }
+    set_ubrr(pgm_read_byte(lbp_baud_ubrr + index));
+    return 1;
+}
+
+#if LBP_RELAY
+/**
+ * Forward a copy of a broadcast in the rx queue to the other link, the frame itself goes to the handler.
+ * Without a free frame the broadcast isn't forwarded.
+ */
+static void forward_copy(const lbp_frame *frame) {
+    uint8_t copy;
+    ATOMIC(
+        copy = alloc_frame();
+    );
+    if (copy == FRAME_NONE) {
+        count_error(LBP_ERROR_FRAME);
+        return;
+    }
+
+    memcpy(lbp_frames + copy, frame, sizeof(lbp_frame));
+    ATOMIC(
+        forward_frame(copy, frame->route & ~ROUTE_LOCAL);
+    );
+}
+#endif
+
+/**
+ * Dispatch any complete frames in the rx queue. Call this regularly from the main loop,
+ * lbp_handler() is called from here and not from interrupt context.
+ */
+void lbp_poll() {
+    // fall back to the default baud rate if we haven't heard anything valid for a while. That includes
+    // frames that were forwarded
+    if (lbp_frame_heard) {
+        lbp_frame_heard = 0;
+        lbp_frame_time = get_millis();
+    }
+    if (lbp_ubrr != UBRR(UART_BAUD) && get_millis() - lbp_frame_time >= LBP_BAUD_FALLBACK_TIMEOUT) {
+        set_ubrr(UBRR(UART_BAUD));
+    }
 
+    // the frame is handed to the handler to build the reply in, which means the application
+    // must not be holding on to a buffer from lbp_get_tx_buffer()
+    while (lbp_rx_queue.length && lbp_tx_claimed == FRAME_NONE) {
+        ATOMIC(
+            lbp_tx_claimed = queue_pop(&lbp_rx_queue);
+        );
+
+        lbp_frame *frame = lbp_frames + lbp_tx_claimed;
+#if LBP_RELAY
+        if (frame->route != ROUTE_LOCAL) {
+            forward_copy(frame);
+        }
+#endif
+        parse_packet((lbp_packet *)frame->data, frame->length - 4);
+    }
 }
 
 /**
- * Acquire access to the tx buffer. This will return NULL when the reply buffer is in use.
+ * Returns nonzero when no frames are waiting to be sent or to be handled by lbp_poll().
+ * Low priority messages should only be queued then, so they never hold up a reply.
+ */
+uint8_t lbp_link_idle() {
+    // the frame on the wire stays in the tx queue until its stop byte
+#if LBP_RELAY
+    if (relay_tx.queue.length) {
+        return 0;
+    }
+#endif
+    return !uart_tx.queue.length && !lbp_rx_queue.length;
+}
+
+/**
+ * Read the LBP_ERROR_* counters into data, a byte each. Returns LBP_ERROR_COUNT.
+ */
+uint8_t lbp_read_errors(uint8_t *data) {
+    for (uint8_t i = 0; i < LBP_ERROR_COUNT; i++) {
+        data[i] = lbp_errors[i];
+    }
+    return LBP_ERROR_COUNT;
+}
+
+/**
+ * Prepare the link for standby, see power.h: the start bit of the next byte wakes the board up and
+ * the byte is received as usual. Returns 0 if the transmitter is still busy, the board must not stop
+ * the clocks then. Call this with interrupts disabled.
+ */
+uint8_t lbp_suspend() {
+    // the stop byte of the last frame leaves the queue before it is on the wire
+    if (uart_tx.state != STATE_IDLE) {
+        return 0;
+    }
+#if LBP_RELAY
+    // Timer 0 stops in standby, a byte can't be sent or received then. The start bit of the next one
+    // wakes the board up in time
+    if (relay_tx.state != STATE_IDLE || !relay_idle()) {
+        return 0;
+    }
+#endif
+    UCSR0D = START_DETECTION;
+    return 1;
+}
+
+/**
+ * Undo lbp_suspend() after the board woke up
+ */
+void lbp_resume() {
+    // clears the flag too
+    UCSR0D = 1 << RXS0;
+}
+
+/**
+ * Acquire a frame for a message of the application. This will return NULL when a previously acquired
+ * buffer has not been sent or discarded yet, or when the frames left are needed for a window of commands.
  */
 lbp_packet *lbp_get_tx_buffer() {
     lbp_packet *buffer = NULL;
     // make sure we don't get interrupted when claiming the buffer
     ATOMIC(
-        // can we claim the buffer?
-        if (tx_link_state == STATE_IDLE) {
-            tx_link_state = STATE_FILLING;
-            buffer = (lbp_packet *)lbp_tx_buffer;
+        // can we claim a frame?
+        if (lbp_tx_claimed == FRAME_NONE && free_frame_count() > LBP_WINDOW_SIZE_CONTENT) {
+            lbp_tx_claimed = alloc_frame();
+            buffer = (lbp_packet *)lbp_frames[lbp_tx_claimed].data;
         }
     );
     if (buffer) {
         buffer->srcinfo = LBP_SOURCE_ADDRESS;
+    } else {
+        PROFILE_COUNT(PROFILE_TX_BUSY);
     }
     return buffer;
 }
 
 /**
- * Send the current message in the tx buffer and revokes access to it.
+ * Queue the current message in the tx buffer for transmission and revokes access to it.
+ * Queued messages are sent in order.
  */
 void lbp_send_message(uint8_t data_length) {
-    lbp_tx_buffer_length = data_length + 3;
-    lbp_tx_buffer_index = 0;
-    tx_crc = 0;
-
-    // this function can only be called if the transmit buffer was empty so we can just directly write to output reg
-    // start the frame
-    UDR0 = CHAR_START;
-    tx_link_state = STATE_FRAME;
+    lbp_frames[lbp_tx_claimed].length = data_length + 3;
 
+    ATOMIC(
+        send_uart(lbp_tx_claimed);
+        lbp_tx_claimed = FRAME_NONE;
+    );
 }
 
 /**
  * Discard the current tx buffer and revokes access to it.
  */
 void lbp_discard_message() {
-    tx_link_state = STATE_IDLE;
-}
\ No newline at end of file
+    ATOMIC(
+        lbp_free_frames |= 1 << lbp_tx_claimed;
+        lbp_tx_claimed = FRAME_NONE;
+    );
+}
+/**
+ * Returns the crc of the link layer over length bytes of data, starting from crc
+ */
+uint8_t lbp_crc(const uint8_t *data, uint8_t length, uint8_t crc) {
+    for (uint8_t i = 0; i < length; i++) {
+        crc = crc8(data[i], crc);
+    }
+    return crc;
+}
@@ -6,15 +6,42 @@
 /**
  * This file contains a launch box protocol implementation interface.
  * To use this file in a project, implement the callback functions
+ *
+ * Boards can share a bus. A frame is only taken in if it is a broadcast, or if it is addressed to the
+ * address of the board (see lbp_set_address()) or to LBP_ADDRESS_UNKNOWN, which is what a host uses
+ * that talks to a single board. Replies are for the host and never taken in. The rest is dropped as
+ * soon as its header is in, without buffering the rest of it or waking up the main loop.
+ * A relay build (LBP_RELAY in config.h) forwards the frames that aren't for the board to the relay link
+ * instead, see relay.h, and everything from the relay link to the uart. Broadcasts from either side are
+ * taken in and forwarded. The addresses of a forwarded frame are left as they are, the boards behind a
+ * relay filter by their own addresses like those on the bus.
  */
 
  /**
   * Defines relating to LBP
   */
 
-// size of the rx and tx buffer. Current code only accounts for one packet / buffer
+// size of a frame buffer. Current code only accounts for one packet / buffer
 #define LBP_BUFFER_SIZE 32
 
+// amount of frame buffers, shared by the frames being received, waiting for lbp_poll() and waiting
+// for transmission. At most 8. A relay needs more, frames being forwarded wait for the slower link
+#if LBP_RELAY
+#define LBP_FRAME_COUNT 8
+#else
+#define LBP_FRAME_COUNT 6
+#endif
+
+// baud rates that can be selected with lbp_set_baud(). The crystal divides exactly into all of them
+#define LBP_BAUD_38400      0
+#define LBP_BAUD_57600      1
+#define LBP_BAUD_115200     2
+#define LBP_BAUD_230400     3
+#define LBP_BAUD_COUNT      4
+
+// time without a valid frame after which a changed baud rate reverts to UART_BAUD, milliseconds
+#define LBP_BAUD_FALLBACK_TIMEOUT 5000
+
 // masks
 #define LBP_TYPE_MASK       0xC0
 #define LBP_SEQNUM_MASK     0xC0
@@ -29,6 +56,9 @@
 // Default source address
 #define LBP_SOURCE_ADDRESS 0x3F
 
+// destination of a device that doesn't know the address of the other end
+#define LBP_ADDRESS_UNKNOWN 0x3F
+
 // message id's
 #define LBP_NACK                            0x01
 #define LBP_IDENTIFY                        0x02
@@ -38,6 +68,7 @@
 #define LBP_NETWORK_DISCOVERY_ASYNC_REPLY   0x05
 #define LBP_STATUS_REQUEST                  0x06
 #define LBP_STATUS_REQUEST_ASYNC_REPLY      0x07
+#define LBP_WINDOW_SIZE                     0x08
 
 // Default replies
 #define LBP_IDENTIFY_CONTENT_0              0xB0 // identification code 0x000B, major version 0
@@ -47,9 +78,27 @@
 #define LBP_EXTENDED_IDENTIFY_CONTENT_1     0x00
 #define LBP_EXTENDED_IDENTIFY_NAME          "SRP V0.0 "
 
+#define LBP_WINDOW_SIZE_CONTENT             4    // amount of commands that may be in flight at once
+
+// the status reply may carry a friendly name of the state, up to this many ASCII characters
+#define LBP_STATE_NAME_SIZE                 16
+
+// link error counters, see lbp_read_errors(). They count since boot and stop at 255
+#define LBP_ERROR_UART                      0 // a received byte was lost or had no stop bit
+#define LBP_ERROR_CRC                       1 // a received frame was dropped for its crc
+#define LBP_ERROR_FRAME                     2 // a received frame was dropped for its length or for lack of a buffer
+#define LBP_ERROR_COUNT                     3
+
+// every command in the window needs a frame, which is reused for its reply. lbp_get_tx_buffer()
+// leaves that many frames alone, so there has to be at least one more for the application
+#if LBP_FRAME_COUNT <= LBP_WINDOW_SIZE_CONTENT || LBP_FRAME_COUNT > 8
+#error "LBP_FRAME_COUNT must be larger than the window size and at most 8"
+#endif
+
 // Macros to extract information from packets
 #define LBP_TYPE(packet) ((packet)->srcinfo & LBP_TYPE_MASK)
 #define LBP_SRC_ADDR(packet) ((packet)->srcinfo & LBP_ADDRESS_MASK)
+#define LBP_DEST_ADDR(packet) ((packet)->destinfo & LBP_ADDRESS_MASK)
 #define LBP_SEQNUM(packet) ((packet)->destinfo & LBP_SEQNUM_MASK)
 
 /**
@@ -67,12 +116,23 @@ typedef struct __attribute__((packed)) {
  */
 
 /**
- * Handle arbitrary synchronous packets. The function MUST call lbp_send_message() or lbp_discard_message().
+ * Handle arbitrary synchronous packets. This is called from lbp_poll(), so it may take its time.
+ * The function MUST call lbp_send_message() or lbp_discard_message().
  * Note that the reply address and packet type are already set. The only thing the application has to set is
  * the id and the data.
+ * reply points to the same buffer as packet: the reply is built in place and sent from the frame
+ * the command arrived in. Read what's needed from the packet data before overwriting it, an echo of the
+ * data needs no copying at all. The header already belongs to the reply, the address of the sender
+ * is LBP_DEST_ADDR(reply).
  */
 void lbp_handler(lbp_packet *packet, uint8_t data_length, lbp_packet *reply);
 
+/**
+ * Handle broadcasts of the messages from 0x10 on. These are never answered, the function MUST call
+ * lbp_discard_message(). Like lbp_handler() this is called from lbp_poll().
+ */
+void lbp_broadcast_handler(lbp_packet *packet, uint8_t data_length);
+
 /**
  * Should return nonzero when the rocket has encountered an error
  */
@@ -83,22 +143,79 @@ uint8_t lbp_state_error();
  */
 uint8_t lbp_state_armed();
 
+/**
+ * Should return nonzero when the rocket has a warning. An error takes precedence.
+ */
+uint8_t lbp_state_warning();
+
+/**
+ * Should write the name of the state into data, at most LBP_STATE_NAME_SIZE ASCII characters without
+ * a terminator, and return its length
+ */
+uint8_t lbp_state_name(uint8_t *data);
+
 /**
  * The following functions are the interface to the driver
  */
 
 /**
- * Initialize the peripheral and internal state
+ * Initialize the peripheral and internal state. baud_index selects the LBP_BAUD_* rate to start with,
+ * the link falls back to UART_BAUD if no valid frame arrives in time. Invalid values select UART_BAUD directly.
+ * address is the address of the board, see lbp_set_address().
+ */
+void init_lbp(uint8_t baud_index, uint8_t address);
+
+/**
+ * Set the address of the board, only its lower 6 bits are used. Frames to other addresses are dropped
+ * from then on, or forwarded in a relay build.
  */
-void init_lbp();
+void lbp_set_address(uint8_t address);
 
 /**
- * Acquire access to the tx buffer. This will return NULL when the reply buffer is in use.
+ * Select one of the LBP_BAUD_* baud rates. Returns zero if the index is invalid.
+ * When answering a command, call this after queuing the reply so the reply is still sent at the
+ * old rate. If no valid frame is received for LBP_BAUD_FALLBACK_TIMEOUT the link reverts to UART_BAUD.
+ */
+uint8_t lbp_set_baud(uint8_t index);
+
+/**
+ * Dispatch any complete frames in the rx queue. Call this regularly from the main loop,
+ * lbp_handler() is called from here and not from interrupt context.
+ */
+void lbp_poll();
+
+/**
+ * Returns nonzero when no frames are waiting to be sent or to be handled by lbp_poll().
+ * Low priority messages should only be queued then, so they never hold up a reply.
+ */
+uint8_t lbp_link_idle();
+
+/**
+ * Read the LBP_ERROR_* counters into data, a byte each. Returns LBP_ERROR_COUNT.
+ */
+uint8_t lbp_read_errors(uint8_t *data);
+
+/**
+ * Prepare the link for standby, see power.h: the start bit of the next byte wakes the board up and
+ * the byte is received as usual. Returns 0 if the transmitter is still busy, the board must not stop
+ * the clocks then. Call this with interrupts disabled.
+ */
+uint8_t lbp_suspend();
+
+/**
+ * Undo lbp_suspend() after the board woke up
+ */
+void lbp_resume();
+
+/**
+ * Acquire a frame for a message of the application. This will return NULL when a previously acquired
+ * buffer has not been sent or discarded yet, or when the frames left are needed for a window of commands.
  */
 lbp_packet *lbp_get_tx_buffer();
 
 /**
- * Send the current message in the tx buffer and revokes access to it.
+ * Queue the current message in the tx buffer for transmission and revokes access to it.
+ * Queued messages are sent in order.
  */
 void lbp_send_message(uint8_t data_length);
 
@@ -107,6 +224,11 @@ void lbp_send_message(uint8_t data_length);
  */
 void lbp_discard_message();
 
+/**
+ * Returns the crc of the link layer over length bytes of data, starting from crc
+ */
+uint8_t lbp_crc(const uint8_t *data, uint8_t length, uint8_t crc);
+
 
 
 #endif
@@ -0,0 +1,151 @@
+#include "logger.h"
+#include "actuators.h"
+
+/**
+ * EEPROM ring. Every write moves on to the next slot, so the wear is spread over the whole ring.
+ * The newest record is the one that isn't followed by its successor in sequence.
+ */
+static log_record EEMEM log_records[LOG_RECORD_COUNT];
+
+#define LOG_ERASED 0xFF
+
+/**
+ * Queue of records waiting to be written
+ */
+typedef struct {
+    uint8_t index;
+    uint8_t length;
+    log_record queue[LOG_QUEUE_SIZE];
+} log_queue_type;
+
+static log_queue_type log_queue;
+
+// slot the next record goes into and its sequence number
+static uint8_t log_head;
+static uint8_t log_sequence = LOG_SEQUENCE_FIRST;
+
+// progress of writing the record at the head of the queue, see update_logger()
+static uint8_t log_write_step;
+
+// time of the previous event, in milliseconds
+static uint32_t log_last_time;
+
+/**
+ * Returns nonzero if sequence belongs to a written record
+ */
+static uint8_t is_valid_sequence(uint8_t sequence) {
+    return sequence >= LOG_SEQUENCE_FIRST && sequence <= LOG_SEQUENCE_LAST;
+}
+
+/**
+ * Returns the sequence number that follows sequence
+ */
+static uint8_t next_sequence(uint8_t sequence) {
+    return sequence == LOG_SEQUENCE_LAST ? LOG_SEQUENCE_FIRST : sequence + 1;
+}
+
+/**
+ * Initialize the logger. This finds the newest record in the EEPROM ring.
+ */
+void init_logger() {
+    for (uint8_t i = 0; i < LOG_RECORD_COUNT; i++) {
+        uint8_t sequence = eeprom_read_byte(&log_records[i].sequence);
+        if (!is_valid_sequence(sequence)) {
+            continue;
+        }
+
+        uint8_t next = eeprom_read_byte(&log_records[(i + 1) % LOG_RECORD_COUNT].sequence);
+        if (next != next_sequence(sequence)) {
+            log_head = (i + 1) % LOG_RECORD_COUNT;
+            log_sequence = next_sequence(sequence);
+            break;
+        }
+    }
+
+    log_event(LOG_BOOT, MCUSR);
+    MCUSR = 0;
+}
+
+/**
+ * Queue an event for the log. This never blocks, if the queue is full the event is dropped.
+ * Only call this from the main loop.
+ */
+void log_event(uint8_t event, uint8_t data) {
+    if (log_queue.length == LOG_QUEUE_SIZE) {
+        return;
+    }
+
+    uint32_t now = get_millis();
+    uint32_t delta = now - log_last_time;
+    log_last_time = now;
+
+    log_record *record = log_queue.queue + ((log_queue.index + log_queue.length) % LOG_QUEUE_SIZE);
+    record->event = event;
+    record->data = data;
+    record->delta = delta > 0xFFFF ? 0xFFFF : delta;
+    log_queue.length++;
+}
+
+/**
+ * Write queued events to the EEPROM. Like update_eeprom() this starts at most one byte write per call
+ * and never waits for the EEPROM. Call it regularly from the main loop.
+ */
+void update_logger() {
+    while (log_queue.length) {
+        // a previous write is still in progress
+        if (!eeprom_is_ready()) {
+            return;
+        }
+
+        log_record *record = log_queue.queue + log_queue.index;
+        record->sequence = log_sequence;
+
+        // the sequence number is cleared first and written last, so a record that was
+        // interrupted by a reset reads back as an empty slot
+        uint8_t *address = (uint8_t *)(log_records + log_head);
+        uint8_t value;
+        if (log_write_step == 0) {
+            value = LOG_ERASED;
+        } else if (log_write_step < sizeof(log_record)) {
+            address += log_write_step;
+            value = ((uint8_t *)record)[log_write_step];
+        } else {
+            value = log_sequence;
+        }
+        log_write_step++;
+
+        uint8_t changed = eeprom_read_byte(address) != value;
+        if (changed) {
+            eeprom_write_byte(address, value);
+        }
+
+        // the record is complete
+        if (log_write_step > sizeof(log_record)) {
+            log_write_step = 0;
+            log_head = (log_head + 1) % LOG_RECORD_COUNT;
+            log_sequence = next_sequence(log_sequence);
+            log_queue.index = (log_queue.index + 1) % LOG_QUEUE_SIZE;
+            log_queue.length--;
+        }
+
+        if (changed) {
+            return;
+        }
+    }
+}
+
+/**
+ * Returns nonzero when every queued event has been written by update_logger()
+ */
+uint8_t is_log_written() {
+    return !log_queue.length;
+}
+
+/**
+ * Read a slot of the EEPROM ring. index 0 is the oldest slot, LOG_RECORD_COUNT - 1 the newest.
+ * Empty slots have a sequence number outside of LOG_SEQUENCE_FIRST..LOG_SEQUENCE_LAST.
+ * This busy waits if the EEPROM is still writing, check eeprom_is_ready() first to avoid that.
+ */
+void log_read(uint8_t index, log_record *record) {
+    eeprom_read_block(record, log_records + ((log_head + index) % LOG_RECORD_COUNT), sizeof(log_record));
+}
@@ -0,0 +1,77 @@
+#ifndef _LOGGER_H_
+#define _LOGGER_H_
+
+#include <avr/eeprom.h>
+#include "config.h"
+
+/**
+ * This file contains the interface to the flight event log. Events are queued in RAM and written
+ * into a ring of records in EEPROM in the background, so logging never blocks the flight loop.
+ */
+
+// amount of records in the EEPROM ring
+#define LOG_RECORD_COUNT    32
+
+// amount of records that can be waiting for update_logger(). Must be a power of two
+#define LOG_QUEUE_SIZE      8
+
+// record sequence numbers run from LOG_SEQUENCE_FIRST to LOG_SEQUENCE_LAST,
+// 0x00 and 0xFF mark an empty slot (zero filled eep file or erased EEPROM)
+#define LOG_SEQUENCE_FIRST  0x01
+#define LOG_SEQUENCE_LAST   0xFE
+
+// events, with the meaning of their data byte
+#define LOG_BOOT            0x01 // MCUSR reset flags
+#define LOG_STATE           0x02 // the state that was entered
+#define LOG_BREAKWIRE       0x03 // nonzero: connected
+#define LOG_VOTE            0x04 // nonzero: asserted
+#define LOG_BATTERY_MIN     0x05 // lowest battery value (8-bit ADC range) since launch
+#define LOG_DEPLOY          0x06 // LOG_DEPLOY_* flags
+#define LOG_PEER_VOTE       0x07 // the peer in the low nibble, its VOTE_* reason in the high nibble
+
+// LOG_DEPLOY flags
+#define LOG_DEPLOY_SERVO    0x01 // deployed with the servo, otherwise with the pyro
+#define LOG_DEPLOY_VOTE     0x02 // deployed on a vote, otherwise on the max deploy time
+#define LOG_DEPLOY_PEERS    0x04 // peer votes were part of the vote
+
+/**
+ * One entry in the log. delta is the time since the previous event in milliseconds,
+ * saturating at 0xFFFF. For LOG_BOOT it is the time since reset.
+ */
+typedef struct __attribute__((packed)) {
+    uint8_t  sequence;
+    uint8_t  event;
+    uint8_t  data;
+    uint16_t delta;
+} log_record;
+
+/**
+ * Initialize the logger. This finds the newest record in the EEPROM ring.
+ */
+void init_logger();
+
+/**
+ * Queue an event for the log. This never blocks, if the queue is full the event is dropped.
+ * Only call this from the main loop.
+ */
+void log_event(uint8_t event, uint8_t data);
+
+/**
+ * Write queued events to the EEPROM. Like update_eeprom() this starts at most one byte write per call
+ * and never waits for the EEPROM. Call it regularly from the main loop.
+ */
+void update_logger();
+
+/**
+ * Returns nonzero when every queued event has been written by update_logger()
+ */
+uint8_t is_log_written();
+
+/**
+ * Read a slot of the EEPROM ring. index 0 is the oldest slot, LOG_RECORD_COUNT - 1 the newest.
+ * Empty slots have a sequence number outside of LOG_SEQUENCE_FIRST..LOG_SEQUENCE_LAST.
+ * This busy waits if the EEPROM is still writing, check eeprom_is_ready() first to avoid that.
+ */
+void log_read(uint8_t index, log_record *record);
+
+#endif
@@ -3,6 +3,12 @@
 #include "actuators.h"
 #include "state_machine.h"
 #include "lbp.h"
+#include "events.h"
+#include "logger.h"
+#include "params.h"
+#include "scheduler.h"
+#include "profiling.h"
+#include "power.h"
 
 /**
  * Fuse config
@@ -15,6 +21,11 @@ FUSES = {
         
 };
 
+// implemented with the LBP message handler below
+static void update_log_download();
+static void update_telemetry(uint8_t events);
+static void update_self_test_report(uint8_t events);
+
 /**
  * Initialization routine. Called directly after boot with interrupts disabled
  */
@@ -23,24 +34,51 @@ void init() {
     CLKPR = 0; // Prescaler set to 1 -> CPU running at 7.3728 MHz
 
     // run all module initializers
-    init_actuators();
+    init_power();
     init_eeprom();
+    init_actuators();
+    init_logger();
     init_inputs();
     init_state_machine();
-    init_lbp();
+    init_lbp(config.lbp_baud_index, config.lbp_address);
+#if PROFILING
+    init_profiling();
+#endif
 }
 
 /**
- * Update routine. Called in a loop after the initialization routine has completed
+ * Update routine. Called in a loop after the initialization routine has completed.
+ * Sleeps until a timer tick, an input change or an lbp frame needs handling
  */
 void update() {
-    update_state_machine();
-    _delay_ms(10); // wait 10ms between successive state transitions
+    uint8_t events = wait_for_events();
+    PROFILE_BEGIN(PROFILE_LOOP);
+#if PROFILING
+    if (events & EVENT_TICK) {
+        // the counter restarted at 0 on the tick
+        PROFILE_LATENCY(PROFILE_LOOP_LATENCY, 0);
+    }
+#endif
+    lbp_poll();
+    update_log_download();
+    {
+        PROFILE_BEGIN(PROFILE_STATE_MACHINE);
+        update_state_machine(events);
+        PROFILE_END(PROFILE_STATE_MACHINE);
+    }
+    update_self_test_report(events);
+    update_telemetry(events);
+    update_eeprom();
+    update_logger();
+    PROFILE_END(PROFILE_LOOP);
+    // standby isn't part of the loop time
+    update_power(events);
 }
 
 /**
- * Program entry point
+ * Program entry point. The simulator in Software/sim drives init() and update() itself.
  */
+#ifndef SRP_HOST
 int main() {
     // make sure all interrupts are disabled
     ATOMIC(
@@ -51,182 +89,415 @@ int main() {
     }
     return 0;
 }
+#endif
 
 /**
  * Below is the implementation of the LBP message handler
  */
 
 /*
- * Definition of the message id's
+ * Definition of the message id's. The parameters in params.h are read with 0x10 + id
+ * and written with 0x20 + id.
  */
-#define LBP_GET_MIN_DEPLOY_TIME             0x10
-#define LBP_SET_MIN_DEPLOY_TIME             0x20
+#define LBP_GET_PARAMETER(id)               (0x10 | (id))
+#define LBP_SET_PARAMETER(id)               (0x20 | (id))
 
-#define LBP_GET_MAX_DEPLOY_TIME             0x11
-#define LBP_SET_MAX_DEPLOY_TIME             0x21
+// batch access
+#define LBP_GET_PARAMETERS                  0x30 // data: list of parameters, or the configuration, see get_parameters()
+#define LBP_PARAMETERS_FROM                 0x80
+#define LBP_SET_PARAMETERS                  0x31 // data: list of [parameter][size][value]
 
-#define LBP_GET_MEASURED_DEPLOY_TIME        0x12
+// discovery of the parameter table
+#define LBP_GET_PARAMETER_INFO              0x32 // data: parameter, see param_info(). Empty: PARAM_COUNT
 
-#define LBP_GET_BATTERY_VOLTAGE             0x13
+// telemetry subscription
+#define LBP_SET_TELEMETRY                   0x33 // data: rate in Hz, 0 to stop. Packets are async with this id
+#define TELEMETRY_MAX_RATE                  50
 
-#define LBP_GET_BATTERY_EMPTY_LIMIT         0x14
-#define LBP_SET_BATTERY_EMPTY_LIMIT         0x24
+#define LBP_GET_LOG                         0x34 // the records follow as async frames with the same id
 
-#define LBP_GET_DEPLOY_MODE                 0x15
-#define LBP_SET_DEPLOY_MODE                 0x25
+// instrumentation, only in a PROFILING build. Empty: [section count][counter count][counters], see profiling.h
+#define LBP_GET_DIAGNOSTICS                 0x35 // data: section for its statistics, or DIAGNOSTICS_RESET
+#define DIAGNOSTICS_RESET                   0xFF
 
-#define LBP_GET_SERVO_CLOSED_POSITION       0x16
-#define LBP_SET_SERVO_CLOSED_POSITION       0x26
+// pre-flight self-test, see test.h. Empty: the report of the last test. The report of a started
+// test follows as an async frame with the same id once it is done
+#define LBP_SELF_TEST                       0x36 // data: SELF_TEST_START
+#define SELF_TEST_START                     1
 
-#define LBP_GET_SERVO_OPEN_POSITION         0x17
-#define LBP_SET_SERVO_OPEN_POSITION         0x27
+// deploy vote of a peer board, broadcast only, see vote.h
+#define LBP_DEPLOY_VOTE                     0x37 // data: [voter address][VOTE_* reason]
 
-#define LBP_SET_SERVO_POSITION              0x28
+// everything a pad display polls for in one reply, see get_status()
+#define LBP_GET_STATUS                      0x38
+#define STATUS_SIZE                         12 // without the name of the state
+#if STATUS_SIZE + LBP_STATE_NAME_SIZE > LBP_BUFFER_SIZE - 3
+#error "the status with the name of the state doesn't fit in a packet"
+#endif
 
-#define LBP_GET_ADDRESS                     0x19
-#define LBP_SET_ADDRESS                     0x29
+// amount of log records per async frame, behind the index of the first one
+#define LOG_RECORDS_PER_FRAME               5
 
 /**
- * LBP message handler
+ * State of a log download. The log is streamed from the main loop as the tx queue has room.
  */
-void lbp_handler(lbp_packet *packet, uint8_t data_length, lbp_packet *reply) {
-    reply->id = packet->id;
+#define LOG_DOWNLOAD_IDLE                   0xFF
 
-    uint16_t temp;
+static uint8_t log_download_index = LOG_DOWNLOAD_IDLE;
+static uint8_t log_download_address;
 
-    if (packet->id >= 0x20) {
-        // all setters
-        switch (packet->id) {
-            case LBP_SET_MIN_DEPLOY_TIME:
-                if (data_length != 2) {
-                    break;
-                }
-                temp = ((uint16_t)packet->data[1]) << 8 | packet->data[0];
-                eeprom_write(&min_deploy_time, temp);
-                reply->data[0] = packet->data[0];
-                reply->data[1] = packet->data[1];
-                lbp_send_message(2);
-                return;
+/**
+ * Send the next frames of a log download, as far as the tx queue allows
+ */
+static void update_log_download() {
+    while (log_download_index != LOG_DOWNLOAD_IDLE) {
+        // don't block on a pending log or config write
+        if (!eeprom_is_ready()) {
+            return;
+        }
 
-            case LBP_SET_MAX_DEPLOY_TIME:
-                if (data_length != 2) {
-                    break;
-                }
-                temp = ((uint16_t)packet->data[1]) << 8 | packet->data[0];
-                eeprom_write(&max_deploy_time, temp);
-                reply->data[0] = packet->data[0];
-                reply->data[1] = packet->data[1];
-                lbp_send_message(2);
-                return;
+        lbp_packet *packet = lbp_get_tx_buffer();
+        if (!packet) {
+            return;
+        }
 
-            case LBP_SET_BATTERY_EMPTY_LIMIT:
-                if (data_length != 1) {
-                    break;
-                }
-                eeprom_write(&battery_empty_limit, packet->data[0]);
-                reply->data[0] = packet->data[0];
-                lbp_send_message(1);
-                return;
+        packet->srcinfo |= LBP_ASYNC;
+        packet->destinfo = log_download_address;
+        packet->id = LBP_GET_LOG;
+        packet->data[0] = log_download_index;
 
-            case LBP_SET_DEPLOY_MODE:
-                if (data_length != 1) {
-                    break;
-                }
-                eeprom_write(&use_servo, packet->data[0]);
-                reply->data[0] = packet->data[0];
-                lbp_send_message(1);
-                return;
+        uint8_t length = 1;
+        for (uint8_t i = 0; i < LOG_RECORDS_PER_FRAME && log_download_index < LOG_RECORD_COUNT; i++) {
+            log_read(log_download_index++, (log_record *)(packet->data + length));
+            length += sizeof(log_record);
+        }
+        lbp_send_message(length);
 
-            case LBP_SET_SERVO_CLOSED_POSITION:
-                if (data_length != 1) {
-                    break;
-                }
-                eeprom_write(&servo_closed_position, packet->data[0]);
-                reply->data[0] = packet->data[0];
-                lbp_send_message(1);
-                return;
+        if (log_download_index == LOG_RECORD_COUNT) {
+            log_download_index = LOG_DOWNLOAD_IDLE;
+        }
+    }
+}
 
-            case LBP_SET_SERVO_OPEN_POSITION:
-                if (data_length != 1) {
-                    break;
-                }
-                eeprom_write(&servo_open_position, packet->data[0]);
-                reply->data[0] = packet->data[0];
-                lbp_send_message(1);
-                return;
+/**
+ * State of the self-test report, sent to whoever started the test
+ */
+static uint8_t self_test_due;
+static uint8_t self_test_address;
 
-            case LBP_SET_SERVO_POSITION:
-                if (data_length != 1) {
-                    break;
-                }
-                set_servo_position(packet->data[0]);
-                reply->data[0] = packet->data[0];
-                lbp_send_message(1);
-                return;
+/**
+ * Run the self-test and send its report once it is done
+ */
+static void update_self_test_report(uint8_t events) {
+    if (update_self_test(events)) {
+        self_test_due = 1;
+    }
+    if (!self_test_due) {
+        return;
+    }
 
-            case LBP_SET_ADDRESS:
-                if (data_length != 1) {
-                    break;
-                }
-                eeprom_write(&lbp_address, packet->data[0]);
-                reply->data[0] = packet->data[0];
-                lbp_send_message(1);
-                return;
+    lbp_packet *packet = lbp_get_tx_buffer();
+    if (!packet) {
+        return;
+    }
+    self_test_due = 0;
+
+    packet->srcinfo |= LBP_ASYNC;
+    packet->destinfo = self_test_address;
+    packet->id = LBP_SELF_TEST;
+    lbp_send_message(self_test_report(packet->data));
+}
+
+/**
+ * State of the telemetry subscription
+ */
+static uint8_t telemetry_task = TASK_NONE; // scheduler task that posts EVENT_TELEMETRY, TASK_NONE when nobody is subscribed
+static uint8_t telemetry_due;
+static uint8_t telemetry_address;
+
+static void telemetry_tick() {
+    post_event(EVENT_TELEMETRY);
+}
+
+/**
+ * Push a telemetry packet when one is due: [state][inputs][battery (2)][flight time in ms (4)][buzzer pattern]
+ * Telemetry is low priority, it is only queued when there is no other lbp traffic.
+ * Packets that are due while the link is busy are merged into one.
+ */
+static void update_telemetry(uint8_t events) {
+    if (events & EVENT_TELEMETRY) {
+        telemetry_due = 1;
+    }
+    if (!telemetry_due || !lbp_link_idle()) {
+        return;
+    }
+
+    lbp_packet *packet = lbp_get_tx_buffer();
+    if (!packet) {
+        return;
+    }
+    telemetry_due = 0;
+
+    packet->srcinfo |= LBP_ASYNC;
+    packet->destinfo = telemetry_address;
+    packet->id = LBP_SET_TELEMETRY;
+
+    uint16_t battery = get_battery_value_precise();
+    uint32_t flight_time = get_flight_time();
+    packet->data[0] = get_flight_state();
+    packet->data[1] = get_inputs();
+    packet->data[2] = battery & 0xFF;
+    packet->data[3] = battery >> 8;
+    for (uint8_t i = 0; i < 4; i++) {
+        packet->data[4 + i] = flight_time & 0xFF;
+        flight_time >>= 8;
+    }
+    packet->data[8] = get_buzzer_pattern();
+    lbp_send_message(9);
+}
+
+/**
+ * Build the reply to LBP_GET_STATUS into data and return its length: [state][inputs][battery (2)]
+ * [WARNING_* flags][LBP_ERROR_* counters (3)][uptime in ms (4)][name of the state]
+ */
+static uint8_t get_status(uint8_t *data) {
+    uint16_t battery = get_battery_value_precise();
+    uint32_t uptime = get_millis();
+    data[0] = get_flight_state();
+    data[1] = get_inputs();
+    data[2] = battery & 0xFF;
+    data[3] = battery >> 8;
+    data[4] = get_warnings();
+    lbp_read_errors(data + 5);
+    for (uint8_t i = 0; i < 4; i++) {
+        data[8 + i] = uptime & 0xFF;
+        uptime >>= 8;
+    }
+    return STATUS_SIZE + lbp_state_name(data + STATUS_SIZE);
+}
+
+/**
+ * Build the reply to LBP_GET_PARAMETERS into reply and its length into length. Returns 0 if a parameter
+ * can't be read or the values don't fit in one packet. ids and reply may be the same buffer.
+ * An empty list, or a single LBP_PARAMETERS_FROM | id, is the configuration from id on: as much of it as
+ * fits, the host asks again from the id after the last one it got until the reply is empty.
+ */
+static uint8_t get_parameters(uint8_t *ids, uint8_t count, uint8_t *reply, uint8_t *length) {
+    *length = 0;
+
+    // the reply grows faster than the list is read
+    uint8_t list[LBP_BUFFER_SIZE - 3];
+    for (uint8_t i = 0; i < count; i++) {
+        list[i] = ids[i];
+    }
+
+    // the configuration instead of a list
+    uint8_t all = !count || (count == 1 && (list[0] & LBP_PARAMETERS_FROM));
+    uint8_t first = 0;
+    if (all) {
+        first = count ? list[0] & ~LBP_PARAMETERS_FROM : 0;
+        count = first < PARAM_COUNT ? PARAM_COUNT - first : 0;
+    }
+
+    for (uint8_t i = 0; i < count; i++) {
+        uint8_t id = all ? first + i : list[i];
+        if (all && (param_flags(id) & (PARAM_CONFIG | PARAM_WRITE)) != (PARAM_CONFIG | PARAM_WRITE)) {
+            continue;
         }
-    } else if (!data_length) {
-        // getters
-        switch (packet->id) {
-            case LBP_GET_MIN_DEPLOY_TIME:
-                temp = eeprom_read(&min_deploy_time);
-                reply->data[1] = temp >> 8;
-                reply->data[0] = temp & 0xFF;
-                lbp_send_message(2);
-                return;
 
-            case LBP_GET_MAX_DEPLOY_TIME:
-                temp = eeprom_read(&max_deploy_time);
-                reply->data[1] = temp >> 8;
-                reply->data[0] = temp & 0xFF;
-                lbp_send_message(2);
-                return;
+        // room for the id, the size and the largest value
+        if (*length + 4 > LBP_BUFFER_SIZE - 3) {
+            return all;
+        }
 
-            case LBP_GET_MEASURED_DEPLOY_TIME:
-                temp = eeprom_read(&last_logged_deploy_time);
-                reply->data[1] = temp >> 8;
-                reply->data[0] = temp & 0xFF;
-                lbp_send_message(2);
-                return;
+        uint8_t size = param_get(id, reply + *length + 2);
+        if (!size) {
+            return 0;
+        }
+        reply[*length] = id;
+        reply[*length + 1] = size;
+        *length += size + 2;
+    }
+    return 1;
+}
 
-            case LBP_GET_BATTERY_VOLTAGE:
-                reply->data[0] = get_battery_value();
-                lbp_send_message(1);
-                return;
+/**
+ * Check a LBP_SET_PARAMETERS list. Returns nonzero if every entry is valid.
+ */
+static uint8_t check_parameters(uint8_t *data, uint8_t length) {
+    uint8_t i = 0;
+    while (i < length) {
+        if (i + 2 > length || i + 2 + data[i + 1] > length) {
+            return 0;
+        }
+        if (!param_check(data[i], data + i + 2, data[i + 1])) {
+            return 0;
+        }
+        i += data[i + 1] + 2;
+    }
+    return 1;
+}
 
-            case LBP_GET_BATTERY_EMPTY_LIMIT:
-                reply->data[0] = eeprom_read(&battery_empty_limit);
-                lbp_send_message(1);
-                return;
+/**
+ * LBP broadcast handler
+ */
+void lbp_broadcast_handler(lbp_packet *packet, uint8_t data_length) {
+    if (packet->id == LBP_DEPLOY_VOTE && data_length == 2) {
+        receive_vote(packet->data[0], packet->data[1]);
+    }
+    lbp_discard_message();
+}
 
-            case LBP_GET_DEPLOY_MODE:
-                reply->data[0] = eeprom_read(&use_servo);
-                lbp_send_message(1);
-                return;
+/**
+ * LBP message handler
+ */
+void lbp_handler(lbp_packet *packet, uint8_t data_length, lbp_packet *reply) {
+    reply->id = packet->id;
 
-            case LBP_GET_SERVO_CLOSED_POSITION:
-                reply->data[0] = eeprom_read(&servo_closed_position);
+    uint8_t id = packet->id & 0x0F;
+    uint8_t length;
+
+    switch (packet->id) {
+        case LBP_GET_PARAMETERS:
+            if (!get_parameters(packet->data, data_length, reply->data, &length)) {
+                break;
+            }
+            lbp_send_message(length);
+            return;
+
+        case LBP_SET_PARAMETERS: {
+            // nothing is changed unless every entry is valid
+            if (!check_parameters(packet->data, data_length)) {
+                break;
+            }
+            for (uint8_t i = 0; i < data_length; i += packet->data[i + 1] + 2) {
+                param_set(packet->data[i], packet->data + i + 2);
+            }
+            // the request is the ack. The frame may be reused once it's sent, so keep the values
+            // that still have to be applied
+            uint8_t values[LBP_BUFFER_SIZE - 3];
+            for (uint8_t i = 0; i < data_length; i++) {
+                values[i] = packet->data[i];
+            }
+            lbp_send_message(data_length);
+            for (uint8_t i = 0; i < data_length; i += values[i + 1] + 2) {
+                param_apply(values[i], values + i + 2);
+            }
+            return;
+        }
+
+        case LBP_GET_PARAMETER_INFO:
+            if (!data_length) {
+                reply->data[0] = PARAM_COUNT;
                 lbp_send_message(1);
                 return;
-
-            case LBP_GET_SERVO_OPEN_POSITION:
-                reply->data[0] = eeprom_read(&servo_open_position);
+            }
+            length = param_info(packet->data[0], reply->data);
+            if (data_length != 1 || !length) {
+                break;
+            }
+            lbp_send_message(length);
+            return;
+
+        case LBP_SET_TELEMETRY:
+            if (data_length != 1 || packet->data[0] > TELEMETRY_MAX_RATE) {
+                break;
+            }
+            cancel_task(telemetry_task);
+            telemetry_task = TASK_NONE;
+            telemetry_due = 0;
+            if (packet->data[0]) {
+                telemetry_task = schedule_task(telemetry_tick, get_time(), TIME_COUNTS_PER_SECOND / packet->data[0], PRIORITY_NORMAL);
+                if (telemetry_task == TASK_NONE) {
+                    break;
+                }
+            }
+            telemetry_address = LBP_DEST_ADDR(reply);
+            // the request is the ack
+            lbp_send_message(1);
+            return;
+
+        case LBP_GET_LOG:
+            if (data_length) {
+                break;
+            }
+            // reply with the amount of records, then stream them oldest first
+            log_download_index = 0;
+            log_download_address = LBP_DEST_ADDR(reply);
+            reply->data[0] = LOG_RECORD_COUNT;
+            lbp_send_message(1);
+            return;
+
+        case LBP_SELF_TEST:
+            if (data_length == 1 && packet->data[0] == SELF_TEST_START) {
+                // refused outside of IDLE and while a test is running
+                if (!self_test_start()) {
+                    break;
+                }
+                self_test_address = LBP_DEST_ADDR(reply);
+            } else if (data_length) {
+                break;
+            }
+            lbp_send_message(self_test_report(reply->data));
+            return;
+
+        case LBP_GET_STATUS:
+            if (data_length) {
+                break;
+            }
+            lbp_send_message(get_status(reply->data));
+            return;
+
+#if PROFILING
+        case LBP_GET_DIAGNOSTICS:
+            if (!data_length) {
+                reply->data[0] = PROFILE_SECTION_COUNT;
+                reply->data[1] = PROFILE_COUNTER_COUNT;
+                lbp_send_message(2 + profile_read_counters(reply->data + 2));
+                return;
+            }
+            if (data_length != 1) {
+                break;
+            }
+            if (packet->data[0] == DIAGNOSTICS_RESET) {
+                profile_reset();
+                // the request is the ack
                 lbp_send_message(1);
                 return;
+            }
+            length = profile_read(packet->data[0], reply->data);
+            if (!length) {
+                break;
+            }
+            lbp_send_message(length);
+            return;
+#endif
+
+        default:
+            if (packet->id == LBP_SET_PARAMETER(id)) {
+                // all setters
+                if (!param_check(id, packet->data, data_length)) {
+                    break;
+                }
+                param_set(id, packet->data);
+                // the request is the ack. The frame may be reused once it's sent, keep the value
+                uint8_t value[2];
+                value[0] = packet->data[0];
+                value[1] = packet->data[1];
+                lbp_send_message(data_length);
+                param_apply(id, value);
+                return;
 
-            case LBP_GET_ADDRESS:
-                reply->data[0] = eeprom_read(&lbp_address);
-                lbp_send_message(1);
+            } else if (packet->id == LBP_GET_PARAMETER(id) && !data_length) {
+                // getters
+                length = param_get(id, reply->data);
+                if (!length) {
+                    break;
+                }
+                lbp_send_message(length);
                 return;
-        }
+            }
+            break;
     }
     reply->id = LBP_NACK;
     lbp_send_message(0);
@@ -0,0 +1,221 @@
+#include "params.h"
+#include <avr/pgmspace.h>
+#include <string.h>
+#include "eeprom.h"
+#include "inputs.h"
+#include "actuators.h"
+#include "lbp.h"
+#include "vote.h"
+
+/**
+ * Accessors for the parameters that aren't plain configuration values
+ */
+static uint16_t get_battery_voltage() {
+    return get_battery_value();
+}
+
+static uint16_t get_battery_voltage_precise() {
+    return get_battery_value_precise();
+}
+
+static void apply_servo_position(uint16_t value) {
+    set_servo_position(value);
+}
+
+static void apply_baud_rate(uint16_t value) {
+    // the ack still goes out at the old rate
+    lbp_set_baud(value);
+}
+
+static void apply_address(uint16_t value) {
+    // the ack is already on its way, it doesn't go through the filter
+    lbp_set_address(value);
+}
+
+/**
+ * Parameter names, these are the keys used by the configure tool
+ */
+#define PARAM_NAME(name) static const char param_name_##name[] PROGMEM = #name
+
+PARAM_NAME(min_deploy_time);
+PARAM_NAME(max_deploy_time);
+PARAM_NAME(measured_deploy_time);
+PARAM_NAME(battery_voltage);
+PARAM_NAME(battery_empty_limit);
+PARAM_NAME(deploy_mode);
+PARAM_NAME(servo_closed_position);
+PARAM_NAME(servo_open_position);
+PARAM_NAME(servo_position);
+PARAM_NAME(address);
+PARAM_NAME(baud_rate);
+PARAM_NAME(battery_voltage_precise);
+PARAM_NAME(servo_output);
+PARAM_NAME(servo_min_pulse);
+PARAM_NAME(servo_max_pulse);
+PARAM_NAME(servo_slew);
+PARAM_NAME(vote_peers);
+PARAM_NAME(vote_quorum);
+
+// a value in config
+#define CONFIG_PARAM(name, member, min, max, flags) \
+    {&config.member, NULL, NULL, min, max, \
+     (flags) | PARAM_CONFIG | (sizeof(config.member) == 2 ? PARAM_WIDE : 0), param_name_##name}
+
+// a value that is read through a function
+#define GETTER_PARAM(name, get, flags) \
+    {NULL, get, NULL, 0, 0, (flags) | PARAM_READ, param_name_##name}
+
+/**
+ * The parameter table, indexed by id
+ */
+static const param_descriptor param_table[PARAM_COUNT] PROGMEM = {
+    CONFIG_PARAM(min_deploy_time, min_deploy_time, 0, 0xFFFF, PARAM_READ | PARAM_WRITE | PARAM_LIVE),
+    CONFIG_PARAM(max_deploy_time, max_deploy_time, 0, 0xFFFF, PARAM_READ | PARAM_WRITE | PARAM_LIVE),
+    CONFIG_PARAM(measured_deploy_time, last_logged_deploy_time, 0, 0xFFFF, PARAM_READ),
+    GETTER_PARAM(battery_voltage, get_battery_voltage, 0),
+    CONFIG_PARAM(battery_empty_limit, battery_empty_limit, 0, 0xFF, PARAM_READ | PARAM_WRITE | PARAM_LIVE),
+    CONFIG_PARAM(deploy_mode, use_servo, 0, 1, PARAM_READ | PARAM_WRITE | PARAM_LIVE),
+    // the servo only moves to the closed position at startup
+    CONFIG_PARAM(servo_closed_position, servo_closed_position, 0, 0xFF, PARAM_READ | PARAM_WRITE),
+    CONFIG_PARAM(servo_open_position, servo_open_position, 0, 0xFF, PARAM_READ | PARAM_WRITE | PARAM_LIVE),
+    {NULL, NULL, apply_servo_position, 0, 0xFF, PARAM_WRITE | PARAM_LIVE, param_name_servo_position},
+    {&config.lbp_address, NULL, apply_address, 0, LBP_ADDRESS_MASK,
+     PARAM_READ | PARAM_WRITE | PARAM_CONFIG | PARAM_LIVE, param_name_address},
+    {&config.lbp_baud_index, NULL, apply_baud_rate, 0, LBP_BAUD_COUNT - 1,
+     PARAM_READ | PARAM_WRITE | PARAM_CONFIG | PARAM_LIVE, param_name_baud_rate},
+    GETTER_PARAM(battery_voltage_precise, get_battery_voltage_precise, PARAM_WIDE),
+    // the output is set up at startup
+    CONFIG_PARAM(servo_output, servo_output, 0, SERVO_OUTPUT_COUNT - 1, PARAM_READ | PARAM_WRITE),
+    CONFIG_PARAM(servo_min_pulse, servo_min_pulse, SERVO_PULSE_MIN, SERVO_PULSE_MAX, PARAM_READ | PARAM_WRITE | PARAM_LIVE),
+    CONFIG_PARAM(servo_max_pulse, servo_max_pulse, SERVO_PULSE_MIN, SERVO_PULSE_MAX, PARAM_READ | PARAM_WRITE | PARAM_LIVE),
+    CONFIG_PARAM(servo_slew, servo_slew, 0, 0xFF, PARAM_READ | PARAM_WRITE | PARAM_LIVE),
+    // both are part of the deploy plan, which is made at launch
+    CONFIG_PARAM(vote_peers, vote_peers, 0, (1 << VOTE_PEER_COUNT) - 1, PARAM_READ | PARAM_WRITE | PARAM_LIVE),
+    CONFIG_PARAM(vote_quorum, vote_quorum, 1, VOTE_PEER_COUNT + 1, PARAM_READ | PARAM_WRITE | PARAM_LIVE),
+};
+
+/**
+ * Copy the descriptor of parameter id from PROGMEM. Returns its flags, 0 if there is no such parameter.
+ */
+uint8_t param_read_descriptor(uint8_t id, param_descriptor *descriptor) {
+    if (id >= PARAM_COUNT) {
+        return 0;
+    }
+    memcpy_P(descriptor, param_table + id, sizeof(param_descriptor));
+    return descriptor->flags;
+}
+
+/**
+ * Returns the PARAM_* flags of parameter id, 0 if there is no such parameter
+ */
+uint8_t param_flags(uint8_t id) {
+    if (id >= PARAM_COUNT) {
+        return 0;
+    }
+    return pgm_read_byte(&param_table[id].flags);
+}
+
+/**
+ * Returns the value in data, which has the size of parameter descriptor
+ */
+static uint16_t decode_value(param_descriptor *descriptor, uint8_t *data) {
+    uint16_t value = data[0];
+    if (descriptor->flags & PARAM_WIDE) {
+        value |= ((uint16_t)data[1]) << 8;
+    }
+    return value;
+}
+
+/**
+ * Read parameter id into data (little endian). Returns the size of the value, or 0 if it can't be read.
+ */
+uint8_t param_get(uint8_t id, uint8_t *data) {
+    param_descriptor descriptor;
+    if (!(param_read_descriptor(id, &descriptor) & PARAM_READ)) {
+        return 0;
+    }
+
+    uint16_t value;
+    if (descriptor.get) {
+        value = descriptor.get();
+    } else if (descriptor.flags & PARAM_WIDE) {
+        value = *(uint16_t *)descriptor.value;
+    } else {
+        value = *(uint8_t *)descriptor.value;
+    }
+
+    data[0] = value & 0xFF;
+    if (descriptor.flags & PARAM_WIDE) {
+        data[1] = value >> 8;
+        return 2;
+    }
+    return 1;
+}
+
+/**
+ * Check that data is a valid value for parameter id. Returns nonzero if param_set() would accept it.
+ */
+uint8_t param_check(uint8_t id, uint8_t *data, uint8_t length) {
+    param_descriptor descriptor;
+    if (!(param_read_descriptor(id, &descriptor) & PARAM_WRITE)) {
+        return 0;
+    }
+    if (length != ((descriptor.flags & PARAM_WIDE) ? 2 : 1)) {
+        return 0;
+    }
+
+    uint16_t value = decode_value(&descriptor, data);
+    return value >= descriptor.min && value <= descriptor.max;
+}
+
+/**
+ * Store a value that passed param_check() for parameter id. Parameters that can't be written are ignored.
+ */
+void param_set(uint8_t id, uint8_t *data) {
+    param_descriptor descriptor;
+    if (!(param_read_descriptor(id, &descriptor) & PARAM_WRITE) || !descriptor.value) {
+        return;
+    }
+
+    if (descriptor.flags & PARAM_WIDE) {
+        config_write((uint16_t *)descriptor.value, decode_value(&descriptor, data));
+    } else {
+        config_write((uint8_t *)descriptor.value, data[0]);
+    }
+}
+
+/**
+ * Perform the side effects of a new value for parameter id, once the reply to the command has been queued.
+ */
+void param_apply(uint8_t id, uint8_t *data) {
+    param_descriptor descriptor;
+    if (!(param_read_descriptor(id, &descriptor) & PARAM_WRITE)) {
+        return;
+    }
+    if (descriptor.apply) {
+        descriptor.apply(decode_value(&descriptor, data));
+    }
+}
+
+/**
+ * Describe parameter id for discovery by the host: [id][flags][min (2)][max (2)][name]
+ * Returns the length, or 0 if there is no such parameter.
+ */
+uint8_t param_info(uint8_t id, uint8_t *data) {
+    param_descriptor descriptor;
+    if (!param_read_descriptor(id, &descriptor)) {
+        return 0;
+    }
+
+    data[0] = id;
+    data[1] = descriptor.flags;
+    data[2] = descriptor.min & 0xFF;
+    data[3] = descriptor.min >> 8;
+    data[4] = descriptor.max & 0xFF;
+    data[5] = descriptor.max >> 8;
+
+    // the name isn't terminated, it ends with the packet
+    uint8_t length = strlen_P(descriptor.name);
+    memcpy_P(data + 6, descriptor.name, length);
+    return length + 6;
+}
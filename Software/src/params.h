@@ -0,0 +1,89 @@
+#ifndef _PARAMS_H_
+#define _PARAMS_H_
+
+#include "config.h"
+
+/**
+ * This file contains the interface to the parameter table. Every value that can be read or written
+ * over LBP is described by one entry in PROGMEM, the lbp getters, setters and batch messages as well
+ * as the configuration commits are driven by it. Adding a stored parameter means adding its config
+ * member and default in eeprom.h/eeprom.cpp, a new CONFIG_VERSION and one entry in params.cpp.
+ */
+
+// parameter id's. The lbp getter is 0x10 + id, the setter 0x20 + id. From 0x10 on there are no single
+// getters and setters, these parameters are only accessed with the batch messages
+#define PARAM_MIN_DEPLOY_TIME           0x00
+#define PARAM_MAX_DEPLOY_TIME           0x01
+#define PARAM_MEASURED_DEPLOY_TIME      0x02
+#define PARAM_BATTERY_VOLTAGE           0x03
+#define PARAM_BATTERY_EMPTY_LIMIT       0x04
+#define PARAM_DEPLOY_MODE               0x05
+#define PARAM_SERVO_CLOSED_POSITION     0x06
+#define PARAM_SERVO_OPEN_POSITION       0x07
+#define PARAM_SERVO_POSITION            0x08
+#define PARAM_ADDRESS                   0x09
+#define PARAM_BAUD_RATE                 0x0A
+#define PARAM_BATTERY_VOLTAGE_PRECISE   0x0B
+#define PARAM_SERVO_OUTPUT              0x0C
+#define PARAM_SERVO_MIN_PULSE           0x0D
+#define PARAM_SERVO_MAX_PULSE           0x0E
+#define PARAM_SERVO_SLEW                0x0F
+#define PARAM_VOTE_PEERS                0x10
+#define PARAM_VOTE_QUORUM               0x11
+#define PARAM_COUNT                     0x12
+
+// parameter flags
+#define PARAM_READ      0x01 // can be read
+#define PARAM_WRITE     0x02 // can be written
+#define PARAM_CONFIG    0x04 // a member of config, stored in EEPROM
+#define PARAM_LIVE      0x08 // a new value takes effect right away, otherwise only after a reset
+#define PARAM_WIDE      0x10 // 16-bit value, otherwise 8-bit
+
+/**
+ * Parameter descriptor
+ */
+typedef struct {
+    void *value;                    // member of config, NULL if the value is read through get
+    uint16_t (*get)();              // reads a value that isn't in config
+    void (*apply)(uint16_t value);  // side effect of a new value, called once the ack is queued
+    uint16_t min;
+    uint16_t max;
+    uint8_t flags;                  // PARAM_* flags, 0 for unused id's
+    const char *name;               // in PROGMEM
+} param_descriptor;
+
+/**
+ * Copy the descriptor of parameter id from PROGMEM. Returns its flags, 0 if there is no such parameter.
+ */
+uint8_t param_read_descriptor(uint8_t id, param_descriptor *descriptor);
+
+/**
+ * Returns the PARAM_* flags of parameter id, 0 if there is no such parameter
+ */
+uint8_t param_flags(uint8_t id);
+
+/**
+ * Read parameter id into data (little endian). Returns the size of the value, or 0 if it can't be read.
+ */
+uint8_t param_get(uint8_t id, uint8_t *data);
+
+/**
+ * Check that data is a valid value for parameter id. Returns nonzero if param_set() would accept it.
+ */
+uint8_t param_check(uint8_t id, uint8_t *data, uint8_t length);
+
+/**
+ * Store a value that passed param_check() for parameter id. Settings that need more than storing the value
+ * (moving the servo, changing the baud rate) happen in param_apply(), which should be called once the reply
+ * to the command has been queued.
+ */
+void param_set(uint8_t id, uint8_t *data);
+void param_apply(uint8_t id, uint8_t *data);
+
+/**
+ * Describe parameter id for discovery by the host: [id][flags][min (2)][max (2)][name]
+ * Returns the length, or 0 if there is no such parameter.
+ */
+uint8_t param_info(uint8_t id, uint8_t *data);
+
+#endif
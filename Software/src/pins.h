@@ -0,0 +1,88 @@
+#ifndef _PINS_H_
+#define _PINS_H_
+
+#include <avr/io.h>
+#include <stdint.h>
+
+/**
+ * This file contains the pin types the pin map in config.h is made of. A pin is a type, Pin<port, bit>,
+ * with only static inline functions, so every access has a constant register and a constant mask.
+ * The port registers of the ATtiny1634 are in the bit addressable I/O space, so set(), clear(),
+ * input() and output() compile to a single sbi or cbi, and read() to an in and an andi or a sbic
+ * in a condition. These are atomic, unlike a read-modify-write of the whole port, so they are safe
+ * to use from the interrupt handlers next to the main loop without an atomic section.
+ *
+ * In a SRP_HOST build the same code runs on the registers Software/sim simulates.
+ */
+
+// a port of the ATtiny1634, the registers of a Pin
+#define PIN_PORT(name, letter) \
+    struct name { \
+        static inline volatile uint8_t &pin() { return PIN##letter; } \
+        static inline volatile uint8_t &ddr() { return DDR##letter; } \
+        static inline volatile uint8_t &port() { return PORT##letter; } \
+        static inline volatile uint8_t &pue() { return PUE##letter; } \
+    }
+
+PIN_PORT(PortA, A);
+PIN_PORT(PortB, B);
+PIN_PORT(PortC, C);
+
+template <typename Port, uint8_t bit>
+struct Pin {
+    enum { mask = 1 << bit };
+
+    static inline void output() {
+        Port::ddr() |= mask;
+    }
+
+    static inline void input() {
+        Port::ddr() &= ~mask;
+    }
+
+    static inline void pullup(uint8_t enabled) {
+        if (enabled) {
+            Port::pue() |= mask;
+        } else {
+            Port::pue() &= ~mask;
+        }
+    }
+
+    static inline void set() {
+        Port::port() |= mask;
+    }
+
+    static inline void clear() {
+        Port::port() &= ~mask;
+    }
+
+    /**
+     * Drive the pin to value. A constant value is the same as set() or clear(), otherwise it is
+     * a branch to one of them.
+     */
+    static inline void write(uint8_t value) {
+        if (value) {
+            set();
+        } else {
+            clear();
+        }
+    }
+
+    static inline void toggle() {
+#ifdef SRP_HOST
+        Port::port() ^= mask;
+#else
+        // writing a one to PINx toggles PORTx
+        Port::pin() = mask;
+#endif
+    }
+
+    /**
+     * Returns nonzero if the pin is high
+     */
+    static inline uint8_t read() {
+        return Port::pin() & mask;
+    }
+};
+
+#endif
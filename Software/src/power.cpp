@@ -0,0 +1,135 @@
+#include "power.h"
+#include <avr/sleep.h>
+#include "events.h"
+#include "inputs.h"
+#include "actuators.h"
+#include "lbp.h"
+#include "eeprom.h"
+#include "logger.h"
+#include "state_machine.h"
+
+#if STANDBY_DELAY
+// watchdog settings, an interrupt without a reset every STANDBY_WAKE_TIME in standby
+#define WATCHDOG_STANDBY    ((1 << WDIE) | (1 << WDP1) | (1 << WDP0)) // 125ms
+#define WATCHDOG_OFF        0
+
+// written to CCP, this unlocks WDTCSR for the next 4 cycles
+#define CCP_SIGNATURE       0xD8
+
+// time of the last activity, see update_power()
+static uint32_t standby_activity;
+
+// timer counts spent in standby, counted by the watchdog
+static volatile uint32_t standby_counts;
+
+// timer counts of standby the time base hasn't moved on by yet, less than a period
+static uint32_t standby_carry;
+
+// set by the watchdog, the wake up was only to count the time
+static volatile uint8_t standby_timed_wake;
+
+ISR(WDT_vect) {
+    standby_counts += STANDBY_WAKE_TIME;
+    standby_timed_wake = 1;
+}
+
+/**
+ * Write the watchdog configuration. Call this with interrupts disabled.
+ */
+static void set_watchdog(uint8_t value) {
+    CCP = CCP_SIGNATURE;
+    WDTCSR = value;
+}
+
+/**
+ * Sleep in standby until something other than the watchdog wakes the board up. Returns 0 without having
+ * been in standby if an event, an input change or the link came first.
+ */
+static uint8_t standby() {
+    uint8_t sleeping = 0;
+
+    // the timer has to stop first, the cpu idles until the servo pulse has ended
+    suspend_timer();
+    cli();
+    standby_counts = 0;
+    set_sleep_mode(SLEEP_MODE_IDLE);
+
+    // ticks don't matter here, the main loop sees them once the board is awake again
+    while (!(pending_events & ~EVENT_TICK) && !is_input_changing()) {
+        if (!sleeping && is_timer_suspended()) {
+            if (!lbp_suspend()) {
+                break;
+            }
+            suspend_inputs();
+            set_watchdog(WATCHDOG_STANDBY);
+            set_sleep_mode(SLEEP_MODE_STANDBY);
+            sleeping = 1;
+        }
+
+        standby_timed_wake = 0;
+        sleep_enable();
+        sei();
+        sleep_cpu();
+        sleep_disable();
+        cli();
+
+        // the watchdog only counts the time, any other interrupt wakes the board up. That is half an
+        // interval after the last watchdog interrupt on average
+        if (sleeping && !standby_timed_wake) {
+            standby_counts += STANDBY_WAKE_TIME / 2;
+            break;
+        }
+    }
+
+    if (sleeping) {
+        set_watchdog(WATCHDOG_OFF);
+        lbp_resume();
+        resume_inputs();
+    }
+
+    // the timer can only move on by whole periods
+    uint32_t counts = standby_counts + standby_carry;
+    uint32_t periods = counts / TIME_COUNTS_PER_PERIOD;
+    standby_carry = counts - TIME_FROM_PERIODS(periods);
+    resume_timer(periods);
+    sei();
+    return sleeping;
+}
+#endif
+
+/**
+ * Initialize the power management, turning off the peripherals that aren't used
+ */
+void init_power() {
+    // TWI, USI and USART1
+    PRR = (1 << PRTWI) | (1 << PRUSI) | (1 << PRUSART1);
+    // the analog comparator
+    ACSRA = 1 << ACD;
+}
+
+/**
+ * Go to standby when it's time to, and return once the board has woken up. events are the EVENT_* flags
+ * that woke up the main loop, anything but a timer tick keeps the board awake for another STANDBY_DELAY.
+ */
+void update_power(uint8_t events) {
+#if STANDBY_DELAY
+    uint32_t now = get_time();
+
+    // nothing may be left to do that needs the main loop
+    if ((events & ~EVENT_TICK) || !is_standby_allowed() || get_buzzer_pattern() != BUZZER_NONE ||
+        !lbp_link_idle() || !is_config_committed() || !is_log_written()) {
+        standby_activity = now;
+        return;
+    }
+    if (now - standby_activity < TIME_FROM_MS(STANDBY_DELAY)) {
+        return;
+    }
+
+    // whatever woke the board up is activity. If it didn't get to standby it tries again at the next tick
+    if (standby()) {
+        standby_activity = get_time();
+    }
+#else
+    (void)events;
+#endif
+}
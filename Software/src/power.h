@@ -0,0 +1,38 @@
+#ifndef _POWER_H_
+#define _POWER_H_
+
+#include "config.h"
+
+/**
+ * This file contains the power management of the board. The peripherals nobody uses are off from boot.
+ * On the pad, once nothing happened for STANDBY_DELAY, the board goes to standby: Timer 1 stops at the
+ * end of a servo pulse, the ADC is turned off and the cpu sleeps in standby mode, where only the crystal
+ * oscillator keeps running. It wakes up on
+ * - a pin change of any input, the pin change interrupts of inputs.cpp
+ * - the start bit of a byte on the link, with the start frame detection of the USART, or on the relay
+ *   link with its pin change interrupt
+ * - the watchdog every STANDBY_WAKE_TIME, which only keeps the time base going.
+ * The oscillator being up, the cpu runs within 6 cycles and everything is back at full rate a few
+ * microseconds later, long before an input is debounced or the first byte has been received.
+ * Time in standby is counted in watchdog intervals, so it has the accuracy of the watchdog oscillator.
+ * Any other wake up comes somewhere in an interval and counts as half of one, so it is off by at most
+ * half an interval. The time base moves on in whole 20ms periods, the rest is carried to the next
+ * standby. Launch detection is unaffected, an armed board never goes to standby.
+ */
+
+// interval of the watchdog in standby, in timer counts. A short interval wakes the cpu more often,
+// for a few microseconds each time, a long one makes the time base less accurate
+#define STANDBY_WAKE_TIME   TIME_FROM_MS(125)
+
+/**
+ * Initialize the power management, turning off the peripherals that aren't used
+ */
+void init_power();
+
+/**
+ * Go to standby when it's time to, and return once the board has woken up. events are the EVENT_* flags
+ * that woke up the main loop, anything but a timer tick keeps the board awake for another STANDBY_DELAY.
+ */
+void update_power(uint8_t events);
+
+#endif
@@ -0,0 +1,179 @@
+#include "profiling.h"
+
+#if PROFILING
+
+#include "actuators.h"
+#include "eeprom.h"
+
+/**
+ * Statistics of a section, in timer counts
+ */
+typedef struct {
+    uint16_t min;
+    uint16_t max;
+    uint16_t samples;   // saturates, the average is over the samples counted
+    uint32_t sum;
+} profile_stats;
+
+static profile_stats profile_sections[PROFILE_SECTION_COUNT];
+static uint16_t profile_counters[PROFILE_COUNTER_COUNT];
+
+#if PROFILING == PROFILING_GPIO
+// nonzero if EXTRA_GPIO1 is a scope pin. The hardware servo output drives the same pad
+static uint8_t profile_gpio1;
+#endif
+
+/**
+ * Drive the scope pin of section, if it has one
+ */
+static void set_profile_pin(uint8_t section, uint8_t value) {
+#if PROFILING == PROFILING_GPIO
+    switch (section) {
+        case PROFILE_SCHEDULER:
+            if (profile_gpio1) {
+                EXTRA_GPIO1::write(value);
+            }
+            break;
+
+        case PROFILE_RX:
+            EXTRA_GPIO2::write(value);
+            break;
+
+        case PROFILE_TX:
+            EXTRA_GPIO3::write(value);
+            break;
+    }
+#else
+    (void)section;
+    (void)value;
+#endif
+}
+
+/**
+ * Initialize the statistics, and the scope pins in a PROFILING_GPIO build
+ */
+void init_profiling() {
+#if PROFILING == PROFILING_GPIO
+    // the servo output is taken at boot like init_actuators() does, it needs a reset to change
+    profile_gpio1 = config.servo_output != SERVO_OUTPUT_HARDWARE;
+    if (profile_gpio1) {
+        EXTRA_GPIO1::output();
+        EXTRA_GPIO1::clear();
+    }
+    EXTRA_GPIO2::output();
+    EXTRA_GPIO3::output();
+    EXTRA_GPIO2::clear();
+    EXTRA_GPIO3::clear();
+#endif
+    profile_reset();
+}
+
+/**
+ * Start and end a timed section. Called from the macros below, safe to call from interrupt context.
+ */
+uint16_t profile_begin(uint8_t section) {
+    set_profile_pin(section, 1);
+    return TCNT1;
+}
+
+void profile_end(uint8_t section, uint16_t begin) {
+    set_profile_pin(section, 0);
+    profile_latency(section, begin);
+}
+
+/**
+ * Add a value in timer counts to the statistics of section. Safe to call from interrupt context.
+ */
+void profile_record(uint8_t section, uint16_t value) {
+    profile_stats *stats = profile_sections + section;
+    NESTED_ATOMIC(
+        if (stats->samples != 0xFFFF) {
+            if (!stats->samples || value < stats->min) {
+                stats->min = value;
+            }
+            if (value > stats->max) {
+                stats->max = value;
+            }
+            stats->sum += value;
+            stats->samples++;
+        }
+    );
+}
+
+/**
+ * Add the counts from since (a Timer 1 count) to now to the statistics of section. Safe to call from
+ * interrupt context.
+ */
+void profile_latency(uint8_t section, uint16_t since) {
+    uint16_t now = TCNT1;
+    // the counter wraps every 20ms, longer spans can't be told apart from shorter ones
+    profile_record(section, now >= since ? now - since : now + TIME_COUNTS_PER_PERIOD - since);
+}
+
+/**
+ * Increment an error counter. Safe to call from interrupt context.
+ */
+void profile_count(uint8_t counter) {
+    NESTED_ATOMIC(
+        if (profile_counters[counter] != 0xFFFF) {
+            profile_counters[counter]++;
+        }
+    );
+}
+
+/**
+ * Read the statistics of section into data: [section][min (2)][max (2)][average (2)][samples (2)]
+ * Returns the length, or 0 if there is no such section.
+ */
+uint8_t profile_read(uint8_t section, uint8_t *data) {
+    if (section >= PROFILE_SECTION_COUNT) {
+        return 0;
+    }
+
+    profile_stats stats;
+    ATOMIC(stats = profile_sections[section];);
+    uint16_t average = stats.samples ? stats.sum / stats.samples : 0;
+
+    data[0] = section;
+    data[1] = stats.min & 0xFF;
+    data[2] = stats.min >> 8;
+    data[3] = stats.max & 0xFF;
+    data[4] = stats.max >> 8;
+    data[5] = average & 0xFF;
+    data[6] = average >> 8;
+    data[7] = stats.samples & 0xFF;
+    data[8] = stats.samples >> 8;
+    return 9;
+}
+
+/**
+ * Read the error counters into data, 2 bytes each. Returns the length.
+ */
+uint8_t profile_read_counters(uint8_t *data) {
+    for (uint8_t i = 0; i < PROFILE_COUNTER_COUNT; i++) {
+        uint16_t count;
+        ATOMIC(count = profile_counters[i];);
+        data[2 * i] = count & 0xFF;
+        data[2 * i + 1] = count >> 8;
+    }
+    return 2 * PROFILE_COUNTER_COUNT;
+}
+
+/**
+ * Clear the statistics and the counters
+ */
+void profile_reset() {
+    NESTED_ATOMIC(
+        for (uint8_t i = 0; i < PROFILE_SECTION_COUNT; i++) {
+            profile_sections[i].min = 0;
+            profile_sections[i].max = 0;
+            profile_sections[i].samples = 0;
+            profile_sections[i].sum = 0;
+        }
+        for (uint8_t i = 0; i < PROFILE_COUNTER_COUNT; i++) {
+            profile_counters[i] = 0;
+        }
+    );
+}
+
+#endif
@@ -0,0 +1,92 @@
+#ifndef _PROFILING_H_
+#define _PROFILING_H_
+
+#include "config.h"
+
+/**
+ * This file contains the instrumentation of the interrupt handlers and the main loop, see PROFILING in
+ * config.h. Sections are timed in Timer 1 counts (1.085 us) and kept as min/max/average statistics,
+ * errors on the link are counted. Both are read over LBP with LBP_GET_DIAGNOSTICS.
+ * In a normal build all of the macros below are empty.
+ */
+
+// timed sections
+#define PROFILE_RX              0 // USART0_RX_vect
+#define PROFILE_TX              1 // USART0_TX_vect
+#define PROFILE_SCHEDULER       2 // TIMER1_COMPA_vect, the scheduler tasks
+#define PROFILE_TICK            3 // TIMER1_CAPT_vect, the 20ms wrap
+#define PROFILE_STATE_MACHINE   4 // update_state_machine()
+#define PROFILE_LOOP            5 // a main loop iteration, from waking up to going back to sleep
+#define PROFILE_TICK_LATENCY    6 // from the 20ms wrap to TIMER1_CAPT_vect
+#define PROFILE_TASK_LATENCY    7 // from the scheduler compare to TIMER1_COMPA_vect
+#define PROFILE_LOOP_LATENCY    8 // from the 20ms wrap to the main loop handling EVENT_TICK
+#define PROFILE_SECTION_COUNT   9
+
+// error counters
+#define PROFILE_UART_OVERRUN    0 // a received byte was lost
+#define PROFILE_UART_FRAME      1 // a received byte had no stop bit
+#define PROFILE_CRC_DROP        2 // a received frame was dropped for its crc
+#define PROFILE_TX_BUSY         3 // lbp_get_tx_buffer() had no frame to offer
+#define PROFILE_COUNTER_COUNT   4
+
+#if PROFILING
+
+/**
+ * Initialize the statistics, and the scope pins in a PROFILING_GPIO build
+ */
+void init_profiling();
+
+/**
+ * Start and end a timed section. Called from the macros below, safe to call from interrupt context.
+ */
+uint16_t profile_begin(uint8_t section);
+void profile_end(uint8_t section, uint16_t begin);
+
+/**
+ * Add a value in timer counts to the statistics of section. Safe to call from interrupt context.
+ */
+void profile_record(uint8_t section, uint16_t value);
+
+/**
+ * Add the counts from since (a Timer 1 count) to now to the statistics of section. Safe to call from
+ * interrupt context.
+ */
+void profile_latency(uint8_t section, uint16_t since);
+
+/**
+ * Increment an error counter. Safe to call from interrupt context.
+ */
+void profile_count(uint8_t counter);
+
+/**
+ * Read the statistics of section into data: [section][min (2)][max (2)][average (2)][samples (2)]
+ * Returns the length, or 0 if there is no such section.
+ */
+uint8_t profile_read(uint8_t section, uint8_t *data);
+
+/**
+ * Read the error counters into data, 2 bytes each. Returns the length.
+ */
+uint8_t profile_read_counters(uint8_t *data);
+
+/**
+ * Clear the statistics and the counters
+ */
+void profile_reset();
+
+// only one section can be timed per scope
+#define PROFILE_BEGIN(section)          uint16_t profile_begin_time = profile_begin(section)
+#define PROFILE_END(section)            profile_end(section, profile_begin_time)
+#define PROFILE_LATENCY(section, since) profile_latency(section, since)
+#define PROFILE_COUNT(counter)          profile_count(counter)
+
+#else
+
+#define PROFILE_BEGIN(section)
+#define PROFILE_END(section)
+#define PROFILE_LATENCY(section, since)
+#define PROFILE_COUNT(counter)
+
+#endif
+
+#endif
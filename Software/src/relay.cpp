@@ -0,0 +1,108 @@
+#include "relay.h"
+
+#if LBP_RELAY
+
+// transmitter, the bits that are left after the start bit: 8 data bits and the stop bit
+static volatile uint8_t tx_data;
+static volatile uint8_t tx_bits;
+
+// receiver, the data bits that are left to sample. RX_IDLE waits for a start bit, RX_STOP samples the stop bit
+#define RX_IDLE             0xFF
+#define RX_STOP             0
+
+static volatile uint8_t rx_data;
+static volatile uint8_t rx_bits = RX_IDLE;
+
+/**
+ * Timer 0 compare A interrupt, a bit time has passed on the transmitter
+ */
+ISR(TIMER0_COMPA_vect) {
+    if (tx_bits) {
+        OCR0A += RELAY_BIT_COUNTS;
+        // ones are shifted in behind the data, the last of them is the stop bit
+        RELAY_TX_PIN::write(tx_data & 1);
+        tx_data = (tx_data >> 1) | 0x80;
+        tx_bits--;
+        return;
+    }
+
+    // the stop bit is done
+    TIMSK &= ~(1 << OCIE0A);
+    lbp_relay_transmit();
+}
+
+/**
+ * Timer 0 compare B interrupt, the middle of a received bit
+ */
+ISR(TIMER0_COMPB_vect) {
+    OCR0B += RELAY_BIT_COUNTS;
+    uint8_t level = RELAY_RX_PIN::read();
+    if (rx_bits != RX_STOP) {
+        rx_data = (rx_data >> 1) | (level ? 0x80 : 0);
+        rx_bits--;
+        return;
+    }
+
+    // wait for the next start bit. A byte without a stop bit is dropped, its frame fails the crc
+    TIMSK &= ~(1 << OCIE0B);
+    PCMSK0 |= RELAY_RX_PIN::mask;
+    rx_bits = RX_IDLE;
+    if (level) {
+        lbp_relay_receive(rx_data);
+    }
+}
+
+/**
+ * Catch the start bit of a byte. Called by the pin change interrupt of RELAY_RX_PIN.
+ */
+void relay_pin_change() {
+    // the other pins of the interrupt get here too, and so does the end of a start bit that was too short
+    if (rx_bits != RX_IDLE || RELAY_RX_PIN::read()) {
+        return;
+    }
+
+    OCR0B = TCNT0 + RELAY_BIT_COUNTS * 3 / 2;
+    TIFR = 1 << OCF0B;
+    TIMSK |= 1 << OCIE0B;
+    rx_bits = 8;
+    // the edges of the data bits don't need the pin change interrupt
+    PCMSK0 &= ~RELAY_RX_PIN::mask;
+}
+
+/**
+ * Initialize the pins, Timer 0 already runs for the inputs
+ */
+void init_relay() {
+    // the line idles high
+    RELAY_TX_PIN::set();
+    RELAY_TX_PIN::output();
+    RELAY_RX_PIN::input();
+    RELAY_RX_PIN::pullup(1);
+
+    // Timer 0 is started by init_inputs(), the compare channels are moved along bit by bit
+
+    // the pin change interrupt of port A is enabled by init_inputs()
+    PCMSK0 |= RELAY_RX_PIN::mask;
+}
+
+/**
+ * Start sending byte. Only call this while the last byte is done, that is from lbp_relay_transmit() or
+ * when nothing has been sent since. Must be called with interrupts disabled.
+ */
+void relay_write(uint8_t byte) {
+    RELAY_TX_PIN::clear();
+    OCR0A = TCNT0 + RELAY_BIT_COUNTS;
+    TIFR = 1 << OCF0A;
+    TIMSK |= 1 << OCIE0A;
+    tx_data = byte;
+    tx_bits = 9;
+}
+
+/**
+ * Returns nonzero when no byte is being sent or received. The board may only stop the clocks then.
+ */
+uint8_t relay_idle() {
+    return !(TIMSK & ((1 << OCIE0A) | (1 << OCIE0B)));
+}
+
+#endif
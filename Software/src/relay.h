@@ -0,0 +1,67 @@
+#ifndef _RELAY_H_
+#define _RELAY_H_
+
+#include "config.h"
+
+/**
+ * This file contains the second link of a relay build, see LBP_RELAY in config.h. It is a software uart
+ * on RELAY_TX_PIN and RELAY_RX_PIN with the same frame format as the USART, 8 bits, no parity and 1 stop
+ * bit, at RELAY_BAUD. Timer 0 runs freely at CPU_FREQ / 8 (its overflow samples the inputs, see inputs.cpp),
+ * its compare A channel times the bits that are sent and its compare B channel samples the bits that are
+ * received, so both directions work at once.
+ * The start bit of a received byte is caught with the pin change interrupt the relay shares with
+ * inputs.cpp, sampling starts from there in the middle of the first data bit.
+ * Every interrupt handler delays the sampling while it runs. The longest of them plus the pin change
+ * interrupt must stay below half a bit, about 52 us or 384 cycles at 9600 baud. The relay benchmark of
+ * the simulator checks this with its estimates.
+ * lbp.cpp runs the link layer on top of this like it does on the USART.
+ */
+
+#if LBP_RELAY
+
+// Timer 0 counts per bit
+#define RELAY_BIT_COUNTS    (CPU_FREQ / 8 / RELAY_BAUD)
+
+// the first sample is taken one and a half bits after the start of a byte
+#if RELAY_BIT_COUNTS * 3 / 2 > 0xFF || RELAY_BIT_COUNTS < 16
+#error "RELAY_BAUD must be between 5400 and 57600"
+#endif
+
+/**
+ * Initialize the pins, Timer 0 already runs for the inputs
+ */
+void init_relay();
+
+/**
+ * Start sending byte. Only call this while the last byte is done, that is from lbp_relay_transmit() or
+ * when nothing has been sent since. Must be called with interrupts disabled.
+ */
+void relay_write(uint8_t byte);
+
+/**
+ * Returns nonzero when no byte is being sent or received. The board may only stop the clocks then.
+ */
+uint8_t relay_idle();
+
+/**
+ * Catch the start bit of a byte. Called by the pin change interrupt of RELAY_RX_PIN.
+ */
+void relay_pin_change();
+
+/**
+ * The following functions are implemented by lbp.cpp, the relay calls them from interrupt context
+ */
+
+/**
+ * A byte was received
+ */
+void lbp_relay_receive(uint8_t byte);
+
+/**
+ * The last byte written with relay_write() is done, including its stop bit
+ */
+void lbp_relay_transmit();
+
+#endif
+
+#endif
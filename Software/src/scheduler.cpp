@@ -0,0 +1,214 @@
+#include "scheduler.h"
+#include "actuators.h"
+#include "profiling.h"
+
+/**
+ * Task pool. A task is in use when its function is set.
+ */
+typedef struct {
+    task_function function;
+    uint32_t time;      // next run, see get_time()
+    uint32_t period;    // 0 for a one-shot task
+    uint8_t priority;
+} task_type;
+
+static task_type tasks[TASK_COUNT];
+
+/**
+ * Returns nonzero if time a is earlier than time b. Works across the wrap of get_time().
+ */
+static uint8_t is_earlier(uint32_t a, uint32_t b) {
+    return (int32_t)(a - b) < 0;
+}
+
+// set while the scheduler interrupt runs the tasks, it programs the compare itself once they're done
+static uint8_t scheduler_running;
+
+// set when a task changed the pool, the scheduler has to scan it again
+static uint8_t tasks_changed;
+
+// the time the compare is programmed for, the scheduler interrupt takes it as the current time
+static uint32_t compare_time;
+
+/**
+ * Program the compare for task next, or turn it off if there is no task. now is a time with the counter
+ * value in count at that time, like a get_time_count(), at most a period ago. Called with interrupts
+ * disabled.
+ */
+static void arm_compare(task_type *next, uint32_t now, uint16_t count) {
+    if (!next) {
+        TIMSK &= ~(1 << OCIE1A);
+        return;
+    }
+
+    // from the counter as it is now, the tasks may have taken a while since now
+    uint16_t counter = TCNT1;
+    uint16_t elapsed = counter >= count ? counter - count : counter + TIME_COUNTS_PER_PERIOD - count;
+    int32_t delay = next->time - now - elapsed;
+    if (delay < SCHEDULER_MIN_LEAD) {
+        delay = SCHEDULER_MIN_LEAD;
+    }
+    // the compare matches once every period, a task further away just checks in again a period later
+    if (delay >= TIME_COUNTS_PER_PERIOD) {
+        delay = TIME_COUNTS_PER_PERIOD - 1;
+    }
+
+    uint16_t target = counter + (uint16_t)delay;
+    if (target >= TIME_COUNTS_PER_PERIOD) {
+        target -= TIME_COUNTS_PER_PERIOD;
+    }
+
+    compare_time = now + elapsed + delay;
+    OCR1A = target;
+    TIFR = 1 << OCF1A;
+    TIMSK |= 1 << OCIE1A;
+}
+
+/**
+ * Program the compare for the earliest task. Called with interrupts disabled.
+ */
+static void arm_scheduler() {
+    if (scheduler_running) {
+        tasks_changed = 1;
+        return;
+    }
+
+    task_type *next = NULL;
+    for (uint8_t i = 0; i < TASK_COUNT; i++) {
+        if (tasks[i].function && (!next || is_earlier(tasks[i].time, next->time))) {
+            next = tasks + i;
+        }
+    }
+
+    uint16_t count;
+    uint32_t now = get_time_count(&count);
+    arm_compare(next, now, count);
+}
+
+/**
+ * Timer 1 compare A interrupt. Runs the due tasks in order of priority, then waits for the next one.
+ * The time is the one the compare was programmed for rather than a get_time(), that is less to do in
+ * the interrupt. A task that gets due meanwhile runs from the next interrupt right after this one.
+ */
+ISR(TIMER1_COMPA_vect) {
+    PROFILE_BEGIN(PROFILE_SCHEDULER);
+    PROFILE_LATENCY(PROFILE_TASK_LATENCY, OCR1A);
+
+    uint16_t count = OCR1A;
+    uint32_t now = compare_time;
+    task_type *next;
+    scheduler_running = 1;
+
+    while (1) {
+        // a single scan finds the due task to run first and the earliest of the others
+        task_type *task = NULL;
+        uint8_t due = 0;
+        next = NULL;
+        for (uint8_t i = 0; i < TASK_COUNT; i++) {
+            task_type *candidate = tasks + i;
+            if (!candidate->function) {
+                continue;
+            }
+            if (is_earlier(now, candidate->time)) {
+                if (!next || is_earlier(candidate->time, next->time)) {
+                    next = candidate;
+                }
+                continue;
+            }
+            due++;
+            if (!task || candidate->priority < task->priority ||
+                (candidate->priority == task->priority && is_earlier(candidate->time, task->time))) {
+                task = candidate;
+            }
+        }
+
+        if (!task) {
+            break;
+        }
+
+        // update the task first, so it can reschedule or cancel itself
+        task_function function = task->function;
+        if (task->period) {
+            task->time += task->period;
+        } else {
+            task->function = NULL;
+        }
+        tasks_changed = 0;
+        function();
+
+        // the scan still holds unless there is more to run or the pool changed
+        if (due > 1 || tasks_changed || (task->function && !is_earlier(now, task->time))) {
+            continue;
+        }
+        if (task->function && (!next || is_earlier(task->time, next->time))) {
+            next = task;
+        }
+        break;
+    }
+
+    scheduler_running = 0;
+    arm_compare(next, now, count);
+    PROFILE_END(PROFILE_SCHEDULER);
+}
+
+/**
+ * Schedule function to run at time (see get_time()), and every period counts after that if period is
+ * nonzero. Returns the task id, or TASK_NONE if the pool is full.
+ * Safe to call from interrupt context, including from a task.
+ */
+uint8_t schedule_task(task_function function, uint32_t time, uint32_t period, uint8_t priority) {
+    uint8_t id = TASK_NONE;
+    NESTED_ATOMIC(
+        for (uint8_t i = 0; i < TASK_COUNT; i++) {
+            if (!tasks[i].function) {
+                tasks[i].function = function;
+                tasks[i].time = time;
+                tasks[i].period = period;
+                tasks[i].priority = priority;
+                id = i;
+                arm_scheduler();
+                break;
+            }
+        }
+    );
+    return id;
+}
+
+/**
+ * Move the next run of a scheduled task to time. Safe to call from interrupt context.
+ */
+void reschedule_task(uint8_t task, uint32_t time) {
+    if (task >= TASK_COUNT) {
+        return;
+    }
+    NESTED_ATOMIC(
+        tasks[task].time = time;
+        arm_scheduler();
+    );
+}
+
+/**
+ * Remove a task from the pool. It won't run anymore once this returns. Safe to call from interrupt context.
+ */
+void cancel_task(uint8_t task) {
+    if (task >= TASK_COUNT) {
+        return;
+    }
+    NESTED_ATOMIC(
+        tasks[task].function = NULL;
+        arm_scheduler();
+    );
+}
+
+/**
+ * Move every task later by counts, without the runs that would have been due meanwhile. This is for a
+ * jump of the time base, see resume_timer(). Safe to call from interrupt context.
+ */
+void delay_tasks(uint32_t counts) {
+    NESTED_ATOMIC(
+        for (uint8_t i = 0; i < TASK_COUNT; i++) {
+            tasks[i].time += counts;
+        }
+        arm_scheduler();
+    );
+}
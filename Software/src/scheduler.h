@@ -0,0 +1,51 @@
+#ifndef _SCHEDULER_H_
+#define _SCHEDULER_H_
+
+#include "config.h"
+
+/**
+ * This file contains the interface to the task scheduler. Tasks are functions that run in interrupt
+ * context at a given time (see get_time()), once or periodically. The scheduler uses the COMPA channel
+ * of Timer 1, which is programmed for the earliest task, so the timer interrupts only fire when there
+ * is something to do. Tasks run with interrupts disabled and should be short.
+ */
+
+// size of the task pool: telemetry, the deploy timeout and room for more
+#define TASK_COUNT          4
+
+// returned when a task can't be scheduled
+#define TASK_NONE           0xFF
+
+// task priorities, lower runs first when several tasks are due at the same time
+#define PRIORITY_DEPLOY     0 // pyro and servo deployment
+#define PRIORITY_NORMAL     1
+
+// the compare is never programmed closer than this to the current count, so it can't be missed
+#define SCHEDULER_MIN_LEAD  16
+
+typedef void (*task_function)();
+
+/**
+ * Schedule function to run at time (see get_time()), and every period counts after that if period is
+ * nonzero. Returns the task id, or TASK_NONE if the pool is full.
+ * Safe to call from interrupt context, including from a task.
+ */
+uint8_t schedule_task(task_function function, uint32_t time, uint32_t period, uint8_t priority);
+
+/**
+ * Move the next run of a scheduled task to time. Safe to call from interrupt context.
+ */
+void reschedule_task(uint8_t task, uint32_t time);
+
+/**
+ * Remove a task from the pool. It won't run anymore once this returns. Safe to call from interrupt context.
+ */
+void cancel_task(uint8_t task);
+
+/**
+ * Move every task later by counts, without the runs that would have been due meanwhile. This is for a
+ * jump of the time base, see resume_timer(). Safe to call from interrupt context.
+ */
+void delay_tasks(uint32_t counts);
+
+#endif
@@ -1,4 +1,7 @@
 #include "state_machine.h"
+#include <string.h>
+#include "scheduler.h"
+#include "vote.h"
 
 /**
  * State machine data
@@ -16,6 +19,143 @@ typedef enum {
 
 static state_type flight_state = SYSTEMS_CHECK;
 
+// names of the states for the lbp status, in the order of state_type
+static const char state_names[] PROGMEM = "error\0systems check\0idle\0preparation\0armed\0launched\0deployed";
+
+// time (see get_time()) at which the breakwire was broken
+static uint32_t launch_time;
+
+/**
+ * Deploy plan. Everything the deploy decision needs is fixed at launch, so the decision is a
+ * couple of compares that run in interrupt context: at the deadlines from the scheduler and on a
+ * vote edge from the input sampling. Peer votes come in over lbp and are checked right away from the
+ * main loop. The main loop only does the logging afterwards.
+ */
+typedef struct {
+    uint32_t min_time;      // from here on a vote deploys, see get_time()
+    uint32_t max_time;      // from here on we deploy without a vote
+    void (*fire)();
+    uint8_t open_position;
+    uint8_t log_flags;      // LOG_DEPLOY_* flags of the actuator
+    uint8_t vote_peers;     // see vote.h
+    uint8_t vote_quorum;
+} deploy_plan_type;
+
+static deploy_plan_type deploy_plan;
+static uint8_t deploy_task = TASK_NONE;
+static volatile uint8_t deploy_pending;  // the plan is active
+static volatile uint8_t deployed;        // LOG_DEPLOY_* flags plus LOG_DEPLOY_DONE once we deployed
+static volatile uint32_t deploy_time;
+
+#define LOG_DEPLOY_DONE 0x80
+
+static void fire_servo() {
+    set_servo_position(deploy_plan.open_position);
+}
+
+static void fire_pyro() {
+    set_pyro_state(ON);
+}
+
+/**
+ * Deploy if the plan says so. Called with interrupts disabled.
+ */
+static void check_deploy() {
+    if (!deploy_pending) {
+        return;
+    }
+
+    uint32_t now = get_time();
+    uint8_t flags;
+    if ((int32_t)(now - deploy_plan.max_time) >= 0) {
+        flags = 0;
+    } else if ((int32_t)(now - deploy_plan.min_time) >= 0) {
+        uint8_t peers = get_peer_votes() & deploy_plan.vote_peers;
+        if (count_votes(peers) < deploy_plan.vote_quorum) {
+            return;
+        }
+        flags = LOG_DEPLOY_VOTE | (peers ? LOG_DEPLOY_PEERS : 0);
+    } else {
+        return;
+    }
+
+    deploy_plan.fire();
+    deploy_time = now;
+    deploy_pending = 0;
+    deployed = LOG_DEPLOY_DONE | deploy_plan.log_flags | flags;
+    cancel_task(deploy_task);
+    deploy_task = TASK_NONE;
+    set_input_handler(NULL);
+}
+
+/**
+ * Scheduler task at the deploy deadlines. After the min deadline it waits for the max deadline.
+ */
+static void deploy_deadline() {
+    check_deploy();
+    if (deploy_pending) {
+        deploy_task = schedule_task(deploy_deadline, deploy_plan.max_time, 0, PRIORITY_DEPLOY);
+    }
+}
+
+/**
+ * Input handler while the plan is active
+ */
+static void deploy_input(uint8_t edges) {
+    if (edges & (1 << INPUT_VOTE)) {
+        check_deploy();
+    }
+}
+
+/**
+ * Take a deploy vote of a peer board, see vote.h. Once the plan is active a vote that makes the
+ * quorum deploys right away.
+ */
+void receive_vote(uint8_t voter, uint8_t reason) {
+    if (!record_vote(voter, reason)) {
+        return;
+    }
+    log_event(LOG_PEER_VOTE, voter | (reason << 4));
+    ATOMIC(check_deploy(););
+}
+
+/**
+ * Snapshot the configuration into the deploy plan and start it
+ */
+static void start_deploy_plan() {
+    deploy_plan.min_time = launch_time + TIME_FROM_PERIODS(config.min_deploy_time);
+    deploy_plan.max_time = launch_time + TIME_FROM_PERIODS(config.max_deploy_time);
+    deploy_plan.fire = config.use_servo ? fire_servo : fire_pyro;
+    deploy_plan.open_position = config.servo_open_position;
+    deploy_plan.log_flags = config.use_servo ? LOG_DEPLOY_SERVO : 0;
+    // a quorum the peers can't reach deploys at the max deadline
+    deploy_plan.vote_peers = config.vote_peers;
+    deploy_plan.vote_quorum = config.vote_quorum;
+
+    ATOMIC(
+        deploy_pending = 1;
+        deploy_task = schedule_task(deploy_deadline, deploy_plan.min_time, 0, PRIORITY_DEPLOY);
+        // the vote may have gone up before the min deadline, or even before launch
+        check_deploy();
+    );
+    set_input_handler(deploy_input);
+}
+
+/**
+ * Switch to a new state and log the transition. The pattern of the previous state, if it is
+ * still playing, is replaced by pattern (BUZZER_*).
+ */
+static void set_state(state_type state, uint8_t pattern) {
+    // the self-test moves the servo, it can't go on outside of IDLE
+    if (state != IDLE) {
+        self_test_stop();
+    }
+    flight_state = state;
+    log_event(LOG_STATE, state);
+    buzzer_stop();
+    buzzer_play(pattern);
+}
+
 /**
  * Implementation of the lbp state callbacks
  */
@@ -28,6 +168,73 @@ uint8_t lbp_state_armed() {
     return flight_state >= ARMED;
 }
 
+uint8_t lbp_state_warning() {
+    return get_warnings() != 0;
+}
+
+uint8_t lbp_state_name(uint8_t *data) {
+    const char *name = state_names;
+    for (uint8_t i = 0; i < flight_state; i++) {
+        name += strlen_P(name) + 1;
+    }
+    uint8_t length = strlen_P(name);
+    memcpy_P(data, name, length);
+    return length;
+}
+
+/**
+ * Returns the current state
+ */
+uint8_t get_flight_state() {
+    return flight_state;
+}
+
+/**
+ * Returns nonzero if the self-test may run, that is in IDLE
+ */
+uint8_t is_self_test_allowed() {
+    return flight_state == IDLE;
+}
+
+/**
+ * Returns nonzero if the board may go to standby, see power.h. That is on the pad before it is armed,
+ * in IDLE or PREPARATION, and while no self-test is running.
+ */
+uint8_t is_standby_allowed() {
+    return (flight_state == IDLE || flight_state == PREPARATION) && !is_self_test_running();
+}
+
+/**
+ * Returns the WARNING_* flags. Warnings don't keep the state machine from going on, they are only reported.
+ */
+uint8_t get_warnings() {
+    uint8_t warnings = 0;
+    if (is_battery_value_ready() && get_battery_value() <= config.battery_empty_limit + BATTERY_WARNING_MARGIN) {
+        warnings |= WARNING_BATTERY;
+    }
+    uint8_t failures = get_self_test_failures();
+    if (failures & SELF_TEST_CONTINUITY) {
+        warnings |= WARNING_SQUIB;
+    }
+    if (failures & ~SELF_TEST_CONTINUITY) {
+        warnings |= WARNING_SELF_TEST;
+    }
+    if (!is_config_committed()) {
+        warnings |= WARNING_CONFIG;
+    }
+    return warnings;
+}
+
+/**
+ * Returns the time since launch in milliseconds, 0 if we haven't launched yet
+ */
+uint32_t get_flight_time() {
+    if (flight_state < LAUNCHED) {
+        return 0;
+    }
+    return TIME_TO_MS(get_time() - launch_time);
+}
+
 /**
  * Initialize the state machine
  */
@@ -36,132 +243,135 @@ void init_state_machine() {
 }
 
 /**
- * Update the state machine.
+ * Update the state machine. events are the EVENT_* flags that woke up the main loop.
  */
-void update_state_machine() {
+void update_state_machine(uint8_t events) {
+    // lbp traffic on its own doesn't change anything the states look at,
+    // configuration changes are picked up at the next tick
+    if (!(events & (EVENT_TICK | EVENT_INPUT))) {
+        return;
+    }
+
+    if (events & EVENT_INPUT) {
+        uint8_t edges = get_input_edges();
+        if (edges & (1 << INPUT_BREAKWIRE)) {
+            log_event(LOG_BREAKWIRE, is_breakwire_connected());
+        }
+        if (edges & (1 << INPUT_VOTE)) {
+            log_event(LOG_VOTE, is_vote_asserted());
+        }
+    }
+
     switch (flight_state) {
         case ERROR:
-            // be annoying
-            if (!buzzer_queue_length()) {
-                buzzer_beep(BEEP_LONG);
-            }
-
             // exit the state once we're no longer armed,
-            // if battery voltage is in good state
-            // and if there's a squib connected if one is necessary
-            if (!is_armed() &&
-                get_battery_value() > eeprom_read_safe(&battery_empty_limit) &&
-                (eeprom_read_safe(&use_servo) || is_squib_connected())) {
-
-                buzzer_beep(BEEP_SHORT);
-                buzzer_beep(BEEP_SHORT);
+            // if battery voltage is in good state,
+            // if there's a squib connected if one is necessary
+            // and once the configuration is valid
+            if (!is_armed() && config_is_valid() &&
+                get_battery_value() > config.battery_empty_limit &&
+                (config.use_servo || is_squib_connected())) {
+
                 set_status_led(ON);
-                flight_state = IDLE;
+                set_state(IDLE, BUZZER_OK);
             }
             break;
 
         case SYSTEMS_CHECK:
             // this state is the entry state, it performs startup checking of some peripherals
 
+            // wait for the first battery measurement
+            if (!is_battery_value_ready()) {
+                break;
+            }
+
             // close the servo if necessary
-            if (eeprom_read_safe(&use_servo)) {
-                set_servo_position(eeprom_read_safe(&servo_closed_position));
+            if (config.use_servo) {
+                set_servo_position(config.servo_closed_position);
             }
 
             // check if the battery is empty
             // also, check if there's a squib connected if we're configured for one.
-            if ((get_battery_value() <= eeprom_read_safe(&battery_empty_limit)) ||
-			((!eeprom_read_safe(&use_servo) && !is_squib_connected()))) {
+            // a board without a valid configuration record runs on the defaults, which aren't safe to fly
+            if (!config_is_valid() || (get_battery_value() <= config.battery_empty_limit) ||
+			((!config.use_servo && !is_squib_connected()))) {
 
-                flight_state = ERROR;
+                set_state(ERROR, BUZZER_ERROR);
                 break;
             }
 
             // if everything's okay, go into idle
-            buzzer_beep(BEEP_SHORT);
-            buzzer_beep(BEEP_SHORT);
             set_status_led(ON);
-            flight_state = IDLE;
+            set_state(IDLE, BUZZER_OK);
             break;
 
         case IDLE:
             if (is_armed()) {
-                flight_state = ERROR;
+                set_state(ERROR, BUZZER_ERROR);
                 break;
             }
 
             if (is_breakwire_connected()) {
-                buzzer_beep(BEEP_SHORT);
-                buzzer_beep(BEEP_SHORT);
                 set_status_led(OFF);
-                flight_state = PREPARATION;
+                set_state(PREPARATION, BUZZER_OK);
                 break;
             }
             break;
 
         case PREPARATION:
             if (!is_breakwire_connected()) {
-                buzzer_beep(BEEP_LONG);
                 set_status_led(ON);
-                flight_state = IDLE;
+                set_state(IDLE, BUZZER_CANCEL);
                 break;
             }
 
             if (is_armed()) {
-                if (!eeprom_read_safe(&use_servo) && !is_squib_connected()) {
-                    flight_state = ERROR;
+                if (!config.use_servo && !is_squib_connected()) {
+                    set_state(ERROR, BUZZER_ERROR);
 
                 } else {
-                    buzzer_beep(BEEP_SHORT);
-                    buzzer_beep(BEEP_SHORT);
                     set_status_led(ON);
-                    flight_state = ARMED;
+                    set_state(ARMED, BUZZER_OK);
                 }
             }
             break;
 
         case ARMED:
             if (!is_armed()) {
-                buzzer_beep(BEEP_LONG);
                 set_status_led(OFF);
-                flight_state = PREPARATION;
+                set_state(PREPARATION, BUZZER_CANCEL);
                 break;
             }
 
             if (!is_breakwire_connected()) {
-                reset_timer();
+                // time from the captured edge rather than from when we got around to noticing it
+                launch_time = get_input_edge_time(INPUT_BREAKWIRE);
+                start_deploy_plan();
+                reset_battery_statistics();
                 set_launch_asserted(ON);
-                flight_state = LAUNCHED;
+                set_state(LAUNCHED, BUZZER_FLIGHT);
                 break;
             }
             break;
 
         case LAUNCHED:
-            if (!buzzer_queue_length()) {
-                buzzer_beep(BEEP_SHORT);
+            // the interrupts deploy, this only backs them up in case the deadline task couldn't be scheduled
+            if (!deployed) {
+                ATOMIC(check_deploy(););
             }
 
-            if (get_timer() >= eeprom_read_safe(&max_deploy_time) || 
-                (get_timer() >= eeprom_read_safe(&min_deploy_time) && is_vote_asserted())) {
-                if (eeprom_read_safe(&use_servo)) {
-                    set_servo_position(eeprom_read_safe(&servo_open_position));
-
-                } else {
-                    set_pyro_state(ON);
-
-                }
-                eeprom_write_safe(&last_logged_deploy_time, get_timer());
-                flight_state = DEPLOYED;
+            if (deployed) {
+                log_event(LOG_DEPLOY, deployed & ~LOG_DEPLOY_DONE);
+                log_event(LOG_BATTERY_MIN, get_battery_min() >> 8);
+                // logged in milliseconds, saturating
+                uint32_t deploy_ms = TIME_TO_MS(deploy_time - launch_time);
+                config_write(&config.last_logged_deploy_time, deploy_ms > 0xFFFF ? 0xFFFF : (uint16_t)deploy_ms);
+                set_state(DEPLOYED, BUZZER_DEPLOYED);
                 break;
             }
-
             break;
 
         case DEPLOYED:
-            if (!buzzer_queue_length()) {
-                buzzer_beep(BEEP_LONG);
-            }
-
             break;
     }
 
@@ -6,20 +6,63 @@
 #include "actuators.h"
 #include "lbp.h"
 #include "test.h"
+#include "events.h"
+#include "logger.h"
 
 /**
  * This file contains the interface to the SRP state machine
  */
 
+// warning flags, see get_warnings()
+#define WARNING_BATTERY         0x01 // the battery is within BATTERY_WARNING_MARGIN of battery_empty_limit
+#define WARNING_SQUIB           0x02 // the last self-test found the continuity line floating or without a squib
+#define WARNING_SELF_TEST       0x04 // the last self-test failed otherwise
+#define WARNING_CONFIG          0x08 // configuration changes haven't been committed to the EEPROM yet
+
+// get_battery_value() steps above battery_empty_limit that are a warning, about 0.3V
+#define BATTERY_WARNING_MARGIN  8
+
 /**
  * Initialize the state machine
  */
 void init_state_machine();
 
 /**
- * Update the state machine.
+ * Update the state machine. events are the EVENT_* flags that woke up the main loop.
+ */
+void update_state_machine(uint8_t events);
+
+/**
+ * Returns the current state, see state_type in state_machine.cpp
+ */
+uint8_t get_flight_state();
+
+/**
+ * Returns the time since launch in milliseconds, 0 if we haven't launched yet
+ */
+uint32_t get_flight_time();
+
+/**
+ * Returns the WARNING_* flags. Warnings don't keep the state machine from going on, they are only reported.
+ */
+uint8_t get_warnings();
+
+/**
+ * Returns nonzero if the self-test may run, that is in IDLE
+ */
+uint8_t is_self_test_allowed();
+
+/**
+ * Returns nonzero if the board may go to standby, see power.h. That is on the pad before it is armed,
+ * in IDLE or PREPARATION, and while no self-test is running.
+ */
+uint8_t is_standby_allowed();
+
+/**
+ * Take a deploy vote of a peer board, see vote.h. Once the plan is active a vote that makes the
+ * quorum deploys right away.
  */
-void update_state_machine();
+void receive_vote(uint8_t voter, uint8_t reason);
 
 
 #endif
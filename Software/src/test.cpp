@@ -1,65 +1,259 @@
-#define A 6 // 0.25 sec tone
-#define K 12 // 0.5 sec tone
-#define H 24 // 1 sec tone
-#define F 48 // 2 sec tone
-#define S -12 // 0.5 sec silence
-
 #include "test.h"
+#include "state_machine.h"
+
+/**
+ * Test steps, one per timer tick except for the servo moves which take SELF_TEST_MOVE_TIME each
+ */
+#define STEP_CONTINUITY     0
+#define STEP_BATTERY        1
+#define STEP_SERVO          2
+#define STEP_DONE           3
+
+// servo moves, alternating between open and closed and ending closed
+#define SELF_TEST_MOVES         4
+#define SELF_TEST_MOVE_TIME     TIME_FROM_MS(1000)
+
+// a move has to be over this long before the end of SELF_TEST_MOVE_TIME
+#define SELF_TEST_SETTLE_MARGIN TIME_FROM_MS(200)
+
+// battery drop (in get_battery_value() steps) that counts as the servo drawing current, about 80mV
+#define SELF_TEST_SAG           2
+
+// the continuity line is charged to the opposite level for this long before it is read without the pullup
+#define SELF_TEST_PULSE_US      5
+#define SELF_TEST_SETTLE_US     20
+
+static uint8_t test_state = SELF_TEST_IDLE;
+static uint8_t test_step;
+static uint8_t test_failures;
+static uint8_t test_continuity;
+
+static uint8_t test_move;
+static uint32_t test_move_start;
+static uint32_t test_last_sag;
+static uint16_t test_settle_time;
+
+static uint8_t test_battery_before;
+static uint8_t test_battery_min;
+
+static uint16_t test_latency_max;
+static uint32_t test_latency_total;
+static uint16_t test_latency_samples;
+
+/**
+ * Pull the continuity line to level, release it and read it back without the pullup. A line that is
+ * driven by the detection circuit reads the same for both levels. Takes a few microseconds with
+ * interrupts disabled.
+ */
+static uint8_t pulse_continuity(uint8_t level) {
+    uint8_t value;
+    uint8_t oldSREG = SREG;
+    cli();
+    CONTINUITY_DETECTION_PIN::pullup(0);
+    CONTINUITY_DETECTION_PIN::write(level);
+    CONTINUITY_DETECTION_PIN::output();
+    _delay_us(SELF_TEST_PULSE_US);
+    CONTINUITY_DETECTION_PIN::input();
+    CONTINUITY_DETECTION_PIN::clear();
+    _delay_us(SELF_TEST_SETTLE_US);
+    value = CONTINUITY_DETECTION_PIN::read() != 0;
+    CONTINUITY_DETECTION_PIN::pullup(1);
+    SREG = oldSREG;
+    return value;
+}
+
+static void test_continuity_line() {
+    if (pulse_continuity(0)) {
+        test_continuity |= SELF_TEST_SQUIB_LOW_PULSE;
+    }
+    if (pulse_continuity(1)) {
+        test_continuity |= SELF_TEST_SQUIB_HIGH_PULSE;
+    }
+
+    uint8_t driven = !(test_continuity & SELF_TEST_SQUIB_LOW_PULSE) == !(test_continuity & SELF_TEST_SQUIB_HIGH_PULSE);
+    if (!driven || (!config.use_servo && !(test_continuity & SELF_TEST_SQUIB_HIGH_PULSE))) {
+        test_failures |= SELF_TEST_CONTINUITY;
+    }
+}
+
+static void start_move(uint32_t now) {
+    set_servo_position((test_move & 1) ? config.servo_closed_position : config.servo_open_position);
+    test_move_start = now;
+    test_last_sag = now;
+}
+
+/**
+ * Follow a servo move. Returns nonzero once it is over.
+ */
+static uint8_t update_move(uint32_t now) {
+    if (test_battery_before - get_battery_value() >= SELF_TEST_SAG) {
+        test_last_sag = now;
+    }
+    if (now - test_move_start < SELF_TEST_MOVE_TIME) {
+        return 0;
+    }
+
+    uint32_t settle = test_last_sag - test_move_start;
+    if (settle > SELF_TEST_MOVE_TIME - SELF_TEST_SETTLE_MARGIN) {
+        test_failures |= SELF_TEST_SERVO;
+    }
+    settle = TIME_TO_MS(settle);
+    if (settle > test_settle_time) {
+        test_settle_time = settle;
+    }
+    return 1;
+}
+
+static void finish() {
+    test_battery_min = get_battery_min() >> 8;
+    if (test_battery_min <= config.battery_empty_limit) {
+        test_failures |= SELF_TEST_BATTERY;
+    }
+    if (test_latency_max > TIME_COUNTS_PER_PERIOD / 2) {
+        test_failures |= SELF_TEST_TIMING;
+    }
+    test_step = STEP_DONE;
+    test_state = SELF_TEST_DONE;
+    buzzer_play(test_failures ? BUZZER_CANCEL : BUZZER_OK);
+}
+
+/**
+ * Start the self-test. Returns 0 if the state machine isn't in IDLE or a test is running already.
+ */
+uint8_t self_test_start() {
+    if (test_state == SELF_TEST_RUNNING || !is_self_test_allowed()) {
+        return 0;
+    }
+    test_state = SELF_TEST_RUNNING;
+    test_step = STEP_CONTINUITY;
+    test_failures = 0;
+    test_continuity = 0;
+    test_move = 0;
+    test_settle_time = 0;
+    test_battery_before = 0;
+    test_battery_min = 0;
+    test_latency_max = 0;
+    test_latency_total = 0;
+    test_latency_samples = 0;
+    return 1;
+}
 
 /**
- * Bytecode for the song on single pitch
+ * Stop a running test and return the servo to servo_closed_position. The report is flagged SELF_TEST_ABORTED.
+ * The state machine calls this when it leaves IDLE.
  */
-#define SONG_LEN 18
-const int8_t song[SONG_LEN] = {
-    S, S, A, A, A, A,
-    K, A, A, K, A, A,
-    H, A, A, A, A,
-    F,
-};
+void self_test_stop() {
+    if (test_state != SELF_TEST_RUNNING) {
+        return;
+    }
+    if (test_step == STEP_SERVO) {
+        set_servo_position(config.servo_closed_position);
+    }
+    test_failures |= SELF_TEST_ABORTED;
+    test_battery_min = get_battery_min() >> 8;
+    test_step = STEP_DONE;
+    test_state = SELF_TEST_DONE;
+}
 
 /**
- * Default test impl
+ * Advance the test. events are the EVENT_* flags that woke up the main loop. Returns nonzero once when
+ * the test has finished.
  */
-static void beep_song() {
-    reset_timer();
-    for (uint8_t i = 0; i < SONG_LEN; i++) {
-        int8_t dur = song[i];
-        if (dur >= 0) {
-            buzzer_beep(dur);
-            while (buzzer_queue_length()) {
-                _delay_us(1000);
+uint8_t update_self_test(uint8_t events) {
+    if (test_state != SELF_TEST_RUNNING || !(events & EVENT_TICK)) {
+        return 0;
+    }
+
+    // the counter restarted at 0 on the tick
+    uint16_t latency;
+    get_time_periods(&latency);
+    uint32_t now = get_time();
+    if (latency > test_latency_max) {
+        test_latency_max = latency;
+    }
+    test_latency_total += latency;
+    test_latency_samples++;
+
+    switch (test_step) {
+        case STEP_CONTINUITY:
+            test_continuity_line();
+            test_step = STEP_BATTERY;
+            break;
+
+        case STEP_BATTERY:
+            // the battery under no load, from here on its minimum is the one under servo load
+            test_battery_before = get_battery_value();
+            reset_battery_statistics();
+            if (!config.use_servo) {
+                finish();
+                return 1;
             }
-        } else {
-            uint16_t start = get_timer();
-            while (get_timer() < (start - dur - dur)) {
-                _delay_us(1000);
+            start_move(now);
+            test_step = STEP_SERVO;
+            break;
+
+        case STEP_SERVO:
+            if (!update_move(now)) {
+                break;
             }
-        }
+            if (++test_move == SELF_TEST_MOVES) {
+                finish();
+                return 1;
+            }
+            start_move(now);
+            break;
     }
+    return 0;
 }
 
 /**
- * This file contains the interface to test code that is activated when the programming jumper is shorted
+ * Returns nonzero while a test is running
  */
-void test() {
-    while (1) {
-        beep_song();
+uint8_t is_self_test_running() {
+    return test_state == SELF_TEST_RUNNING;
+}
+
+/**
+ * Returns the failure flags of the last test that ran to the end, 0 if there is none
+ */
+uint8_t get_self_test_failures() {
+    if (test_state != SELF_TEST_DONE || (test_failures & SELF_TEST_ABORTED)) {
+        return 0;
     }
+    return test_failures;
+}
+
+/**
+ * Build the report of the last or the running test into data. Returns SELF_TEST_REPORT_SIZE.
+ */
+uint8_t self_test_report(uint8_t *data) {
+    uint16_t average = test_latency_samples ? test_latency_total / test_latency_samples : 0;
+    data[0] = test_state;
+    data[1] = test_failures;
+    data[2] = test_continuity;
+    data[3] = test_battery_before;
+    data[4] = test_battery_min;
+    data[5] = test_settle_time & 0xFF;
+    data[6] = test_settle_time >> 8;
+    data[7] = test_latency_max & 0xFF;
+    data[8] = test_latency_max >> 8;
+    data[9] = average & 0xFF;
+    data[10] = average >> 8;
+    return SELF_TEST_REPORT_SIZE;
 }
 
 /**
  * beeps a byte encoded on the buzzer. long beep = 1, short beep = 0. It's terminated by a normal beep.
+ * This doesn't wait for the beeps, get_buzzer_pattern() returns BUZZER_NONE once they are done.
  */
 void beep_byte(uint8_t b) {
     while (b) {
         if (b & 1) {
-            buzzer_beep(BEEP_LONG);
+            buzzer_play(BUZZER_BIT_1);
         } else {
-            buzzer_beep(BEEP_SHORT);
+            buzzer_play(BUZZER_BIT_0);
         }
         b >>= 1;
     }
-    while (buzzer_queue_length());
-    buzzer_beep(BEEP_NORMAL);
-    _delay_ms(2000);
+    buzzer_play(BUZZER_END);
 }
@@ -5,16 +5,76 @@
 #include "actuators.h"
 #include "inputs.h"
 #include "lbp.h"
+#include "events.h"
 
 /**
- * This file contains the interface to test code that is activated when the programming jumper is shorted
+ * This file contains the interface to the pre-flight self-test. The test runs from the main loop next
+ * to everything else, one step per timer tick, and only while the state machine is in IDLE:
+ * - the continuity line is pulsed low and high and read back, the detection circuit has to drive it
+ * - the servo is cycled between servo_closed_position and servo_open_position, the battery sag while it
+ *   moves tells how long the servo takes to get there and how low the battery goes under load
+ * - the main loop latency after every tick is measured, which includes the interrupts in front of it
+ * A PROFILING build times the interrupts one by one, see profiling.h.
  */
-void test();
 
+// test states
+#define SELF_TEST_IDLE          0 // no test has run since boot
+#define SELF_TEST_RUNNING       1
+#define SELF_TEST_DONE          2
+
+// failure flags of the report
+#define SELF_TEST_BATTERY       0x01 // the battery went down to battery_empty_limit under load
+#define SELF_TEST_SERVO         0x02 // the servo still drew current at the end of a move
+#define SELF_TEST_CONTINUITY    0x04 // the continuity line floats, or there is no squib in pyro mode
+#define SELF_TEST_TIMING        0x08 // the main loop was late for a tick by more than a period
+#define SELF_TEST_ABORTED       0x80 // the state machine left IDLE during the test
+
+// continuity flags of the report, the level of the squib input after it was pulled low and high.
+// Equal levels mean the line is driven, high is a squib as the state machine sees it.
+#define SELF_TEST_SQUIB_LOW_PULSE   0x01
+#define SELF_TEST_SQUIB_HIGH_PULSE  0x02
+
+// size of the report, see self_test_report()
+#define SELF_TEST_REPORT_SIZE   11
+
+/**
+ * Start the self-test. Returns 0 if the state machine isn't in IDLE or a test is running already.
+ */
+uint8_t self_test_start();
+
+/**
+ * Stop a running test and return the servo to servo_closed_position. The report is flagged SELF_TEST_ABORTED.
+ * The state machine calls this when it leaves IDLE.
+ */
+void self_test_stop();
+
+/**
+ * Advance the test. events are the EVENT_* flags that woke up the main loop. Returns nonzero once when
+ * the test has finished.
+ */
+uint8_t update_self_test(uint8_t events);
+
+/**
+ * Returns nonzero while a test is running
+ */
+uint8_t is_self_test_running();
+
+/**
+ * Returns the failure flags of the last test that ran to the end, 0 if there is none
+ */
+uint8_t get_self_test_failures();
+
+/**
+ * Build the report of the last or the running test into data. Returns SELF_TEST_REPORT_SIZE.
+ * [state][failures][continuity][battery before][battery min][servo settle time in ms (2)]
+ * [loop latency max (2)][loop latency average (2)], latencies in timer counts. Battery values are
+ * like get_battery_value().
+ */
+uint8_t self_test_report(uint8_t *data);
 
 /**
  * beeps a byte encoded on the buzzer. long beep = 1, short beep = 0. It's terminated by a normal beep.
- * This exists for debugging reasons
+ * This exists for debugging reasons, it doesn't wait for the beeps
  */
 void beep_byte(uint8_t b);
 
@@ -0,0 +1,69 @@
+#include "vote.h"
+#include "eeprom.h"
+#include "inputs.h"
+#include "actuators.h"
+
+// peers that have voted, a bit per address. The vote counts until VOTE_TIMEOUT after its time
+static volatile uint8_t votes_received;
+static volatile uint32_t vote_times[VOTE_PEER_COUNT];
+
+/**
+ * Returns the votes in votes_received that aren't stale at now. Call this with interrupts disabled.
+ */
+static uint8_t fresh_votes(uint32_t now) {
+    uint8_t votes = 0;
+    for (uint8_t i = 0; i < VOTE_PEER_COUNT; i++) {
+        if ((votes_received & (1 << i)) && now - vote_times[i] < VOTE_TIMEOUT) {
+            votes |= 1 << i;
+        }
+    }
+    return votes;
+}
+
+/**
+ * Record a vote of peer voter, with a VOTE_* reason. Votes of boards that aren't in config.vote_peers
+ * are ignored. Returns nonzero if the peer votes now and didn't before, or the other way around.
+ * Only call this from the main loop.
+ */
+uint8_t record_vote(uint8_t voter, uint8_t reason) {
+    if (voter >= VOTE_PEER_COUNT || !(config.vote_peers & (1 << voter))) {
+        return 0;
+    }
+
+    uint8_t bit = 1 << voter;
+    uint8_t before;
+    ATOMIC(
+        uint32_t now = get_time();
+        before = fresh_votes(now) & bit;
+        if (reason == VOTE_NONE) {
+            votes_received &= ~bit;
+        } else {
+            vote_times[voter] = now;
+            votes_received |= bit;
+        }
+    );
+    return !before != (reason == VOTE_NONE);
+}
+
+/**
+ * Returns the peers whose vote isn't stale, a bit per address like config.vote_peers.
+ * Safe to call from interrupt context.
+ */
+uint8_t get_peer_votes() {
+    uint8_t votes;
+    NESTED_ATOMIC(votes = fresh_votes(get_time()););
+    return votes;
+}
+
+/**
+ * Returns the amount of votes for deploying: the vote in pin and the peers in votes, which is a mask
+ * like get_peer_votes(). Safe to call from interrupt context.
+ */
+uint8_t count_votes(uint8_t votes) {
+    uint8_t count = is_vote_asserted() ? 1 : 0;
+    while (votes) {
+        count += votes & 1;
+        votes >>= 1;
+    }
+    return count;
+}
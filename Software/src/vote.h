@@ -0,0 +1,47 @@
+#ifndef _VOTE_H_
+#define _VOTE_H_
+
+#include "config.h"
+
+/**
+ * This file contains the deploy votes of peer boards. Next to the vote in pin, other boards of a
+ * redundant recovery stack (an altimeter detecting apogee, another SRP running out of time) can vote
+ * for deploying with LBP_DEPLOY_VOTE broadcasts. config.vote_peers selects the boards that count by
+ * their lbp_address, config.vote_quorum how many votes out of the pin and those peers deploy.
+ * A peer repeats its vote, one that hasn't been repeated within VOTE_TIMEOUT is stale and doesn't count.
+ * Votes are timestamped when they are received, the clocks of the boards don't have to agree.
+ * The default quorum of 1 without peers is the vote in pin alone.
+ */
+
+// peers are the addresses 0 to VOTE_PEER_COUNT - 1, a bit each in vote_peers
+#define VOTE_PEER_COUNT     8
+
+// a peer vote counts for this long after it was received
+#define VOTE_TIMEOUT        TIME_FROM_MS(500)
+
+// vote reasons, for the log. VOTE_NONE withdraws a vote
+#define VOTE_NONE           0
+#define VOTE_APOGEE         1
+#define VOTE_TIMER          2
+#define VOTE_OTHER          3
+
+/**
+ * Record a vote of peer voter, with a VOTE_* reason. Votes of boards that aren't in config.vote_peers
+ * are ignored. Returns nonzero if the peer votes now and didn't before, or the other way around.
+ * Only call this from the main loop.
+ */
+uint8_t record_vote(uint8_t voter, uint8_t reason);
+
+/**
+ * Returns the peers whose vote isn't stale, a bit per address like config.vote_peers.
+ * Safe to call from interrupt context.
+ */
+uint8_t get_peer_votes();
+
+/**
+ * Returns the amount of votes for deploying: the vote in pin and the peers in votes, which is a mask
+ * like get_peer_votes(). Safe to call from interrupt context.
+ */
+uint8_t count_votes(uint8_t votes);
+
+#endif